@@ -0,0 +1,596 @@
+/*
+
+Copyright (c) 2012, Alexandre Girao <alexgirao@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+ * ADPCM packet decoder
+ *
+ * decode_packet() is written once for any (bits per code, channels)
+ * and always inlined into the adpcm_<kernel>_<bits>_<channels>
+ * instances below, so each of them is compiled with constant shifts,
+ * masks and loop bounds; the per code update is branch free
+ *
+ * kernels
+ *
+ *   fused   the bit reader feeds the state update code by code
+ *   unpack  a first pass splits the packet codes to one byte each, 8
+ *           codes per 64 bit load, the state update then only reads
+ *           bytes
+ *   pdep    unpack with the split done by one BMI2 pdep per 8 codes,
+ *           picked at run time when the cpu has it
+ *   prefix  unpack (pdep when there is bmi2), then the index chain,
+ *           differences and a clamped prefix sum as separate passes,
+ *           see below (experimental)
+ *   table   one lookup per 8 bits of 2 and 4 bit mono codes, fused for
+ *           the other layouts
+ *
+ * reference: http://www.adobe.com/content/dam/Adobe/en/devnet/swf/pdf/swf_file_format_spec_v10.pdf
+ * reference: doc/imaadpcm.cpp and doc/imaadpcm.h
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_PDEP 1
+#endif
+
+#include "adpcm.h"
+#include "adpcm_core.h"
+
+int adpcm_kernel = ADPCM_KERNEL_FUSED;
+
+static const char *const kernel_names[ADPCM_KERNEL_COUNT] = {
+	[ADPCM_KERNEL_FUSED] = "fused",
+	[ADPCM_KERNEL_UNPACK] = "unpack",
+	[ADPCM_KERNEL_PDEP] = "pdep",
+	[ADPCM_KERNEL_PREFIX] = "prefix",
+	[ADPCM_KERNEL_TABLE] = "table",
+};
+
+/* writes n codes starting at bitpos to one byte each
+ */
+typedef void unpack_fn(const unsigned char *buf, int64_t nbits, int64_t bitpos, int n, uint8_t *codes);
+
+/* the 8 codes at bitpos, right aligned, 8 * bits + 7 <= 64
+ */
+static ALWAYS_INLINE uint64_t load_group(const unsigned char *buf, int64_t bitpos, const int bits)
+{
+	return load_be64(buf + (bitpos >> 3)) << (bitpos & 7) >> (64 - 8 * bits);
+}
+
+/* whole groups while a 64 bit load stays inside buf, returns the codes
+ * done; the rest goes through the bit reader
+ */
+static ALWAYS_INLINE int unpack_groups(const unsigned char *buf, int64_t nbits, int64_t bitpos, int n, uint8_t *codes, const int bits)
+{
+	const int64_t last = ((nbits + 7) >> 3) - 8;
+	int i, k;
+
+	for (i = 0; i + 8 <= n && (bitpos >> 3) <= last; i += 8, bitpos += 8 * bits) {
+		uint64_t g = load_group(buf, bitpos, bits);
+		for (k = 0; k < 8; k++) {
+			codes[i + k] = (g >> (bits * (7 - k))) & ((1 << bits) - 1);
+		}
+	}
+	return i;
+}
+
+static ALWAYS_INLINE void unpack_rest(const unsigned char *buf, int64_t nbits, int64_t bitpos, int i, int n, uint8_t *codes, const int bits)
+{
+	struct bitreader br[1];
+
+	if (i == n) {
+		return;
+	}
+	br_init(br, buf, nbits, bitpos + (int64_t)i * bits);
+	for (; i < n; i++) {
+		codes[i] = br_get(br, bits);
+	}
+}
+
+static ALWAYS_INLINE void unpack_codes(const unsigned char *buf, int64_t nbits, int64_t bitpos, int n, uint8_t *codes, const int bits)
+{
+	int i = unpack_groups(buf, nbits, bitpos, n, codes, bits);
+	unpack_rest(buf, nbits, bitpos, i, n, codes, bits);
+}
+
+#ifdef HAVE_PDEP
+/* pdep drops the 8 fields into the low bits of the 8 bytes, the last
+ * code lowest, the byte swap puts the first code first in memory
+ */
+__attribute__((target("bmi2")))
+static ALWAYS_INLINE void unpack_codes_pdep(const unsigned char *buf, int64_t nbits, int64_t bitpos, int n, uint8_t *codes, const int bits)
+{
+	const uint64_t mask = 0x0101010101010101ull * ((1 << bits) - 1);
+	const int64_t last = ((nbits + 7) >> 3) - 8;
+	int i;
+
+	for (i = 0; i + 8 <= n && ((bitpos + (int64_t)i * bits) >> 3) <= last; i += 8) {
+		uint64_t x = _pdep_u64(load_group(buf, bitpos + (int64_t)i * bits, bits), mask);
+		x = __builtin_bswap64(x);
+		memcpy(codes + i, &x, 8);
+	}
+	unpack_rest(buf, nbits, bitpos, i, n, codes, bits);
+}
+#endif
+
+/* the prefix kernel
+ *
+ * the index sequence depends on the codes alone, so a packet is taken
+ * in passes: the index chain gives every code its step, the signed
+ * differences then follow code by code independently, and the samples
+ * are their running sum clamped to 16 bits, which is a plain prefix sum
+ * as long as no partial sum leaves the range
+ *
+ * the chain itself is walked CHAIN_MAG_BITS of code magnitudes at a
+ * time through chain_table, the steps in between hang off the start of
+ * each group and are out of the critical path
+ */
+
+#define CHAIN_MAG_BITS 6
+#define CHAIN_CODES(bits) ((bits) < 5 ? CHAIN_MAG_BITS / ((bits) - 1) : 1)
+
+/* index after CHAIN_CODES(bits) codes from index, for bits 2, 3 and 4,
+ * the first code in the upper magnitude bits
+ */
+static uint8_t chain_table[3][89][1 << CHAIN_MAG_BITS];
+static pthread_once_t chain_once = PTHREAD_ONCE_INIT;
+
+static ALWAYS_INLINE int index_step(int index, unsigned code, const int bits)
+{
+	index += indexAdjustTable[bits - 2][code & ((1 << (bits - 1)) - 1)];
+	index = index < 0 ? 0 : index;
+	return index > 88 ? 88 : index;
+}
+
+static void chain_init(void)
+{
+	int bits, index, m, k;
+
+	for (bits = 2; bits < 5; bits++) {
+		const int n = CHAIN_CODES(bits);
+		for (index = 0; index < 89; index++) {
+			for (m = 0; m < 1 << CHAIN_MAG_BITS; m++) {
+				int j = index;
+				for (k = 0; k < n; k++) {
+					j = index_step(j, m >> ((bits - 1) * (n - 1 - k)), bits);
+				}
+				chain_table[bits - 2][index][m] = j;
+			}
+		}
+	}
+}
+
+static ALWAYS_INLINE void index_chain(const uint8_t *codes, int n, int index, int32_t *steps, const int bits)
+{
+	const int group = CHAIN_CODES(bits);
+	const int mag = (1 << (bits - 1)) - 1;
+	int i = 0, k;
+
+	if (bits < 5) {
+		for (; i + group <= n; i += group) {
+			int j = index, m = 0;
+			for (k = 0; k < group; k++) {
+				steps[i + k] = stepSizeTable[j];
+				j = index_step(j, codes[i + k], bits);
+				m = m << (bits - 1) | (codes[i + k] & mag);
+			}
+			index = chain_table[bits - 2][index][m];
+		}
+	}
+	for (; i < n; i++) {
+		steps[i] = stepSizeTable[index];
+		index = index_step(index, codes[i], bits);
+	}
+}
+
+/* steps in, differences out, the arithmetic of decode_code() four
+ * codes at a time
+ */
+static ALWAYS_INLINE void code_differences(const uint8_t *codes, int n, int32_t *diffs, const int bits)
+{
+	int i = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; i + 4 <= n; i += 4) {
+		int32_t c4, k;
+		__m128i step = _mm_loadu_si128((const __m128i*)(diffs + i)), code, bit, sign, difference;
+
+		memcpy(&c4, codes + i, 4);
+		code = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(c4), zero), zero);
+		difference = _mm_srai_epi32(step, bits - 1);
+#pragma GCC unroll 4
+		for (k = 0; k < bits - 1; k++) {
+			bit = _mm_set1_epi32(1 << k);
+			bit = _mm_cmpeq_epi32(_mm_and_si128(code, bit), bit);
+			difference = _mm_add_epi32(difference, _mm_and_si128(bit, _mm_srai_epi32(step, bits - 2 - k)));
+		}
+		bit = _mm_set1_epi32(1 << (bits - 1));
+		sign = _mm_cmpeq_epi32(_mm_and_si128(code, bit), bit);
+		difference = _mm_sub_epi32(_mm_xor_si128(difference, sign), sign);
+		_mm_storeu_si128((__m128i*)(diffs + i), difference);
+	}
+#endif
+	for (; i < n; i++) {
+		diffs[i] = code_difference(codes[i], diffs[i], bits);
+	}
+}
+
+/* out[i] = clamp(sample + diffs[0] + ... + diffs[i]) with the clamp at
+ * every step, four at a time while none of the four partial sums
+ * leaves the 16 bit range, in which case the clamps are no-ops
+ */
+static ALWAYS_INLINE void clamped_prefix_sum(const int32_t *diffs, int n, int sample, int16_t *out)
+{
+	int i = 0, k;
+#ifdef __SSE2__
+	const __m128i lo = _mm_set1_epi32(-32768), hi = _mm_set1_epi32(32767);
+	__m128i prev = _mm_set1_epi32(sample);
+
+	while (i + 4 <= n) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(diffs + i));
+		x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+		x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+		x = _mm_add_epi32(x, prev);
+		if (_mm_movemask_epi8(_mm_or_si128(_mm_cmpgt_epi32(x, hi), _mm_cmplt_epi32(x, lo)))) {
+			/* near clipping, these four one by one
+			 */
+			sample = _mm_cvtsi128_si32(prev);
+			for (k = 0; k < 4; k++, i++) {
+				sample += diffs[i];
+				sample = sample > 32767 ? 32767 : sample;
+				sample = sample < -32768 ? -32768 : sample;
+				out[i] = sample;
+			}
+			prev = _mm_set1_epi32(sample);
+			continue;
+		}
+		_mm_storel_epi64((__m128i*)(out + i), _mm_packs_epi32(x, x));
+		prev = _mm_shuffle_epi32(x, 0xff);
+		i += 4;
+	}
+	sample = _mm_cvtsi128_si32(prev);
+#endif
+	for (; i < n; i++) {
+		sample += diffs[i];
+		sample = sample > 32767 ? 32767 : sample;
+		sample = sample < -32768 ? -32768 : sample;
+		out[i] = sample;
+	}
+}
+
+/* the table kernel
+ *
+ * for 2 and 4 bit mono, 8 bits of the stream hold 4 or 2 whole codes of
+ * one channel, and both the differences they add and the index after
+ * them depend on nothing but (index, those 8 bits), so one lookup
+ * stands for all of them and only the clamped adds stay per code
+ */
+
+#define BYTE_CODES(bits) (8 / (bits))
+
+static int32_t byte_diffs_2[89][256][BYTE_CODES(2)];
+static int32_t byte_diffs_4[89][256][BYTE_CODES(4)];
+static uint8_t byte_next[2][89][256]; /* 2 and 4 bits */
+static pthread_once_t byte_once = PTHREAD_ONCE_INIT;
+
+static void byte_table_init_bits(const int bits)
+{
+	int index, byte, k;
+
+	for (index = 0; index < 89; index++) {
+		for (byte = 0; byte < 256; byte++) {
+			int32_t *d = bits == 2 ? byte_diffs_2[index][byte] : byte_diffs_4[index][byte];
+			int j = index;
+			for (k = 0; k < BYTE_CODES(bits); k++) {
+				unsigned code = (byte >> (8 - bits * (k + 1))) & ((1 << bits) - 1);
+				d[k] = code_difference(code, stepSizeTable[j], bits);
+				j = index_step(j, code, bits);
+			}
+			byte_next[bits == 4][index][byte] = j;
+		}
+	}
+}
+
+static void byte_table_init(void)
+{
+	byte_table_init_bits(2);
+	byte_table_init_bits(4);
+}
+
+/* how decode_packet() walks the codes
+ */
+enum packet_loop {
+	LOOP_CODES,  /* one by one, from the bit reader or unpacked */
+	LOOP_PREFIX, /* the prefix kernel passes */
+	LOOP_BYTES   /* the table kernel, LOOP_CODES where it does not apply */
+};
+
+/* unpack is NULL for the fused and table kernels, a constant either
+ * way, like loop
+ */
+static ALWAYS_INLINE int decode_packet(const unsigned char *buf, int64_t nbits, int64_t *bitpos, int16_t *out, unpack_fn *unpack, const int loop, const int bits, const int channels)
+{
+	struct adpcm_state state[2];
+	struct bitreader br[1];
+	uint8_t codes[ADPCM_PACKET_CODES * 2];
+	int64_t avail = nbits - *bitpos;
+	int ncodes, i, c;
+
+	if (avail < ADPCM_PACKET_HEADER_BITS * channels) {
+		return 0;
+	}
+
+	avail -= ADPCM_PACKET_HEADER_BITS * channels;
+	ncodes = avail / (bits * channels) > ADPCM_PACKET_CODES ? ADPCM_PACKET_CODES : avail / (bits * channels);
+
+	br_init(br, buf, nbits, *bitpos);
+
+	for (c = 0; c < channels; c++) {
+		state[c].sample = (int16_t)br_get(br, 16); /* SI16 InitialSample */
+		state[c].index = br_get(br, 6);            /* UB[6] InitialIndex */
+		*out++ = state[c].sample;
+	}
+
+	if (loop == LOOP_BYTES && channels == 1 && (bits == 2 || bits == 4)) {
+		const int32_t *diffs = bits == 2 ? byte_diffs_2[0][0] : byte_diffs_4[0][0];
+		const uint8_t (*next)[256] = byte_next[bits == 4];
+		int index = state[0].index, sample = state[0].sample, k;
+
+		for (i = 0; i + BYTE_CODES(bits) <= ncodes; i += BYTE_CODES(bits)) {
+			const unsigned byte = br_get(br, 8);
+			const int32_t *d = diffs + (index * 256 + byte) * BYTE_CODES(bits);
+			for (k = 0; k < BYTE_CODES(bits); k++) {
+				sample += d[k];
+				sample = sample > 32767 ? 32767 : sample;
+				sample = sample < -32768 ? -32768 : sample;
+				*out++ = sample;
+			}
+			index = next[index][byte];
+		}
+		state[0].index = index;
+		state[0].sample = sample;
+		for (; i < ncodes; i++) {
+			*out++ = decode_code(br_get(br, bits), &state[0], bits);
+		}
+	} else if (loop == LOOP_PREFIX) {
+		uint8_t split[ADPCM_PACKET_CODES];
+		int32_t diffs[ADPCM_PACKET_CODES];
+		int16_t samples[ADPCM_PACKET_CODES];
+
+		unpack(buf, nbits, *bitpos + ADPCM_PACKET_HEADER_BITS * channels, ncodes * channels, codes);
+		for (c = 0; c < channels; c++) {
+			const uint8_t *code = codes;
+			if (channels == 2) {
+				for (i = 0; i < ncodes; i++) {
+					split[i] = codes[2 * i + c];
+				}
+				code = split;
+			}
+			index_chain(code, ncodes, state[c].index, diffs, bits);
+			code_differences(code, ncodes, diffs, bits);
+			if (channels == 1) {
+				clamped_prefix_sum(diffs, ncodes, state[0].sample, out);
+			} else {
+				clamped_prefix_sum(diffs, ncodes, state[c].sample, samples);
+				for (i = 0; i < ncodes; i++) {
+					out[2 * i + c] = samples[i];
+				}
+			}
+		}
+	} else if (unpack) {
+		const uint8_t *code = codes;
+
+		unpack(buf, nbits, *bitpos + ADPCM_PACKET_HEADER_BITS * channels, ncodes * channels, codes);
+		for (i = 0; i < ncodes; i++) {
+			for (c = 0; c < channels; c++) {
+				*out++ = decode_code(*code++, &state[c], bits);
+			}
+		}
+	} else {
+		for (i = 0; i < ncodes; i++) {
+			for (c = 0; c < channels; c++) {
+				*out++ = decode_code(br_get(br, bits), &state[c], bits);
+			}
+		}
+	}
+
+	*bitpos += (int64_t)ADPCM_PACKET_HEADER_BITS * channels + (int64_t)ncodes * bits * channels;
+
+	return ncodes + 1;
+}
+
+#define DEFINE_UNPACK(bits)						\
+	static void unpack_##bits(const unsigned char *buf, int64_t nbits, int64_t bitpos, int n, uint8_t *codes) \
+	{								\
+		unpack_codes(buf, nbits, bitpos, n, codes, bits);	\
+	}
+
+DEFINE_UNPACK(2)
+DEFINE_UNPACK(3)
+DEFINE_UNPACK(4)
+DEFINE_UNPACK(5)
+
+#ifdef HAVE_PDEP
+#define DEFINE_UNPACK_PDEP(bits)					\
+	__attribute__((target("bmi2")))					\
+	static void unpack_pdep_##bits(const unsigned char *buf, int64_t nbits, int64_t bitpos, int n, uint8_t *codes) \
+	{								\
+		unpack_codes_pdep(buf, nbits, bitpos, n, codes, bits);	\
+	}
+
+DEFINE_UNPACK_PDEP(2)
+DEFINE_UNPACK_PDEP(3)
+DEFINE_UNPACK_PDEP(4)
+DEFINE_UNPACK_PDEP(5)
+#endif
+
+#define DEFINE_DECODER(kernel, unpack, loop, bits, channels)		\
+	static int adpcm_##kernel##_##bits##_##channels(const struct adpcm_stream *st, const unsigned char *buf, int64_t nbits, int64_t *bitpos, int16_t *out) \
+	{								\
+		return decode_packet(buf, nbits, bitpos, out, unpack, loop, bits, channels); \
+	}
+
+#define DEFINE_DECODERS(kernel, loop, unpack2, unpack3, unpack4, unpack5) \
+	DEFINE_DECODER(kernel, unpack2, loop, 2, 1)			\
+	DEFINE_DECODER(kernel, unpack3, loop, 3, 1)			\
+	DEFINE_DECODER(kernel, unpack4, loop, 4, 1)			\
+	DEFINE_DECODER(kernel, unpack5, loop, 5, 1)			\
+	DEFINE_DECODER(kernel, unpack2, loop, 2, 2)			\
+	DEFINE_DECODER(kernel, unpack3, loop, 3, 2)			\
+	DEFINE_DECODER(kernel, unpack4, loop, 4, 2)			\
+	DEFINE_DECODER(kernel, unpack5, loop, 5, 2)
+
+#define DECODERS(kernel) {						\
+		{adpcm_##kernel##_2_1, adpcm_##kernel##_3_1, adpcm_##kernel##_4_1, adpcm_##kernel##_5_1}, \
+		{adpcm_##kernel##_2_2, adpcm_##kernel##_3_2, adpcm_##kernel##_4_2, adpcm_##kernel##_5_2} \
+	}
+
+DEFINE_DECODERS(fused, LOOP_CODES, NULL, NULL, NULL, NULL)
+DEFINE_DECODERS(unpack, LOOP_CODES, unpack_2, unpack_3, unpack_4, unpack_5)
+#ifdef HAVE_PDEP
+DEFINE_DECODERS(pdep, LOOP_CODES, unpack_pdep_2, unpack_pdep_3, unpack_pdep_4, unpack_pdep_5)
+#endif
+DEFINE_DECODERS(prefix, LOOP_PREFIX, unpack_2, unpack_3, unpack_4, unpack_5)
+#ifdef HAVE_PDEP
+DEFINE_DECODERS(prefix_pdep, LOOP_PREFIX, unpack_pdep_2, unpack_pdep_3, unpack_pdep_4, unpack_pdep_5)
+#endif
+DEFINE_DECODERS(table, LOOP_BYTES, NULL, NULL, NULL, NULL)
+
+static adpcm_packet_fn *const decoders[ADPCM_KERNEL_COUNT][2][4] = {
+	[ADPCM_KERNEL_FUSED] = DECODERS(fused),
+	[ADPCM_KERNEL_UNPACK] = DECODERS(unpack),
+#ifdef HAVE_PDEP
+	[ADPCM_KERNEL_PDEP] = DECODERS(pdep),
+#endif
+	[ADPCM_KERNEL_PREFIX] = DECODERS(prefix),
+	[ADPCM_KERNEL_TABLE] = DECODERS(table),
+};
+
+#ifdef HAVE_PDEP
+/* the prefix kernel splits the codes with pdep when it can
+ */
+static adpcm_packet_fn *const prefix_pdep_decoders[2][4] = DECODERS(prefix_pdep);
+#endif
+
+int adpcm_kernel_from_name(const char *name)
+{
+	int i;
+	for (i=0; i<ADPCM_KERNEL_COUNT; i++) {
+		if (strcmp(kernel_names[i], name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+const char *adpcm_kernel_name(int kernel)
+{
+	assert(kernel >= 0 && kernel < ADPCM_KERNEL_COUNT);
+	return kernel_names[kernel];
+}
+
+int adpcm_kernel_supported(int kernel)
+{
+	if (kernel < 0 || kernel >= ADPCM_KERNEL_COUNT || !decoders[kernel][0][0]) {
+		return 0;
+	}
+#ifdef HAVE_PDEP
+	if (kernel == ADPCM_KERNEL_PDEP) {
+		return __builtin_cpu_supports("bmi2");
+	}
+#endif
+	return 1;
+}
+
+int adpcm_stream_kernel(struct adpcm_stream *st, int kernel)
+{
+	if (!adpcm_kernel_supported(kernel)) {
+		return -1;
+	}
+	st->decode_packet = decoders[kernel][st->channels - 1][st->code_size];
+	if (kernel == ADPCM_KERNEL_PREFIX) {
+		pthread_once(&chain_once, chain_init);
+#ifdef HAVE_PDEP
+		if (adpcm_kernel_supported(ADPCM_KERNEL_PDEP)) {
+			st->decode_packet = prefix_pdep_decoders[st->channels - 1][st->code_size];
+		}
+#endif
+	}
+	if (kernel == ADPCM_KERNEL_TABLE) {
+		pthread_once(&byte_once, byte_table_init);
+	}
+	return 0;
+}
+
+int adpcm_stream_init(struct adpcm_stream *st, const unsigned char *buf, int channels)
+{
+	if (channels != 1 && channels != 2) {
+		return -1;
+	}
+	st->code_size = buf[0] >> 6; /* UB[2] */
+	st->bits_per_code = st->code_size + 2;
+	st->channels = channels;
+	st->packet_bits = (int64_t)channels * (ADPCM_PACKET_HEADER_BITS + ADPCM_PACKET_CODES * st->bits_per_code);
+	return adpcm_stream_kernel(st, adpcm_kernel);
+}
+
+void adpcm_stream_layout(const struct adpcm_stream *st, int64_t nbits, struct adpcm_layout *layout)
+{
+	int64_t avail = nbits - ADPCM_STREAM_START;
+	int64_t rem;
+
+	layout->packets = 0;
+	layout->samples = 0;
+
+	if (avail <= 0) {
+		return;
+	}
+
+	/* every packet but the last is full
+	 */
+	layout->packets = avail / st->packet_bits;
+	layout->samples = layout->packets * ADPCM_PACKET_SAMPLES;
+
+	rem = avail % st->packet_bits;
+	if (rem >= ADPCM_PACKET_HEADER_BITS * st->channels) {
+		layout->packets++;
+		layout->samples += 1 + (rem - ADPCM_PACKET_HEADER_BITS * st->channels) / (st->bits_per_code * st->channels);
+	}
+}
@@ -0,0 +1,98 @@
+#ifndef w5hq1c8vzr3ka0yt6e /* adpcm-h */
+#define w5hq1c8vzr3ka0yt6e /* adpcm-h */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" { /* assume C declarations for C++ */
+#endif
+
+/* ADPCMSOUNDDATA (SWF File Format Specification Version 10)
+ *
+ *   UB[2]  AdpcmCodeSize (bits per code - 2)
+ *   ADPCMMONOPACKET or ADPCMSTEREOPACKET, repeated
+ *
+ * each packet carries, per channel, SI16 InitialSample and UB[6]
+ * InitialIndex followed by up to 4095 codes (interleaved for stereo),
+ * packets are not byte aligned
+ */
+
+#define ADPCM_PACKET_CODES 4095
+#define ADPCM_PACKET_SAMPLES 4096 /* per channel, initial sample included */
+#define ADPCM_PACKET_HEADER_BITS 22 /* per channel */
+
+struct adpcm_state {
+	int index;
+	int sample;
+};
+
+struct adpcm_stream;
+
+typedef int adpcm_packet_fn(const struct adpcm_stream *st, const unsigned char *buf, int64_t nbits, int64_t *bitpos, int16_t *out);
+
+struct adpcm_stream {
+	int code_size; /* AdpcmCodeSize */
+	int bits_per_code;
+	int channels;
+	int64_t packet_bits; /* size of a full packet */
+	adpcm_packet_fn *decode_packet;
+};
+
+/* packet decoding kernels, all give the same samples, see adpcm.c
+ */
+enum adpcm_kernel {
+	ADPCM_KERNEL_FUSED,
+	ADPCM_KERNEL_UNPACK,
+	ADPCM_KERNEL_PDEP,
+	ADPCM_KERNEL_PREFIX,
+	ADPCM_KERNEL_TABLE,
+	ADPCM_KERNEL_COUNT
+};
+
+/* kernel taken by adpcm_stream_init, only set it to a supported one
+ */
+extern int adpcm_kernel;
+
+int adpcm_kernel_from_name(const char *name);
+const char *adpcm_kernel_name(int kernel);
+int adpcm_kernel_supported(int kernel);
+
+/* reads AdpcmCodeSize from the first byte of buf and selects the
+ * specialized decoder, returns -1 on invalid channel count
+ */
+int adpcm_stream_init(struct adpcm_stream *st, const unsigned char *buf, int channels);
+
+/* switches an initialized stream to another kernel, returns -1 when it
+ * is not supported here
+ */
+int adpcm_stream_kernel(struct adpcm_stream *st, int kernel);
+
+/* the bit position of the first packet
+ */
+#define ADPCM_STREAM_START 2
+
+/* stream layout from the code size and payload length alone, samples
+ * are per channel
+ */
+struct adpcm_layout {
+	int64_t packets;
+	int64_t samples;
+};
+
+void adpcm_stream_layout(const struct adpcm_stream *st, int64_t nbits, struct adpcm_layout *layout);
+
+/* decodes the packet starting at *bitpos (buf holds nbits), writes
+ * interleaved samples to out (room for ADPCM_PACKET_SAMPLES * channels)
+ * and advances *bitpos, returns samples per channel or 0 when there is
+ * no room left for a packet header
+ */
+static inline int adpcm_decode_packet(const struct adpcm_stream *st, const unsigned char *buf, int64_t nbits, int64_t *bitpos, int16_t *out)
+{
+	return st->decode_packet(st, buf, nbits, bitpos, out);
+}
+
+#ifdef __cplusplus
+}; /* end of function prototypes */
+#endif
+
+#endif /* ! w5hq1c8vzr3ka0yt6e adpcm-h */
@@ -0,0 +1,592 @@
+/*
+
+Copyright (c) 2012, Alexandre Girao <alexgirao@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ *
+ *
+ * adpcm_bench
+ *
+ * microbenchmarks of the decode kernels on synthetic streams, results
+ * are json lines on stdout
+ *
+ *   mixer:  voices mixed per audio callback by the fused decode-and-mix
+ *           kernel of mixer.c against decoding to s16 and then mixing
+ *   decode: packet decoding throughput of every kernel of adpcm.c for
+ *           each bits per code, on encoded tones or random codes, with
+ *           the speedup over the fused kernel
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "debug0.h"
+
+#include "str.h"
+#include "stats.h"
+#include "adpcm.h"
+#include "adpcm_core.h"
+#include "mixer.h"
+
+#include "bsd-getopt_long.h"
+#include "getopt_x.h"
+
+static const char *options_short = NULL;
+static const char *options_mandatory = NULL;
+
+static struct option options_long[] = {
+	{.val='b', .name="bench", .has_arg=1},
+	{.val='i', .name="input", .has_arg=1},
+	{.val='c', .name="code-bits", .has_arg=1},
+	{.val='s', .name="stereo"},
+	{.val='r', .name="rate", .has_arg=1},
+	{.val='p', .name="period", .has_arg=1},
+	{.val='V', .name="voices", .has_arg=1},
+	{.val='n', .name="callbacks", .has_arg=1},
+	{.val='m', .name="megabytes", .has_arg=1},
+	{.val='g', .name="signal", .has_arg=1},
+	{.val='h', .name="help"},
+	{.name=NULL}
+};
+
+struct args {
+	const char *bench;
+	const char *input;
+	int code_bits;
+	int is_stereo;
+	int rate;
+	double period_ms;
+	int voices;
+	int callbacks;
+	int megabytes;
+	const char *signal;
+} args[1] = {{.signal = "tone", .bench = "mixer", .code_bits = 4, .rate = 44100, .period_ms = 5, .voices = 256, .callbacks = 2000, .megabytes = 16}};
+
+/* sub or zero */
+#define SOZ(a,b) ((a) > (b) ? (a) - (b) : 0)
+
+static void help(const char *argv0, struct getopt_x *state)
+{
+	char buf[4096];
+	int bufsz = sizeof(buf);
+	struct option opt[1];
+	int pos = 0;
+	int c = 0;
+
+	pos += snprintf(buf + pos, SOZ(bufsz,pos), "\n");
+	pos += snprintf(buf + pos, SOZ(bufsz,pos), "  usage: %s [options] ...\n", argv0);
+	pos += snprintf(buf + pos, SOZ(bufsz,pos), "  options:\n");
+	pos += snprintf(buf + pos, SOZ(bufsz,pos), "\n");
+
+	while ((c = getopt_x_option(state, c, opt)) >= 0) {
+		pos += getopt_x_option_format(buf + pos, bufsz - pos, state, opt);
+		switch (opt->val) {
+		case 'b':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "mixer (default) or decode\n");
+			break;
+		case 'i':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "ADPCMSOUNDDATA every voice plays (default: random data)\n");
+			break;
+		case 'c':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "bits per code of the random data, 2 to 5 (default 4)\n");
+			break;
+		case 's':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "stereo voices\n");
+			break;
+		case 'r':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "sample rate (default 44100)\n");
+			break;
+		case 'p':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "callback period in milliseconds (default 5)\n");
+			break;
+		case 'V':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "most voices tried, doubling from 1 (default 256)\n");
+			break;
+		case 'n':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "callbacks timed per voice count (default 2000)\n");
+			break;
+		case 'm':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "data decoded per run of the decode bench (default 16)\n");
+			break;
+		case 'g':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "decode bench data: tone (default, encoded tones and noise) or random codes\n");
+			break;
+		case 'h':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "\n");
+			break;
+		default:
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "undocumented\n");
+		}
+		if (pos >= bufsz) {
+			LOG(D0_ERROR, "buffer too small");
+			exit(1);
+		}
+	}
+	pos += snprintf(buf + pos, SOZ(bufsz,pos), "\n");
+
+	fputs(buf, stderr);
+}
+
+static int process_args(struct getopt_x *state, int argc, char **argv)
+{
+	int c;
+	if (getopt_x_prepare(state, argc, argv, options_short, options_long, options_mandatory)) {
+		LOG(D0_ERROR, "error: failed to parse options");
+		exit(1);
+	}
+	do {
+		struct option *opt;
+		switch (c = getopt_x_next(state, &opt)) {
+		case 'b': args->bench = optarg; break;
+		case 'i': args->input = optarg; break;
+		case 'c':
+			if ((args->code_bits = atoi(optarg)) < 2 || args->code_bits > 5) {
+				LOG(D0_ERROR, "error: invalid bits per code [%s]", optarg);
+				return -1;
+			}
+			break;
+		case 's': args->is_stereo = 1; break;
+		case 'r':
+			if ((args->rate = atoi(optarg)) <= 0) {
+				LOG(D0_ERROR, "error: invalid rate [%s]", optarg);
+				return -1;
+			}
+			break;
+		case 'p':
+			if ((args->period_ms = atof(optarg)) <= 0) {
+				LOG(D0_ERROR, "error: invalid period [%s]", optarg);
+				return -1;
+			}
+			break;
+		case 'V':
+			if ((args->voices = atoi(optarg)) <= 0) {
+				LOG(D0_ERROR, "error: invalid voice count [%s]", optarg);
+				return -1;
+			}
+			break;
+		case 'n':
+			if ((args->callbacks = atoi(optarg)) <= 0) {
+				LOG(D0_ERROR, "error: invalid callback count [%s]", optarg);
+				return -1;
+			}
+			break;
+		case 'm':
+			if ((args->megabytes = atoi(optarg)) <= 0) {
+				LOG(D0_ERROR, "error: invalid size [%s]", optarg);
+				return -1;
+			}
+			break;
+		case 'g':
+			if (strcmp(optarg, "tone") != 0 && strcmp(optarg, "random") != 0) {
+				LOG(D0_ERROR, "error: unknown signal [%s]", optarg);
+				return -1;
+			}
+			args->signal = optarg;
+			break;
+		case 'h': help(argv[0], state); exit(0);
+		case -1: break;
+		default:
+			getopt_x_option_debug(state, c, opt);
+			return -1;
+		}
+	} while (c != -1);
+	return state->got_error;
+}
+
+/* xorshift64*, the runs have to be repeatable
+ */
+static uint64_t rng = 0x9e3779b97f4a7c15ull;
+
+static uint64_t rand64(void)
+{
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return rng * 0x2545f4914f6cdd1dull;
+}
+
+static float randf(void)
+{
+	return (rand64() >> 40) / (float)(1 << 24);
+}
+
+/* one second of random codes per voice, headers included, any bit
+ * pattern is a valid stream
+ */
+static void random_stream(struct str *s, int bits, int channels, int rate)
+{
+	int64_t len = ((int64_t)rate * bits * channels + 7) / 8 + 1, i;
+
+	str_alloc(s, len + 8);
+	for (i=0; i<len; i+=8) {
+		uint64_t r = rand64();
+		memcpy(s->s + i, &r, 8);
+	}
+	s->len = len;
+	s->s[0] = (s->s[0] & 0x3f) | (bits - 2) << 6; /* AdpcmCodeSize */
+}
+
+/* the two pass baseline: a voice decoded to s16 a packet at a time,
+ * then mixed
+ */
+struct s16_voice {
+	struct adpcm_stream stream[1];
+	const unsigned char *buf;
+	int64_t nbits, bitpos;
+	int16_t pcm[ADPCM_PACKET_SAMPLES * 2];
+	int pos, n; /* frames */
+	float gain[2];
+};
+
+static void s16_voice_decode(struct s16_voice *v, int16_t *out, int frames)
+{
+	const int channels = v->stream->channels;
+
+	while (frames > 0) {
+		int k;
+		if (v->pos == v->n) {
+			if ((v->n = adpcm_decode_packet(v->stream, v->buf, v->nbits, &v->bitpos, v->pcm)) == 0) {
+				v->bitpos = ADPCM_STREAM_START; /* loop */
+				v->n = adpcm_decode_packet(v->stream, v->buf, v->nbits, &v->bitpos, v->pcm);
+			}
+			v->pos = 0;
+		}
+		k = v->n - v->pos < frames ? v->n - v->pos : frames;
+		memcpy(out, v->pcm + v->pos * channels, sizeof(int16_t) * k * channels);
+		out += k * channels;
+		v->pos += k;
+		frames -= k;
+	}
+}
+
+static void s16_mix(struct s16_voice *voices, int nvoices, int16_t *tmp, float *out, int frames)
+{
+	int i, j;
+
+	memset(out, 0, sizeof(float) * 2 * frames);
+	for (i=0; i<nvoices; i++) {
+		struct s16_voice *v = voices + i;
+		const float gl = v->gain[0], gr = v->gain[1];
+
+		s16_voice_decode(v, tmp, frames);
+		if (v->stream->channels == 1) {
+			for (j=0; j<frames; j++) {
+				out[2 * j] += tmp[j] * gl;
+				out[2 * j + 1] += tmp[j] * gr;
+			}
+		} else {
+			for (j=0; j<frames; j++) {
+				out[2 * j] += tmp[2 * j] * gl;
+				out[2 * j + 1] += tmp[2 * j + 1] * gr;
+			}
+		}
+	}
+}
+
+struct timing {
+	double mean_us;
+	double max_us;
+};
+
+static void timing_add(struct timing *t, int64_t ns)
+{
+	t->mean_us += ns / 1e3 / args->callbacks;
+	t->max_us = ns / 1e3 > t->max_us ? ns / 1e3 : t->max_us;
+}
+
+static int bench_mixer(void)
+{
+	const int frames = args->rate * args->period_ms / 1000;
+	const int channels = args->is_stereo ? 2 : 1;
+	const double period_us = args->period_ms * 1000;
+	struct mixer_voice *voices = calloc(args->voices, sizeof(struct mixer_voice));
+	struct s16_voice *baseline = calloc(args->voices, sizeof(struct s16_voice));
+	struct str *streams = calloc(args->voices, sizeof(struct str));
+	float *out = malloc(sizeof(float) * 2 * frames);
+	float *ref = malloc(sizeof(float) * 2 * frames);
+	int16_t *tmp = malloc(sizeof(int16_t) * 2 * frames);
+	double fused_per_voice = 0, s16_per_voice = 0;
+	int i, j, n;
+
+	assert(voices && baseline && streams && out && ref && tmp);
+
+	if (frames <= 0) {
+		LOG(D0_ERROR, "error: period shorter than a frame");
+		return 1;
+	}
+
+	for (i=0; i<args->voices; i++) {
+		struct str *s = streams + i;
+		struct mixer_voice *v = voices + i;
+		struct s16_voice *b = baseline + i;
+		int skip;
+
+		*s = (struct str)NULL_STR;
+		if (args->input) {
+			str_from_file(s, args->input);
+		} else {
+			random_stream(s, args->code_bits, channels, args->rate);
+		}
+		if (mixer_voice_init(v, (unsigned char*)s->s, s->len, channels)) {
+			LOG(D0_ERROR, "error: invalid stream");
+			return 1;
+		}
+		mixer_voice_gain(v, randf(), randf() * 2 - 1);
+		mixer_voice_loop(v, 0, 0);
+
+		assert(adpcm_stream_init(b->stream, v->buf, channels) == 0);
+		b->buf = v->buf;
+		b->nbits = v->nbits;
+		b->bitpos = ADPCM_STREAM_START;
+		memcpy(b->gain, v->gain, sizeof(b->gain));
+
+		/* voices start at different points so packet boundaries
+		 * do not line up
+		 */
+		for (skip = rand64() % (args->rate / 2); skip > 0; skip -= frames) {
+			int k = skip < frames ? skip : frames;
+			mixer_voice_mix(v, out, k);
+			s16_voice_decode(b, tmp, k);
+		}
+	}
+
+	for (n=1; ; n = n * 2 < args->voices ? n * 2 : args->voices) {
+		struct timing fused = {0}, s16 = {0};
+
+		for (i=0; i<args->callbacks; i++) {
+			int64_t t0 = stats_clock(), t1, t2;
+			mixer_mix(voices, n, out, frames);
+			t1 = stats_clock();
+			s16_mix(baseline, n, tmp, ref, frames);
+			t2 = stats_clock();
+			timing_add(&fused, t1 - t0);
+			timing_add(&s16, t2 - t1);
+
+			for (j=0; j<2 * frames; j++) {
+				if (out[j] != ref[j]) {
+					LOG(D0_ERROR, "error: fused and two pass mixes differ at voices=%i callback=%i frame=%i", n, i, j / 2);
+					return 1;
+				}
+			}
+		}
+		printf("{\"bench\": \"mixer\", \"voices\": %i, \"frames\": %i, \"fused_us\": %.2f, \"fused_max_us\": %.2f, \"two_pass_us\": %.2f, \"two_pass_max_us\": %.2f}\n",
+			n, frames, fused.mean_us, fused.max_us, s16.mean_us, s16.max_us);
+		fused_per_voice = fused.mean_us / n;
+		s16_per_voice = s16.mean_us / n;
+		if (n == args->voices) {
+			break;
+		}
+	}
+
+	/* extrapolated from the largest voice count, one core
+	 */
+	printf("{\"bench\": \"mixer\", \"code_bits\": %i, \"channels\": %i, \"rate\": %i, \"period_us\": %.0f, \"fused_voices_per_period\": %.0f, \"two_pass_voices_per_period\": %.0f}\n",
+		voices->stream->bits_per_code, channels, args->rate, period_us,
+		period_us / fused_per_voice, period_us / s16_per_voice);
+
+	for (i=0; i<args->voices; i++) {
+		str_free(streams + i);
+	}
+	free(streams);
+	free(voices);
+	free(baseline);
+	free(out);
+	free(ref);
+	free(tmp);
+	return 0;
+}
+
+static void put_bits(unsigned char *buf, int64_t *bitpos, unsigned v, int k)
+{
+	while (k--) {
+		if ((v >> k) & 1) {
+			buf[*bitpos >> 3] |= 0x80 >> (*bitpos & 7);
+		}
+		(*bitpos)++;
+	}
+}
+
+static int tone_sample(int64_t t, int c)
+{
+	const double w = 2 * M_PI / 44100;
+	double x = 0.25 * sin(w * (220 + 3 * c) * t) + 0.15 * sin(w * (1375 - 40 * c) * t) + 0.05 * (randf() * 2 - 1);
+	return x * 32767;
+}
+
+/* whole packets of a plain IMA encoding of a few tones and some noise,
+ * peaks around -7 dBFS like mixed game audio, so decoding rarely clips
+ */
+static void tone_stream(struct str *s, int bits, int channels, int64_t len)
+{
+	struct adpcm_state state[2] = {{0, 0}, {0, 0}};
+	const int64_t packet_bits = (int64_t)channels * (ADPCM_PACKET_HEADER_BITS + ADPCM_PACKET_CODES * bits);
+	int64_t packets = (len * 8 - ADPCM_STREAM_START) / packet_bits, p, t = 0, bitpos = 0;
+	int i, c;
+
+	str_alloc(s, len + 8);
+	memset(s->s, 0, len + 8);
+	put_bits((unsigned char*)s->s, &bitpos, bits - 2, 2); /* AdpcmCodeSize */
+
+	for (p=0; p<packets; p++) {
+		for (c=0; c<channels; c++) {
+			state[c].sample = tone_sample(t, c);
+			put_bits((unsigned char*)s->s, &bitpos, state[c].sample & 0xffff, 16);
+			put_bits((unsigned char*)s->s, &bitpos, state[c].index, 6);
+		}
+		t++;
+		for (i=0; i<ADPCM_PACKET_CODES; i++, t++) {
+			for (c=0; c<channels; c++) {
+				int d = tone_sample(t, c) - state[c].sample, step = stepSizeTable[state[c].index], k;
+				unsigned code = d < 0 ? 1 << (bits - 1) : 0;
+				d = d < 0 ? -d : d;
+				for (k=bits-2; k>=0; k--) {
+					if (d >= step >> (bits - 2 - k)) {
+						code |= 1 << k;
+						d -= step >> (bits - 2 - k);
+					}
+				}
+				decode_code(code, &state[c], bits);
+				put_bits((unsigned char*)s->s, &bitpos, code, bits);
+			}
+		}
+	}
+	s->len = (bitpos + 7) >> 3;
+}
+
+static uint64_t decode_checksum(const struct adpcm_stream *stream, const struct str *data)
+{
+	int16_t out[ADPCM_PACKET_SAMPLES * 2];
+	int64_t bitpos = ADPCM_STREAM_START;
+	uint64_t h = 1469598103934665603ull;
+	int n, i;
+
+	while ((n = adpcm_decode_packet(stream, (unsigned char*)data->s, data->len * 8, &bitpos, out)) > 0) {
+		for (i=0; i<n * stream->channels; i++) {
+			h = (h ^ (uint16_t)out[i]) * 1099511628211ull;
+		}
+	}
+	return h;
+}
+
+/* best of a few runs over the same data, per kernel and bits per code
+ */
+static int bench_decode(void)
+{
+	const int channels = args->is_stereo ? 2 : 1;
+	const int64_t len = (int64_t)args->megabytes << 20;
+	int16_t *out = malloc(sizeof(int16_t) * ADPCM_PACKET_SAMPLES * 2);
+	DEFINE_STR(data);
+	uint64_t checksum = 0;
+	int64_t fused_best = 0;
+	int bits, kernel, run;
+
+	assert(out);
+	if (strcmp(args->signal, "random") == 0) {
+		str_alloc(data, len + 8);
+		for (data->len = 0; data->len < len; data->len += 8) {
+			uint64_t r = rand64();
+			memcpy(data->s + data->len, &r, 8);
+		}
+		data->len = len;
+	}
+
+	for (bits=2; bits<=5; bits++) {
+		if (strcmp(args->signal, "random") == 0) {
+			data->s[0] = (data->s[0] & 0x3f) | (bits - 2) << 6;
+		} else {
+			tone_stream(data, bits, channels, len);
+		}
+
+		for (kernel=0; kernel<ADPCM_KERNEL_COUNT; kernel++) {
+			struct adpcm_stream stream[1];
+			int64_t best = INT64_MAX, samples = 0;
+			uint64_t sum;
+
+			if (!adpcm_kernel_supported(kernel)) {
+				continue;
+			}
+			assert(adpcm_stream_init(stream, (unsigned char*)data->s, channels) == 0);
+			assert(adpcm_stream_kernel(stream, kernel) == 0);
+
+			/* untimed, every kernel has to give the samples of the first
+			 */
+			sum = decode_checksum(stream, data);
+			if (kernel == ADPCM_KERNEL_FUSED) {
+				checksum = sum;
+			} else if (sum != checksum) {
+				LOG(D0_ERROR, "error: kernel %s differs from fused at %i bits per code", adpcm_kernel_name(kernel), bits);
+				return 1;
+			}
+
+			for (run=0; run<3; run++) {
+				int64_t bitpos = ADPCM_STREAM_START, t0 = stats_clock();
+				int n;
+				samples = 0;
+				while ((n = adpcm_decode_packet(stream, (unsigned char*)data->s, data->len * 8, &bitpos, out)) > 0) {
+					samples += n;
+				}
+				t0 = stats_clock() - t0;
+				best = t0 < best ? t0 : best;
+			}
+			if (kernel == ADPCM_KERNEL_FUSED) {
+				fused_best = best;
+			}
+			printf("{\"bench\": \"decode\", \"signal\": \"%s\", \"bits_per_code\": %i, \"channels\": %i, \"kernel\": \"%s\", \"ms\": %.2f, \"ns_per_sample\": %.3f, \"msamples_per_s\": %.1f, \"speedup\": %.2f}\n",
+				args->signal, bits, channels, adpcm_kernel_name(kernel), best / 1e6,
+				(double)best / (samples * channels), samples * channels * 1e3 / best, (double)fused_best / best);
+		}
+	}
+
+	str_free(data);
+	free(out);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct getopt_x state[1];
+
+	if (process_args(state, argc, argv)) {
+		help(argv[0], state);
+		exit(1);
+	}
+
+	if (strcmp(args->bench, "mixer") == 0) {
+		return bench_mixer();
+	}
+	if (strcmp(args->bench, "decode") == 0) {
+		return bench_decode();
+	}
+	LOG(D0_ERROR, "error: unknown bench [%s]", args->bench);
+	return 1;
+}
@@ -0,0 +1,375 @@
+/*
+
+Copyright (c) 2012, Alexandre Girao <alexgirao@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ *
+ *
+ * adpcm_client
+ *
+ * sends decode requests to adpcm_swf2raw --daemon, for local testing
+ * and latency measurement
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+
+#include "debug0.h"
+
+#include "str.h"
+#include "sample_format.h"
+#include "stats.h"
+#include "daemon.h"
+
+#include "bsd-getopt_long.h"
+#include "getopt_x.h"
+
+static const char *options_short = NULL;
+static const char *options_mandatory = NULL;
+
+static struct option options_long[] = {
+	{.val='c', .name="socket", .has_arg=1},
+	{.val='i', .name="input", .has_arg=1},
+	{.val='o', .name="output", .has_arg=1},
+	{.val='s', .name="stereo"},
+	{.val='f', .name="sample-format", .has_arg=1},
+	{.val='n', .name="inline"},
+	{.val='m', .name="memfd"},
+	{.val='F', .name="first", .has_arg=1},
+	{.val='N', .name="samples", .has_arg=1},
+	{.val='R', .name="repeat", .has_arg=1},
+	{.val='h', .name="help"},
+	{.name=NULL}
+};
+
+struct args {
+	const char *socket;
+	const char *input;
+	const char *output;
+	int is_stereo;
+	int sample_format;
+	int inline_data;
+	int memfd;
+	int64_t first;
+	int64_t samples;
+	int repeat;
+} args[1] = {{.samples = -1, .repeat = 1}};
+
+/* sub or zero */
+#define SOZ(a,b) ((a) > (b) ? (a) - (b) : 0)
+
+static void help(const char *argv0, struct getopt_x *state)
+{
+	char buf[4096];
+	int bufsz = sizeof(buf);
+	struct option opt[1];
+	int pos = 0;
+	int c = 0;
+
+	pos += snprintf(buf + pos, SOZ(bufsz,pos), "\n");
+	pos += snprintf(buf + pos, SOZ(bufsz,pos), "  usage: %s [options] ...\n", argv0);
+	pos += snprintf(buf + pos, SOZ(bufsz,pos), "  options:\n");
+	pos += snprintf(buf + pos, SOZ(bufsz,pos), "\n");
+
+	while ((c = getopt_x_option(state, c, opt)) >= 0) {
+		pos += getopt_x_option_format(buf + pos, bufsz - pos, state, opt);
+		switch (opt->val) {
+		case 'c':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "unix socket of adpcm_swf2raw --daemon\n");
+			break;
+		case 'i':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "input path, resolved by the daemon unless --inline\n");
+			break;
+		case 'o':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "pcm output, - for stdout (default: discard)\n");
+			break;
+		case 's':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "input is stereo\n");
+			break;
+		case 'f':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "s16le (default), s16be, s24le, u8 or f32le\n");
+			break;
+		case 'n':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "send the input bytes instead of its path\n");
+			break;
+		case 'm':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "receive the pcm as a sealed memfd and map it, no socket copy\n");
+			break;
+		case 'F':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "first sample per channel (default 0)\n");
+			break;
+		case 'N':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "samples per channel (default up to the end)\n");
+			break;
+		case 'R':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "send the request this many times on one connection, latency json to stderr\n");
+			break;
+		case 'h':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "\n");
+			break;
+		default:
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "undocumented\n");
+		}
+		if (pos >= bufsz) {
+			LOG(D0_ERROR, "buffer too small");
+			exit(1);
+		}
+	}
+	pos += snprintf(buf + pos, SOZ(bufsz,pos), "\n");
+
+	fputs(buf, stderr);
+}
+
+static int process_args(struct getopt_x *state, int argc, char **argv)
+{
+	int c;
+	if (getopt_x_prepare(state, argc, argv, options_short, options_long, options_mandatory)) {
+		LOG(D0_ERROR, "error: failed to parse options");
+		exit(1);
+	}
+	do {
+		struct option *opt;
+		switch (c = getopt_x_next(state, &opt)) {
+		case 'c': args->socket = optarg; break;
+		case 'i': args->input = optarg; break;
+		case 'o': args->output = optarg; break;
+		case 's': args->is_stereo = 1; break;
+		case 'f':
+			if ((args->sample_format = sample_format_from_name(optarg)) < 0) {
+				LOG(D0_ERROR, "error: unknown sample format [%s]", optarg);
+				return -1;
+			}
+			break;
+		case 'n': args->inline_data = 1; break;
+		case 'm': args->memfd = 1; break;
+		case 'F': args->first = atoll(optarg); break;
+		case 'N': args->samples = atoll(optarg); break;
+		case 'R':
+			if ((args->repeat = atoi(optarg)) <= 0) {
+				LOG(D0_ERROR, "error: invalid repeat count [%s]", optarg);
+				return -1;
+			}
+			break;
+		case 'h': help(argv[0], state); exit(0);
+		case -1: break;
+		default:
+			getopt_x_option_debug(state, c, opt);
+			return -1;
+		}
+	} while (c != -1);
+	if (!state->got_error && (!args->socket || !args->input)) {
+		LOG(D0_ERROR, "error: options -c and -i are required");
+		return -1;
+	}
+	return state->got_error;
+}
+
+static int read_full(int fd, void *buf, int64_t len)
+{
+	int64_t got = 0;
+	while (got < len) {
+		ssize_t i = read(fd, (char*)buf + got, len - got);
+		if (i <= 0) {
+			if (i < 0 && errno == EINTR) continue;
+			return -1;
+		}
+		got += i;
+	}
+	return 0;
+}
+
+static int write_full(int fd, const void *buf, int64_t len)
+{
+	int64_t wrote = 0;
+	while (wrote < len) {
+		ssize_t i = write(fd, (const char*)buf + wrote, len - wrote);
+		if (i <= 0) {
+			if (i < 0 && errno == EINTR) continue;
+			return -1;
+		}
+		wrote += i;
+	}
+	return 0;
+}
+
+/* read the response header, picking up the memfd passed along with it
+ */
+static int read_response(int fd, struct daemon_response *rsp, int *memfd)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = {.iov_base = rsp, .iov_len = sizeof(*rsp)};
+	struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control)};
+	struct cmsghdr *cmsg;
+	ssize_t i;
+
+	*memfd = -1;
+	while ((i = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+	if (i <= 0) {
+		return -1;
+	}
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			memcpy(memfd, CMSG_DATA(cmsg), sizeof(int));
+		}
+	}
+	return read_full(fd, (char*)rsp + i, sizeof(*rsp) - i);
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv)
+{
+	struct getopt_x state[1];
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	struct daemon_request req = {.magic = DAEMON_REQUEST_MAGIC};
+	struct daemon_response rsp;
+	DEFINE_STR(request);
+	DEFINE_STR(pcm);
+	const char *data = NULL;
+	void *map = NULL;
+	int64_t *latency;
+	int fd, out = -1, i;
+
+	if (argc == 1 || process_args(state, argc, argv)) {
+		help(argv[0], state);
+		exit(argc == 1 ? 0 : 1);
+	}
+
+	req.flags = (args->inline_data ? DAEMON_INLINE : 0) | (args->is_stereo ? DAEMON_STEREO : 0) | (args->memfd ? DAEMON_MEMFD : 0);
+	req.sample_format = args->sample_format;
+	req.first_sample = args->first;
+	req.samples = args->samples;
+
+	if (args->inline_data) {
+		DEFINE_STR(data);
+		str_from_file(data, args->input);
+		req.len = data->len;
+		str_copyn(request, (char*)&req, sizeof(req));
+		str_cat(request, data);
+		str_free(data);
+	} else {
+		req.len = strlen(args->input);
+		str_copyn(request, (char*)&req, sizeof(req));
+		str_catz(request, args->input);
+	}
+
+	if (strlen(args->socket) >= sizeof(addr.sun_path)) {
+		LOG(D0_ERROR, "error: socket path too long [%s]", args->socket);
+		return 1;
+	}
+	strcpy(addr.sun_path, args->socket);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		perror(args->socket);
+		return 1;
+	}
+
+	latency = calloc(args->repeat, sizeof(int64_t));
+	assert(latency);
+
+	for (i=0; i<args->repeat; i++) {
+		int64_t t0 = stats_clock();
+		int memfd;
+		if (write_full(fd, request->s, request->len) || read_response(fd, &rsp, &memfd)
+		    || rsp.magic != DAEMON_RESPONSE_MAGIC) {
+			LOG(D0_ERROR, "error: daemon closed the connection");
+			return 1;
+		}
+		if (rsp.status) {
+			LOG(D0_ERROR, "error: [%s]: %s", args->input, strerror(rsp.status));
+			return 1;
+		}
+		if (args->memfd) {
+			if (memfd < 0) {
+				LOG(D0_ERROR, "error: no memfd in response");
+				return 1;
+			}
+			if (map) {
+				munmap(map, rsp.bytes);
+				map = NULL;
+			}
+			if (rsp.bytes && (map = mmap(NULL, rsp.bytes, PROT_READ, MAP_SHARED, memfd, 0)) == MAP_FAILED) {
+				perror("mmap");
+				return 1;
+			}
+			close(memfd);
+			data = map;
+		} else {
+			str_alloc(pcm, rsp.bytes + 1);
+			if (read_full(fd, pcm->s, rsp.bytes)) {
+				LOG(D0_ERROR, "error: short response");
+				return 1;
+			}
+			data = pcm->s;
+		}
+		latency[i] = stats_clock() - t0;
+	}
+	close(fd);
+
+	if (args->output) {
+		if (strcmp(args->output, "-") == 0) {
+			out = STDOUT_FILENO;
+		} else if ((out = open(args->output, O_CREAT | O_WRONLY | O_TRUNC, 0644)) < 0) {
+			perror(args->output);
+			return 1;
+		}
+		assert(write_full(out, data, rsp.bytes) == 0);
+		if (out != STDOUT_FILENO) {
+			assert(close(out) == 0);
+		}
+	}
+
+	if (args->repeat > 1) {
+		qsort(latency, args->repeat, sizeof(int64_t), cmp_int64);
+		fprintf(stderr, "{\"requests\": %i, \"samples\": %lld, \"bytes\": %lld, \"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}\n",
+			args->repeat, (long long)rsp.samples, (long long)rsp.bytes,
+			latency[args->repeat / 2] / 1e3, latency[(int64_t)args->repeat * 99 / 100] / 1e3,
+			latency[args->repeat - 1] / 1e3);
+	}
+
+	if (map) {
+		munmap(map, rsp.bytes);
+	}
+	free(latency);
+	str_free(request);
+	str_free(pcm);
+	return 0;
+}
@@ -0,0 +1,134 @@
+#ifndef k7d2m9xq4tfw1hz6pe /* adpcm_core-h */
+#define k7d2m9xq4tfw1hz6pe /* adpcm_core-h */
+
+/* the bit reader and per code update shared by the packet decoders in
+ * adpcm.c and the mixer kernels in mixer.c, everything here is inlined
+ * into callers that pass bits as a compile time constant
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "adpcm.h"
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+static const int stepSizeTable[89] = {
+   7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34,
+   37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143,
+   157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494,
+   544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552,
+   1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026,
+   4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+   11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623,
+   27086, 29794, 32767
+};
+
+/* index adjustment by code magnitude (signal bit stripped), indexed
+ * [bits_per_code - 2]
+ */
+static const int indexAdjustTable[4][16] = {
+	{-1, 2},
+	{-1, -1, 2, 4},
+	{-1, -1, -1, -1, 2, 4, 6, 8},
+	{-1, -1, -1, -1, -1, -1, -1, -1, 1, 2, 4, 6, 8, 10, 13, 16}
+};
+
+/* bit reader, msb first
+ *
+ * acc holds n valid bits at its top, bits below n are either zero or
+ * the next bits of the stream
+ */
+
+struct bitreader {
+	const unsigned char *p;
+	const unsigned char *end;
+	uint64_t acc;
+	int n;
+};
+
+static ALWAYS_INLINE uint64_t load_be64(const unsigned char *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+static ALWAYS_INLINE void br_refill(struct bitreader *br)
+{
+	if (br->end - br->p >= 8) {
+		br->acc |= load_be64(br->p) >> br->n;
+		br->p += (63 - br->n) >> 3;
+		br->n |= 56;
+	} else {
+		while (br->n <= 56) {
+			if (br->p < br->end) {
+				br->acc |= (uint64_t)*br->p++ << (56 - br->n);
+				br->n += 8;
+			} else {
+				br->n = 64; /* zero padding, never consumed */
+			}
+		}
+	}
+}
+
+static ALWAYS_INLINE void br_init(struct bitreader *br, const unsigned char *buf, int64_t nbits, int64_t bitpos)
+{
+	br->p = buf + (bitpos >> 3);
+	br->end = buf + ((nbits + 7) >> 3);
+	br->acc = 0;
+	br->n = 0;
+	br_refill(br);
+	br->acc <<= bitpos & 7;
+	br->n -= bitpos & 7;
+}
+
+static ALWAYS_INLINE unsigned br_get(struct bitreader *br, const int k)
+{
+	unsigned v;
+	if (br->n < k) {
+		br_refill(br);
+	}
+	v = br->acc >> (64 - k);
+	br->acc <<= k;
+	br->n -= k;
+	return v;
+}
+
+/* the signed difference a code adds to the sample at a given step
+ */
+static ALWAYS_INLINE int code_difference(unsigned code, int step, const int bits)
+{
+	const int sign = -(int)((code >> (bits - 1)) & 1);
+	int difference = step >> (bits - 1);
+	int k;
+
+	for (k = 0; k < bits - 1; k++) {
+		difference += -(int)((code >> k) & 1) & (step >> (bits - 2 - k));
+	}
+	return (difference ^ sign) - sign;
+}
+
+/* one code, bits is a compile time constant in every caller
+ */
+static ALWAYS_INLINE int decode_code(unsigned code, struct adpcm_state *state, const int bits)
+{
+	int sample, index;
+
+	sample = state->sample + code_difference(code, stepSizeTable[state->index], bits);
+	sample = sample > 32767 ? 32767 : sample;
+	sample = sample < -32768 ? -32768 : sample;
+	state->sample = sample;
+
+	index = state->index + indexAdjustTable[bits - 2][code & ((1 << (bits - 1)) - 1)];
+	index = index < 0 ? 0 : index;
+	index = index > 88 ? 88 : index;
+	state->index = index;
+
+	return sample;
+}
+
+#endif /* ! k7d2m9xq4tfw1hz6pe adpcm_core-h */
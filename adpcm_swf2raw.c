@@ -55,21 +55,59 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <sys/wait.h>
 #include <ctype.h>
 #include <stdint.h>
+#include <pthread.h>
 
 #include "debug0.h"
 
 #include "str.h"
+#include "sample_format.h"
+#include "stats.h"
+#include "adpcm.h"
+#include "peaks.h"
+#include "loudness.h"
+#include "hash.h"
+#include "dedup.h"
+#include "daemon.h"
+#include "flac.h"
+#include "archive.h"
+#include "swf.h"
+#include "extract.h"
+#include "flv.h"
+#include "ring.h"
+#include "packet_cache.h"
+#include "arena.h"
 
 #include "bsd-getopt_long.h"
 #include "getopt_x.h"
 
 static const char *options_short = NULL;
-static const char *options_mandatory = "io";
+static const char *options_mandatory = NULL; /* -i and -o checked in process_args */
 
 static struct option options_long[] = {
 	{.val='i', .name="input", .has_arg=1},
 	{.val='o', .name="output", .has_arg=1},
 	{.val='s', .name="stereo"},
+	{.val='f', .name="sample-format", .has_arg=1},
+	{.val='F', .name="format", .has_arg=1},
+	{.val='S', .name="stats"},
+	{.val='l', .name="log-level", .has_arg=1},
+	{.val='a', .name="log-async"},
+	{.val='p', .name="probe"},
+	{.val='r', .name="rate", .has_arg=1},
+	{.val='P', .name="peaks", .has_arg=1},
+	{.val='B', .name="peaks-buckets", .has_arg=1},
+	{.val='L', .name="loudness"},
+	{.val='H', .name="hash", .has_arg=1},
+	{.val='b', .name="batch", .has_arg=1},
+	{.val='A', .name="archive"},
+	{.val='V', .name="flv"},
+	{.val='Q', .name="pipeline"},
+	{.val='X', .name="extract-assets"},
+	{.val='M', .name="manifest", .has_arg=1},
+	{.val='D', .name="daemon", .has_arg=1},
+	{.val='w', .name="workers", .has_arg=1},
+	{.val='K', .name="kernel", .has_arg=1},
+	{.val='C', .name="packet-cache", .has_arg=1},
 	{.val='h', .name="help"},
 	{.name=NULL}
 };
@@ -78,7 +116,42 @@ struct args {
 	struct str input_file[1];
 	struct str output_file[1];
 	int is_stereo;
-} args[1];
+	int sample_format;
+	int flac;
+	int probe;
+	int rate;
+	int rate_set;
+	struct str peaks_file[1];
+	const char *peaks_buckets;
+	int loudness;
+	int hash; /* -1 for none */
+	const char *batch;
+	int archive;
+	int flv;
+	int pipeline;
+	int extract_assets;
+	const char *manifest;
+	const char *daemon;
+	int workers;
+	const char **paths; /* non-option arguments */
+	int npaths;
+} args[1] = {{.rate = 22050, .peaks_buckets = "256,1024,4096", .hash = -1}};
+
+static struct peaks peaks[1];
+static struct loudness loudness[1];
+static struct hash hash[1];
+static struct flac *flac;
+
+/* --packet-cache, size 0 when off */
+static struct packet_cache pcache[1];
+
+static int decode_packet(const struct adpcm_stream *st, const unsigned char *buf, int64_t nbits, int64_t *bitpos, int16_t *out)
+{
+	if (pcache->size) {
+		return packet_cache_decode(pcache, st, buf, nbits, bitpos, out);
+	}
+	return adpcm_decode_packet(st, buf, nbits, bitpos, out);
+}
 
 /* sub or zero */
 #define SOZ(a,b) ((a) > (b) ? (a) - (b) : 0)
@@ -103,11 +176,74 @@ static void help(const char *argv0, struct getopt_x *state)
 			pos += snprintf(buf + pos, SOZ(bufsz,pos), "input file that has adpcm_swf raw data\n");
 			break;
 		case 'o':
-			pos += snprintf(buf + pos, SOZ(bufsz,pos), "output file, s16le\n");
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "output file, s16le unless --sample-format is given\n");
 			break;
 		case 's':
 			pos += snprintf(buf + pos, SOZ(bufsz,pos), "stereo input? mono is default\n");
 			break;
+		case 'f':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "output sample format: s16le (default), s16be, s24le, u8 or f32le\n");
+			break;
+		case 'F':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "raw (default) or flac, encoded on --workers threads\n");
+			break;
+		case 'S':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "print decode counters and timings as json to stderr at exit\n");
+			break;
+		case 'l':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "error, warn, info, debug (default) or trace (per packet)\n");
+			break;
+		case 'a':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "log from a background thread, callers never block on stderr\n");
+			break;
+		case 'p':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "print stream layout as json lines, no decoding, extra arguments are probed too\n");
+			break;
+		case 'r':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "sample rate, used for durations and containers (default 22050)\n");
+			break;
+		case 'P':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "write a min/max/rms waveform summary sidecar while decoding\n");
+			break;
+		case 'B':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "ascending bucket sizes for --peaks (default 256,1024,4096)\n");
+			break;
+		case 'L':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "measure EBU R128 loudness, range and peaks, json to stderr\n");
+			break;
+		case 'H':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "xxh3, sha256 or md5 digest of the written pcm, json to stderr\n");
+			break;
+		case 'b':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "decode \"input<tab>output\" lines (- for stdin), identical inputs decoded once\n");
+			break;
+		case 'A':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "-i is a zip or tar(.gz), members into directory -o as <path>.raw, swf sounds as <path>_assets/sound-<id>.raw\n");
+			break;
+		case 'V':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "-i is an flv (- for stdin), adpcm audio tags decoded as they arrive\n");
+			break;
+		case 'Q':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "read, decode and write on three threads joined by lock-free rings, -i may be -\n");
+			break;
+		case 'X':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "sounds of the swf arguments (directories walked) into <name>.<ext>_assets\n");
+			break;
+		case 'M':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "extract-assets skips inputs this file recorded unchanged, and updates it\n");
+			break;
+		case 'D':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "serve decode requests on this unix socket, see adpcm_client\n");
+			break;
+		case 'w':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "worker threads for --daemon, --extract-assets and flac (default one per cpu)\n");
+			break;
+		case 'K':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "packet decoder: fused (default), unpack, pdep (bmi2), prefix or table\n");
+			break;
+		case 'C':
+			pos += snprintf(buf + pos, SOZ(bufsz,pos), "keep this many decoded packets (e.g. 16), repeated ones are copied\n");
+			break;
 		case 0:
 			pos += snprintf(buf + pos, SOZ(bufsz,pos), "this is option --%s and it does such also\n", opt->name);
 			break;
@@ -118,7 +254,7 @@ static void help(const char *argv0, struct getopt_x *state)
 			pos += snprintf(buf + pos, SOZ(bufsz,pos), "undocumented\n");
 		}
 		if (pos >= bufsz) {
-			DEBUG("buffer too small");
+			LOG(D0_ERROR, "buffer too small");
 			exit(1);
 		}
 	}
@@ -129,9 +265,11 @@ static void help(const char *argv0, struct getopt_x *state)
 
 static int process_args(struct getopt_x *state, int argc, char **argv)
 {
-	int c;
+	int c, n;
+	args->paths = calloc(argc, sizeof(char*));
+	assert(args->paths);
 	if (getopt_x_prepare(state, argc, argv, options_short, options_long, options_mandatory)) {
-		DEBUG("error: failed to parse options");
+		LOG(D0_ERROR, "error: failed to parse options");
 		exit(1);
 	}
 	do {
@@ -140,7 +278,79 @@ static int process_args(struct getopt_x *state, int argc, char **argv)
 		case 'i': str_copyz(args->input_file, optarg); break;
 		case 'o': str_copyz(args->output_file, optarg); break;
 		case 's': args->is_stereo = 1; break;
+		case 'f':
+			if ((args->sample_format = sample_format_from_name(optarg)) < 0) {
+				LOG(D0_ERROR, "error: unknown sample format [%s]", optarg);
+				return -1;
+			}
+			break;
+		case 'F':
+			if (strcmp(optarg, "flac") == 0) {
+				args->flac = 1;
+			} else if (strcmp(optarg, "raw") != 0) {
+				LOG(D0_ERROR, "error: unknown format [%s]", optarg);
+				return -1;
+			}
+			break;
+		case 'S': stats->enabled = 1; break;
+		case 'l':
+			if ((debug0_level = debug0_level_from_name(optarg)) < 0) {
+				debug0_level = D0_DEBUG;
+				LOG(D0_ERROR, "error: unknown log level [%s]", optarg);
+				return -1;
+			}
+			break;
+		case 'a':
+			if (debug0_async_start() == 0) {
+				atexit(debug0_async_stop);
+			}
+			break;
+		case 'p': args->probe = 1; break;
+		case 'r':
+			if ((args->rate = atoi(optarg)) <= 0) {
+				LOG(D0_ERROR, "error: invalid rate [%s]", optarg);
+				return -1;
+			}
+			args->rate_set = 1;
+			break;
+		case 'P': str_copyz(args->peaks_file, optarg); break;
+		case 'B': args->peaks_buckets = optarg; break;
+		case 'L': args->loudness = 1; break;
+		case 'H':
+			if ((args->hash = hash_from_name(optarg)) < 0) {
+				LOG(D0_ERROR, "error: unknown hash [%s]", optarg);
+				return -1;
+			}
+			break;
+		case 'b': args->batch = optarg; break;
+		case 'A': args->archive = 1; break;
+		case 'V': args->flv = 1; break;
+		case 'Q': args->pipeline = 1; break;
+		case 'X': args->extract_assets = 1; break;
+		case 'M': args->manifest = optarg; break;
+		case 'D': args->daemon = optarg; break;
+		case 'w':
+			if ((args->workers = atoi(optarg)) <= 0) {
+				LOG(D0_ERROR, "error: invalid worker count [%s]", optarg);
+				return -1;
+			}
+			break;
+		case 'K':
+			if ((adpcm_kernel = adpcm_kernel_from_name(optarg)) < 0 || !adpcm_kernel_supported(adpcm_kernel)) {
+				LOG(D0_ERROR, "error: unknown or unsupported kernel [%s]", optarg);
+				return -1;
+			}
+			break;
+		case 'C':
+			if ((n = atoi(optarg)) <= 0 || n > 4096) {
+				LOG(D0_ERROR, "error: invalid packet cache size [%s]", optarg);
+				return -1;
+			}
+			packet_cache_free(pcache);
+			packet_cache_init(pcache, n);
+			break;
 		case 'h': help(argv[0], state); exit(0);
+		case 1: args->paths[args->npaths++] = optarg; break;
 		case -1: break;
 		default:
 			getopt_x_option_debug(state, c, opt);
@@ -148,1703 +358,1003 @@ static int process_args(struct getopt_x *state, int argc, char **argv)
 		}
 	} while (c != -1);
 	if (!state->got_error) {
-		assert(str_len(args->output_file));
+		if (args->batch && (args->probe || str_len(args->input_file) || str_len(args->output_file) || str_len(args->peaks_file))) {
+			LOG(D0_ERROR, "error: --batch excludes -i, -o, --probe and --peaks");
+			return -1;
+		}
+		if (args->archive && (args->batch || args->probe || str_len(args->peaks_file))) {
+			LOG(D0_ERROR, "error: --archive excludes --batch, --probe and --peaks");
+			return -1;
+		}
+		if (args->flv && (args->batch || args->probe || args->archive)) {
+			LOG(D0_ERROR, "error: --flv excludes --batch, --probe and --archive");
+			return -1;
+		}
+		if (args->pipeline && (args->batch || args->probe || args->archive || args->flv)) {
+			LOG(D0_ERROR, "error: --pipeline excludes --batch, --probe, --archive and --flv");
+			return -1;
+		}
+		if (args->manifest && !args->extract_assets) {
+			LOG(D0_ERROR, "error: --manifest is for extract-assets");
+			return -1;
+		}
+		if (args->daemon) {
+			return 0;
+		}
+		if (args->extract_assets) {
+			if (!args->npaths) {
+				LOG(D0_ERROR, "error: --extract-assets needs files or directories");
+				return -1;
+			}
+			return 0;
+		}
+		if (args->flac && args->sample_format != SAMPLE_FORMAT_S16LE) {
+			LOG(D0_ERROR, "error: flac is written from 16-bit samples only");
+			return -1;
+		}
+		if (!str_len(args->input_file) && !(args->probe && args->npaths) && !args->batch) {
+			LOG(D0_ERROR, "error: option -i is required");
+			return -1;
+		}
+		if (!args->probe && !args->batch && !str_len(args->output_file)) {
+			LOG(D0_ERROR, "error: option -o is required");
+			return -1;
+		}
+		if (!args->probe && args->npaths) {
+			LOG(D0_ERROR, "error: unexpected argument [%s]", args->paths[0]);
+			return -1;
+		}
 	}
 	return state->got_error;
 }
 
-/*
+static int write_exact(int fd, void *buf, int len);
+
+static int workers(void)
+{
+	int n = args->workers ? args->workers : sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+}
+
+/* write a decoded packet, converting it to args->sample_format on the
+ * way out
  */
+static void output_packet(int fd, const int16_t *samples, int n)
+{
+	static unsigned char converted[ADPCM_PACKET_SAMPLES * 2 * 4];
+	const void *out;
+	int len;
 
-static const int indexAdjustTable2bit[4] = {
-	-1, 2, /* 2#0? */
-	-1, 2  /* 2#1? (signal bit set)*/
-};
+	stats_phase(STATS_DECODE);
+	stats->packets++;
+	stats->samples += n;
 
-static const int indexAdjustTable3bit[8] = {
-	-1, -1, 2, 4, /* 2#0?? */
-	-1, -1, 2, 4  /* 2#1?? (signal bit set)*/
-};
+	if (str_len(args->peaks_file)) {
+		peaks_update(peaks, samples, n);
+	}
+	if (args->loudness) {
+		loudness_update(loudness, samples, n);
+	}
 
-static const int indexAdjustTable4bit[16] = {
-	-1, -1, -1, -1, 2, 4, 6, 8, /* 2#0??? */
-	-1, -1, -1, -1, 2, 4, 6, 8 /* 2#1??? (signal bit set)*/
-};
+	/* frames are encoded and written by the flac threads, --hash
+	 * covers the pcm fed to them
+	 */
+	if (flac) {
+		if (args->hash >= 0) {
+			hash_update(hash, samples, n * sizeof(int16_t));
+		}
+		flac_write(flac, samples, n);
+		stats_phase(STATS_WRITE);
+		return;
+	}
 
-static const int indexAdjustTable5bit[32] = {
-	-1, -1, -1, -1, -1, -1, -1, -1, 1, 2, 4, 6, 8, 10, 13, 16, /* 2#0???? */
-	-1, -1, -1, -1, -1, -1, -1, -1, 1, 2, 4, 6, 8, 10, 13, 16  /* 2#1???? (signal bit set)*/
-};
+	if (args->sample_format == SAMPLE_FORMAT_S16LE) {
+		len = n * sizeof(int16_t);
+		out = samples;
+	} else {
+		len = n * sample_format_width(args->sample_format);
+		assert(len <= sizeof(converted));
+		sample_format_convert(args->sample_format, converted, samples, n);
+		out = converted;
+	}
 
-static const int stepSizeTable[89] = {
-   7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34,
-   37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143,
-   157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494,
-   544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552,
-   1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026,
-   4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
-   11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623,
-   27086, 29794, 32767
-};
+	/* hash exactly what is written, while it is still in cache
+	 */
+	if (args->hash >= 0) {
+		hash_update(hash, out, len);
+	}
+	assert(write_exact(fd, (void*)out, len) == len);
 
-struct adpcm_state {
-	int index;
-	int sample;
-};
+	stats->bytes_out += len;
+	stats_phase(STATS_WRITE);
+}
 
-static int adpcm_decode2bit(int deltaCode, struct adpcm_state *state)
+static void cat_json_string(struct str *out, const char *s)
 {
-	assert(deltaCode == (deltaCode & 3) /* 2#11 */);
-
-	int step = stepSizeTable[state->index];
+	str_catc(out, '"');
+	for (; *s; s++) {
+		unsigned char c = *s;
+		if (c == '"' || c == '\\') {
+			str_catc(out, '\\');
+			str_catc(out, c);
+		} else if (c < 0x20) {
+			str_catf(out, "\\u%.4x", c);
+		} else {
+			str_catc(out, c);
+		}
+	}
+	str_catc(out, '"');
+}
 
-	int difference = step >> 1;
-	if (deltaCode & 1) difference += step;
-	if (deltaCode & 2) difference = -difference;
+/* layout of a stream from its first byte and size, nothing is decoded
+ */
+static int probe(const char *adpcm_path, struct str *out)
+{
+	struct adpcm_stream stream[1];
+	struct adpcm_layout layout[1];
+	struct stat st[1];
+	unsigned char first;
+	int fd;
+
+	if ((fd = open(adpcm_path, O_RDONLY)) < 0) {
+		perror(adpcm_path);
+		return 1;
+	}
+	if (fstat(fd, st) != 0 || pread(fd, &first, 1, 0) != 1) {
+		LOG(D0_ERROR, "error: [%s] is empty or unreadable", adpcm_path);
+		close(fd);
+		return 1;
+	}
+	close(fd);
 
-	state->sample += difference;
-	if (state->sample > 32767) state->sample = 32767;
-	else if (state->sample < -32768) state->sample = -32768;
+	assert(adpcm_stream_init(stream, &first, args->is_stereo ? 2 : 1) == 0);
+	adpcm_stream_layout(stream, (int64_t)st->st_size * 8, layout);
 
-	state->index += indexAdjustTable2bit[deltaCode];
-	if (state->index < 0) state->index = 0;
-	else if (state->index > 88) state->index = 88;
+	str_catz(out, "{\"input\": ");
+	cat_json_string(out, adpcm_path);
+	str_catf(out, ", \"bytes\": %lld, \"code_size\": %i, \"bits_per_code\": %i, \"channels\": %i",
+		 (long long)st->st_size, stream->code_size, stream->bits_per_code, stream->channels);
+	str_catf(out, ", \"packets\": %lld, \"samples\": %lld, \"rate\": %i, \"duration\": %.6f}\n",
+		 (long long)layout->packets, (long long)layout->samples, args->rate,
+		 (double)layout->samples / args->rate);
 
-	return state->sample;
+	return 0;
 }
 
-static int adpcm_decode3bit(int deltaCode, struct adpcm_state *state)
+static int probe_all(void)
 {
-	assert(deltaCode == (deltaCode & 7) /* 2#111 */);
+	DEFINE_STR(out);
+	int i, ret = 0;
 
-	int step = stepSizeTable[state->index];
+	str_alloc(out, 0xffff);
 
-	int difference = step >> 2;
-	if (deltaCode & 1) difference += step >> 1;
-	if (deltaCode & 2) difference += step;
-	if (deltaCode & 4) difference = -difference;
-
-	state->sample += difference;
-	if (state->sample > 32767) state->sample = 32767;
-	else if (state->sample < -32768) state->sample = -32768;
-
-	state->index += indexAdjustTable3bit[deltaCode];
-	if (state->index < 0) state->index = 0;
-	else if (state->index > 88) state->index = 88;
+	if (str_len(args->input_file)) {
+		ret |= probe(args->input_file->s, out);
+	}
+	for (i=0; i<args->npaths; i++) {
+		ret |= probe(args->paths[i], out);
+		if (out->len > 0xf000) {
+			assert(write_exact(STDOUT_FILENO, out->s, out->len) == out->len);
+			out->len = 0;
+		}
+	}
+	if (out->len) {
+		assert(write_exact(STDOUT_FILENO, out->s, out->len) == out->len);
+	}
 
-	return state->sample;
+	str_free(out);
+	return ret;
 }
 
-static int adpcm_decode4bit(int deltaCode, struct adpcm_state *state)
+/* opens the output and sets up the sinks hanging off output_packet
+ * for a stream of channels, total_samples per channel (0 if unknown),
+ * returns the fd or -1
+ */
+static int output_open(const char *output_path, int channels, int64_t total_samples)
 {
-	assert(deltaCode == (deltaCode & 15) /* 2#1111 */);
+	int fd;
 
-	int step = stepSizeTable[state->index];
+	if (str_len(args->peaks_file) && peaks_init(peaks, channels, args->peaks_buckets)) {
+		LOG(D0_ERROR, "error: invalid peak bucket list [%s]", args->peaks_buckets);
+		return -1;
+	}
+	if (args->loudness) {
+		loudness_init(loudness, channels, args->rate);
+	}
+	if (args->hash >= 0) {
+		hash_init(hash, args->hash);
+	}
 
-	int difference = step >> 3;
-	if (deltaCode & 1) difference += step >> 2;
-	if (deltaCode & 2) difference += step >> 1;
-	if (deltaCode & 4) difference += step;
-	if (deltaCode & 8) difference = -difference;
+	if (strcmp(output_path, "-") == 0) {
+		fd = STDOUT_FILENO;
+	} else {
+		struct stat st[1];
 
-	state->sample += difference;
-	if (state->sample > 32767) state->sample = 32767;
-	else if (state->sample < -32768) state->sample = -32768;
+		/* --batch fans duplicates out as hardlinks, truncating one
+		 * would rewrite every name of it, so the link is broken first
+		 */
+		if (lstat(output_path, st) == 0 && S_ISREG(st->st_mode) && st->st_nlink > 1 && unlink(output_path) != 0) {
+			perror(output_path);
+			return -1;
+		}
+		if ((fd = open(output_path, O_CREAT | O_WRONLY | O_TRUNC, 0644)) < 0) {
+			int save_errno = errno;
+			assert(fd == -1);
+			LOG(D0_ERROR, "open(output_path=[%s], O_CREAT | O_WRONLY | O_TRUNC, 0644), errno=%i", output_path, save_errno);
+			errno = save_errno;
+			perror(output_path);
+			return -1;
+		}
+	}
 
-	state->index += indexAdjustTable4bit[deltaCode];
-	if (state->index < 0) state->index = 0;
-	else if (state->index > 88) state->index = 88;
+	if (args->flac) {
+		flac = flac_open(fd, channels, args->rate, total_samples, workers());
+	}
+	return fd;
+}
 
-	return state->sample;
+/* json members of the --loudness and --hash lines of the last output,
+ * one line each, kept for the --batch copies of it
+ */
+static struct str report[1];
+
+/* the report lines, naming output_path
+ */
+static void print_report(const char *output_path, const char *lines)
+{
+	DEFINE_STR(line);
+	const char *p, *nl;
+
+	for (p = lines; (nl = strchr(p, '\n')); p = nl + 1) {
+		str_copyz(line, "{\"output\": ");
+		cat_json_string(line, output_path);
+		str_catf(line, ", %.*s}\n", (int)(nl - p), p);
+		fputs(line->s, stderr);
+	}
+	str_free(line);
 }
 
-static int adpcm_decode5bit(int deltaCode, struct adpcm_state *state)
+/* flushes and closes what output_open set up, the sidecars and json
+ * reports included
+ */
+static int output_close(int fd, const char *output_path)
 {
-	assert(deltaCode >= 0);
-	assert(deltaCode <= 31 /* 2#11111 */);
+	if (flac) {
+		int64_t bytes = flac_close(flac);
+		flac = NULL;
+		if (bytes < 0) {
+			if (fd != STDOUT_FILENO) {
+				close(fd);
+			}
+			return 1;
+		}
+		stats->bytes_out += bytes;
+		stats_phase(STATS_WRITE);
+	}
 
-	int step = stepSizeTable[state->index];
+	if (fd != STDOUT_FILENO) {
+		assert(close(fd) == 0);
+		fd = -1;
+	}
 
-	int difference = step >> 4;
-	if (deltaCode & 1) difference += step >> 3;
-	if (deltaCode & 2) difference += step >> 2;
-	if (deltaCode & 4) difference += step >> 1;
-	if (deltaCode & 8) difference += step;
-	if (deltaCode & 16) difference = -difference;
+	str_copyz(report, "");
+	if (args->loudness) {
+		loudness_json(loudness, report);
+		str_catc(report, '\n');
+		loudness_free(loudness);
+	}
 
-	state->sample += difference;
-	if (state->sample > 32767) state->sample = 32767;
-	else if (state->sample < -32768) state->sample = -32768;
+	if (args->hash >= 0) {
+		char hex[2 * HASH_MAX_DIGEST + 1];
+		hash_final_hex(hash, hex);
+		str_catf(report, "\"hash\": \"%s\", \"digest\": \"%s\"\n", hash_name(args->hash), hex);
+	}
+	print_report(output_path, report->s);
 
-	state->index += indexAdjustTable5bit[deltaCode];
-	if (state->index < 0) state->index = 0;
-	else if (state->index > 88) state->index = 88;
+	if (str_len(args->peaks_file)) {
+		int ret = peaks_write(peaks, args->peaks_file->s, args->rate);
+		peaks_free(peaks);
+		if (ret) {
+			return 1;
+		}
+	}
 
-	return state->sample;
+	return 0;
 }
 
-static int write_exact(int fd, void *buf, int len);
-
-int doit(const char *adpcm_path)
+/* len (> 0) bytes of ADPCMSOUNDDATA
+ */
+static int decode_sound(const unsigned char *in, int64_t len, int channels, const char *output_path)
 {
-	DEFINE_STR(input);
+	struct adpcm_stream stream[1];
+	struct adpcm_layout layout[1];
+	int16_t output[ADPCM_PACKET_SAMPLES * 2];
+	int64_t bitpos, nbits;
+	int64_t sample_number = 0;
+	int n, fd;
+
+	DEBUG("input size=%lli", (long long)len);
+	DEBUG("first byte=0x%x", *in);
 
-	/* prepare input
+	/* ADPCMSOUNDDATA
 	 */
 
-	str_from_file(input, adpcm_path);
+	if (adpcm_stream_init(stream, in, channels)) {
+		LOG(D0_ERROR, "error: invalid channel count");
+		return 1;
+	}
 
-	assert(input->len);
+	DEBUG("adpcm_code_size=%i", stream->code_size);
+	DEBUG("bits_per_code=%i", stream->bits_per_code);
 
-	const char *in = input->s;
-	const char *last = in + input->len;
+	stats->code_size = stream->code_size;
+	stats_phase(STATS_PARSE);
 
-	DEBUG("input size=%i", input->len);
-	DEBUG("first byte=0x%x", *in);
+	nbits = len * 8;
+	adpcm_stream_layout(stream, nbits, layout);
 
-	if (args->is_stereo) {
-		DEBUG("ADPCMSTEREOPACKET not implemented yet");
-	} else {
-		/* ADPCMSOUNDDATA
-		 */
-		int adpcm_code_size;
-		int initial_sample;
-		int initial_index;
-		long sample_number = 0;
+	if ((fd = output_open(output_path, stream->channels, layout->samples)) < 0) {
+		return 1;
+	}
 
-		assert((in + 2) < last);
+	/* ADPCMMONOPACKET/ADPCMSTEREOPACKET, the last one may be short
+	 */
 
-		adpcm_code_size = *(unsigned char*)in >> 6;              /* get UB[2]*/
+	bitpos = ADPCM_STREAM_START;
 
-		initial_sample =
-			((*(unsigned char*)in & ((1<<6)-1)) << (16-6)) | /* SI16 UB[6] */
-			(*(unsigned char*)(in+1) << (16-6-8)) |          /* SI16 UB[8] */
-			(*(unsigned char*)(in+2) >> 6);                  /* SI16 UB[2] */
-		initial_sample = (int16_t)initial_sample;
+	while ((n = decode_packet(stream, in, nbits, &bitpos, output)) > 0) {
+		TRACE("initial_sample=%i", output[0]);
+		TRACE("sample_number=%lli, count=%i", (long long)sample_number, n);
+		sample_number += n;
+		output_packet(fd, output, n * stream->channels);
+	}
 
-		initial_index = *(unsigned char*)(in+2) & ((1<<6)-1);    /* UB[6] */
+	if (nbits - bitpos >= 8) {
+		LOG(D0_WARN, "%lli trailing bits ignored", (long long)(nbits - bitpos));
+	}
 
-		DEBUG("adpcm_code_size=%i", adpcm_code_size);
+	return output_close(fd, output_path);
+}
 
-		in += 3;
+static int decode(struct str *input, const char *output_path)
+{
+	return decode_sound((unsigned char*)input->s, input->len, args->is_stereo ? 2 : 1, output_path);
+}
 
-		/* got ADPCMSOUNDDATA and ADPCMMONOPACKET header
-		 */
+/* --pipeline: a reader thread fills input chunks, a decoder thread
+ * turns them into packets and the calling thread writes them through
+ * output_packet, the stages joined by rings of preallocated slots
+ *
+ * packets are not byte aligned and straddle chunks, so the reader puts
+ * the last PIPE_OVERLAP bytes of a chunk in front of the next one and
+ * the decoder, which only takes a packet once it is whole (or the input
+ * ended), resumes in that copy
+ */
 
-		struct adpcm_state state[1] = {{.index = initial_index, .sample = initial_sample}};
-
-		int bits_per_code = adpcm_code_size + 2;
-		DEBUG("bits_per_code=%i", bits_per_code);
-		
-		//DEBUG("initial_sample=%i (first)", initial_sample);
-		//DEBUG("initial_index=%i (first)", initial_index);
-
-		int16_t output[4095], *outputp = output;
-		*outputp++ = initial_sample;
-		sample_number++;
-
-		switch (adpcm_code_size) {
-		case 1: /* 3 bits/sample */
-		{
-			int count = 0;
-			int heading_bits = 0;
-			int amount_of_heading_bits = 0;
-
-			while (in < last && count < 4095) {
-				assert((in + 2) < last);
-
-				int i0 = *(unsigned char*)in++;
-				int i1 = *(unsigned char*)in++;
-				int i2 = *(unsigned char*)in++;
-				
-				int s0 = i0 >> 5;
-				int s1 = (i0 >> 2) & 7;
-				int s2 = ((i0 & 3) << 1) | (i1 >> 7);
-				int s3 = (i1 >> 4) & 7;
-				int s4 = (i1 >> 1) & 7;
-				int s5 = ((i1 & 1) << 2) | (i2 >> 6);
-				int s6 = (i2 >> 3) & 7;
-				int s7 = i2 & 7;
-
-				*outputp++ = adpcm_decode3bit(s0, state);
-				*outputp++ = adpcm_decode3bit(s1, state);
-				*outputp++ = adpcm_decode3bit(s2, state);
-				*outputp++ = adpcm_decode3bit(s3, state);
-				*outputp++ = adpcm_decode3bit(s4, state);
-				*outputp++ = adpcm_decode3bit(s5, state);
-				*outputp++ = adpcm_decode3bit(s6, state);
-				count += 7; /* 7-samples so far */
-				sample_number += 7;
-
-				if (count >= 4095) {
-					assert(count == 4095);
-					/* i2 holds next packet UB[3] at it's tail
-					 */
-					heading_bits = i2 & 7;
-					amount_of_heading_bits = 3;
-					break;
-				}
-
-				*outputp++ = adpcm_decode3bit(s7, state);
-				count++; /* 8-samples (for each 3-byte input) */
-				sample_number++;
-			}
+#define PIPE_CHUNK (1 << 20)
+#define PIPE_OVERLAP 8192 /* > a stereo 5-bit packet, 5130 bytes */
+#define PIPE_IN_SLOTS 4
+#define PIPE_OUT_SLOTS 4
+#define PIPE_OUT_PACKETS 32
+
+struct pipe_in {
+	unsigned char *buf; /* PIPE_OVERLAP + PIPE_CHUNK */
+	int prefix; /* bytes of the previous chunks before buf + PIPE_OVERLAP */
+	int len;
+	int eof;
+};
 
-			if (in < last && count != 4095) {
-				/* this ensures heading_bits got set
-				 */
-				DEBUG("exhaustion");
-				exit(1);
-			}
+struct pipe_out {
+	int16_t samples[PIPE_OUT_PACKETS * ADPCM_PACKET_SAMPLES * 2];
+	int counts[PIPE_OUT_PACKETS]; /* interleaved samples per packet */
+	int npackets;
+	int eof;
+	int error;
+};
 
-			int output_len = ((unsigned char*)outputp) - ((unsigned char*)output);
-			//DEBUG("count=%i, outputp-output=%i", count, output_len);
+struct pipeline {
+	int in_fd;
+	int64_t in_size; /* -1 when not known up front */
+	int64_t bytes_in;
+	struct ring in[1], out[1];
+	void *in_slots[PIPE_IN_SLOTS], *out_slots[PIPE_OUT_SLOTS];
 
-			/* write first ADPCMMONOPACKET
-			 */
+	/* set by the decoder before its first slot is published
+	 */
+	int channels;
+	int64_t samples;
+};
 
-			int use_stdout = str_len(args->output_file) == 1 && args->output_file->s[0] == '-';
-			int fd;
-
-			if (use_stdout) {
-				fd = STDOUT_FILENO;
-			} else {
-				if ((fd = open(args->output_file->s, O_CREAT | O_WRONLY | O_TRUNC, 0644)) < 0) {
-					int save_errno = errno;
-					assert(fd == -1);
-					DEBUG("open(args->output_file->s=[%s], O_CREAT | O_WRONLY | O_TRUNC, 0644), errno=%i", args->output_file->s, save_errno);
-					errno = save_errno;
-					perror(args->output_file->s);
-					break;
-				}
+static void *pipe_reader(void *arg)
+{
+	struct pipeline *pl = arg;
+	unsigned char tail[PIPE_OVERLAP];
+	int tail_len = 0;
+
+	for (;;) {
+		struct pipe_in *c = ring_acquire(pl->in);
+		ssize_t n = 0;
+
+		memcpy(c->buf + PIPE_OVERLAP - tail_len, tail, tail_len);
+		c->prefix = tail_len;
+		c->len = 0;
+		c->eof = 0;
+		while (c->len < PIPE_CHUNK) {
+			if ((n = read(pl->in_fd, c->buf + PIPE_OVERLAP + c->len, PIPE_CHUNK - c->len)) <= 0) {
+				if (n < 0 && errno == EINTR) continue;
+				break;
 			}
-			assert(write_exact(fd, output, output_len) == output_len);
+			c->len += n;
+		}
+		if (n < 0) {
+			perror("read");
+		}
+		c->eof = n <= 0;
+		pl->bytes_in += c->len;
 
-			/* more data?
-			 */
+		/* the overlap for the next chunk, which may need bytes from
+		 * before this one when it is short
+		 */
+		if (c->len >= PIPE_OVERLAP) {
+			tail_len = PIPE_OVERLAP;
+		} else {
+			tail_len = c->prefix + c->len < PIPE_OVERLAP ? c->prefix + c->len : PIPE_OVERLAP;
+		}
+		memcpy(tail, c->buf + PIPE_OVERLAP + c->len - tail_len, tail_len);
+
+		ring_publish(pl->in);
+		if (c->eof) {
+			break;
+		}
+	}
+	return NULL;
+}
 
-			while (in < last) {
-				if (amount_of_heading_bits == 0) {
-					if ((in + 2) >= last) break;
-
-					/*
-					 * [in:8,in1:8] [in2:6] [in2:2]
-					 * ---- 16 ---- -- 6 -- ...
-					 */
-
-					initial_sample = (*(unsigned char*)(in) << 8) | (*(unsigned char*)(in+1));   /* SI16 */
-					initial_sample = (int16_t)initial_sample;
-					initial_index = *(unsigned char*)(in+2) >> 2;   /* UB[6] */
-
-					int i0 = *(unsigned char*)(in+2) & 3; /* UB[2] for next delta */
-
-					//DEBUG("initial_sample=%i", initial_sample);
-					//DEBUG("initial_index=%i", initial_index);
-
-					in += 3;
-
-					/* got ADPCMMONOPACKET header
-					 *
-					 * note: we still have UB[2] hanging on i0
-					 *
-					 *  2] [1|3|3|1] [2|3|3]: 2 bytes to get even
-					 *
-					 */
-
-					state->index = initial_index;
-					state->sample = initial_sample;
-					outputp = output;
-					*outputp++ = initial_sample;
-					sample_number++;
-
-					assert((in + 1) < last);
-
-					int i1 = *(unsigned char*)in++;
-					int i2 = *(unsigned char*)in++;
-
-					int s2 = ((i0 & 3) << 1) | (i1 >> 7);
-					int s3 = (i1 >> 4) & 7;
-					int s4 = (i1 >> 1) & 7;
-					int s5 = ((i1 & 1) << 2) | (i2 >> 6);
-					int s6 = (i2 >> 3) & 7;
-					int s7 = i2 & 7;
-
-					*outputp++ = adpcm_decode3bit(s2, state);
-					*outputp++ = adpcm_decode3bit(s3, state);
-					*outputp++ = adpcm_decode3bit(s4, state);
-					*outputp++ = adpcm_decode3bit(s5, state);
-					*outputp++ = adpcm_decode3bit(s6, state);
-					*outputp++ = adpcm_decode3bit(s7, state);
-					count = 6;
-					sample_number += 6;
-				} else if (amount_of_heading_bits == 3) {
-					if ((in + 2) >= last) break;
-
-					/*
-					 * [3,in:8,in1:5] [in1:3,in2:3] [in2:5]
-					 * ----- 16 ----- ----- 6 ----- ...
-					 */
-
-					initial_sample =
-						(heading_bits << (16-3)) |            /* SI16 UB[3] */
-						(*(unsigned char*)in << (16-3-8)) |   /* SI16 UB[8] */
-						(*(unsigned char*)(in+1) >> 3);       /* SI16 UB[5] */
-					initial_sample = (int16_t)initial_sample;
-
-					initial_index =
-						((*(unsigned char*)(in+1) & 7) << 3) |  /* UB[6] UB[3] */
-						(*(unsigned char*)(in+2) >> 5);         /* UB[6] UB[3] */
-
-					int i0 = *(unsigned char*)(in+2) & 31; /* UB[5] for next delta */
-
-					//DEBUG("initial_sample=%i", initial_sample);
-					//DEBUG("initial_index=%i", initial_index);
-
-					in += 3;
-
-					/* got ADPCMMONOPACKET header
-					 *
-					 * note: we still have UB[5] hanging on i0
-					 *
-					 *  3|2] [1|3|3|1] [2|3|3]: 2 bytes to get even
-					 *
-					 */
-
-					state->index = initial_index;
-					state->sample = initial_sample;
-					outputp = output;
-					*outputp++ = initial_sample;
-					sample_number++;
-
-					assert((in + 1) < last);
-
-					int i1 = *(unsigned char*)in++;
-					int i2 = *(unsigned char*)in++;
-
-					int s1 = (i0 >> 2) & 7;
-					int s2 = ((i0 & 3) << 1) | (i1 >> 7);
-					int s3 = (i1 >> 4) & 7;
-					int s4 = (i1 >> 1) & 7;
-					int s5 = ((i1 & 1) << 2) | (i2 >> 6);
-					int s6 = (i2 >> 3) & 7;
-					int s7 = i2 & 7;
-
-					*outputp++ = adpcm_decode3bit(s1, state);
-					*outputp++ = adpcm_decode3bit(s2, state);
-					*outputp++ = adpcm_decode3bit(s3, state);
-					*outputp++ = adpcm_decode3bit(s4, state);
-					*outputp++ = adpcm_decode3bit(s5, state);
-					*outputp++ = adpcm_decode3bit(s6, state);
-					*outputp++ = adpcm_decode3bit(s7, state);
-					count = 7;
-					sample_number += 7;
-				} else if (amount_of_heading_bits == 4) {
-					if ((in + 2) >= last) break;
-
-					/*
-					 * [4,in:8,in1:4] [in1:4,in2:2] [in2:6]
-					 * ----- 16 ----- ----- 6 ----- ...
-					 */
-
-					initial_sample =
-						(heading_bits << (16-4)) |            /* SI16 UB[4] */
-						(*(unsigned char*)in << (16-4-8)) |   /* SI16 UB[8] */
-						(*(unsigned char*)(in+1) >> 4);       /* SI16 UB[4] */
-					initial_sample = (int16_t)initial_sample;
-
-					initial_index =
-						((*(unsigned char*)(in+1) & 15) << 2) |  /* UB[6] UB[4] */
-						(*(unsigned char*)(in+2) >> 6);          /* UB[6] UB[2] */
-
-					int i0 = *(unsigned char*)(in+2) & 63; /* UB[6] for next delta */
-
-					//DEBUG("initial_sample=%i", initial_sample);
-					//DEBUG("initial_index=%i", initial_index);
-
-					in += 3;
-
-					/* got ADPCMMONOPACKET header
-					 *
-					 * note: we still have UB[6] hanging on i0
-					 *
-					 *  3|3]: 0 bytes to get even
-					 *
-					 */
-
-					state->index = initial_index;
-					state->sample = initial_sample;
-					outputp = output;
-					*outputp++ = initial_sample;
-					sample_number++;
-
-					int s6 = (i0 >> 3) & 7;
-					int s7 = i0 & 7;
-
-					*outputp++ = adpcm_decode3bit(s6, state);
-					*outputp++ = adpcm_decode3bit(s7, state);
-					count = 2;
-					sample_number += 2;
-				} else if (amount_of_heading_bits == 5) {
-					if ((in + 2) >= last) break;
-
-					/*
-					 * [5,in:8,in1:3] [in1:5,in2:1] [in2:7]
-					 * ----- 16 ----- ----- 6 ----- ...
-					 */
-
-					initial_sample =
-						(heading_bits << (16-5)) |            /* SI16 UB[5] */
-						(*(unsigned char*)in << (16-5-8)) |   /* SI16 UB[8] */
-						(*(unsigned char*)(in+1) >> 5);       /* SI16 UB[3] */
-					initial_sample = (int16_t)initial_sample;
-
-					initial_index =
-						((*(unsigned char*)(in+1) & 31) << 1) |  /* UB[6] UB[5] */
-						(*(unsigned char*)(in+2) >> 7);          /* UB[6] UB[1] */
-
-					int i0 = *(unsigned char*)(in+2) & 127; /* UB[7] for next delta */
-
-					//DEBUG("initial_sample=%i", initial_sample);
-					//DEBUG("initial_index=%i", initial_index);
-
-					in += 3;
-
-					/* got ADPCMMONOPACKET header
-					 *
-					 * note: we still have UB[7] hanging on i0
-					 *
-					 *  3|3|1] [2|3|3]: 1 bytes to get even
-					 *
-					 */
-
-					state->index = initial_index;
-					state->sample = initial_sample;
-					outputp = output;
-					*outputp++ = initial_sample;
-					sample_number++;
-
-					assert(in < last);
-
-					int i1 = *(unsigned char*)in++;
-
-					int s3 = (i0 >> 4) & 7;
-					int s4 = (i0 >> 1) & 7;
-					int s5 = ((i0 & 1) << 2) | (i1 >> 6);
-					int s6 = (i1 >> 3) & 7;
-					int s7 = i1 & 7;
-
-					*outputp++ = adpcm_decode3bit(s3, state);
-					*outputp++ = adpcm_decode3bit(s4, state);
-					*outputp++ = adpcm_decode3bit(s5, state);
-					*outputp++ = adpcm_decode3bit(s6, state);
-					*outputp++ = adpcm_decode3bit(s7, state);
-					count = 5;
-					sample_number += 5;
-				} else if (amount_of_heading_bits == 2) {
-					if ((in + 2) >= last) break;
-
-					/*
-					 * [2,in:8,in1:6] [in1:2,in2:4] [in2:4]
-					 * ----- 16 ----- ----- 6 ----- ...
-					 */
-
-					initial_sample =
-						(heading_bits << (16-2)) |            /* SI16 UB[2] */
-						(*(unsigned char*)in << (16-2-8)) |   /* SI16 UB[8] */
-						(*(unsigned char*)(in+1) >> 2);       /* SI16 UB[6] */
-					initial_sample = (int16_t)initial_sample;
-
-					initial_index =
-						((*(unsigned char*)(in+1) & 3) << 4) |   /* UB[6] UB[2] */
-						(*(unsigned char*)(in+2) >> 4);          /* UB[6] UB[4] */
-
-					int i0 = *(unsigned char*)(in+2) & 15;   /* UB[4] for next delta */
-
-					//DEBUG("initial_sample=%i", initial_sample);
-					//DEBUG("initial_index=%i", initial_index);
-
-					in += 3;
-
-					/* got ADPCMMONOPACKET header
-					 *
-					 * note: we still have UB[4] hanging on i0
-					 *
-					 *  3|1] [2|3|3]: 1 bytes to get even
-					 *
-					 */
-
-					state->index = initial_index;
-					state->sample = initial_sample;
-					outputp = output;
-					*outputp++ = initial_sample;
-					sample_number++;
-
-					assert(in < last);
-
-					int i1 = *(unsigned char*)in++;
-
-					int s4 = (i0 >> 1) & 7;
-					int s5 = ((i0 & 1) << 2) | (i1 >> 6);
-					int s6 = (i1 >> 3) & 7;
-					int s7 = i1 & 7;
-
-					*outputp++ = adpcm_decode3bit(s4, state);
-					*outputp++ = adpcm_decode3bit(s5, state);
-					*outputp++ = adpcm_decode3bit(s6, state);
-					*outputp++ = adpcm_decode3bit(s7, state);
-					count = 4;
-					sample_number += 4;
-				} else if (amount_of_heading_bits == 7) {
-					if ((in + 1) >= last) break;
-
-					/*
-					 * [7,in:8,in1:1] [in1:6] [in1:1]
-					 * ----- 16 ----- -- 6 -- ...
-					 */
-
-					initial_sample =
-						(heading_bits << (16-7)) |            /* SI16 UB[7] */
-						(*(unsigned char*)in << (16-7-8)) |   /* SI16 UB[8] */
-						(*(unsigned char*)(in+1) >> 7);       /* SI16 UB[1] */
-					initial_sample = (int16_t)initial_sample;
-
-					initial_index = ((*(unsigned char*)(in+1) >> 1)) & 63;  /* UB[6] UB[6] (note: UB[1] gone to initial_sample) */
-
-					int i0 = *(unsigned char*)(in+1) & 1;    /* UB[1] for next delta */
-
-					//DEBUG("initial_sample=%i", initial_sample);
-					//DEBUG("initial_index=%i", initial_index);
-
-					in += 2;
-
-					/* got ADPCMMONOPACKET header
-					 *
-					 * note: we still have UB[1] hanging on i0
-					 *
-					 *  1] [2|3|3]: 1 bytes to get even
-					 *
-					 */
-
-					state->index = initial_index;
-					state->sample = initial_sample;
-					outputp = output;
-					*outputp++ = initial_sample;
-					sample_number++;
-
-					assert(in < last);
-
-					int i1 = *(unsigned char*)in++;
-
-					int s5 = ((i0 & 1) << 2) | (i1 >> 6);
-					int s6 = (i1 >> 3) & 7;
-					int s7 = i1 & 7;
-
-					*outputp++ = adpcm_decode3bit(s5, state);
-					*outputp++ = adpcm_decode3bit(s6, state);
-					*outputp++ = adpcm_decode3bit(s7, state);
-					count = 3;
-					sample_number += 3;
-				} else if (amount_of_heading_bits == 1) {
-					if ((in + 2) >= last) break;
-
-					/*
-					 * [1,in:8,in1:7] [in1:1,in2:5] [in2:3]
-					 * ----- 16 ----- ----- 6 ----- ...
-					 */
-
-					initial_sample =
-						(heading_bits << (16-1)) |            /* SI16 UB[1] */
-						(*(unsigned char*)in << (16-1-8)) |   /* SI16 UB[8] */
-						(*(unsigned char*)(in+1) >> 1);       /* SI16 UB[7] */
-					initial_sample = (int16_t)initial_sample;
-
-					initial_index =
-						((*(unsigned char*)(in+1) & 1) << 5) |   /* UB[6] UB[1] */
-						(*(unsigned char*)(in+2) >> 3);          /* UB[6] UB[5] */
-
-					int i0 = *(unsigned char*)(in+2) & 7;   /* UB[3] for next delta */
-
-					//DEBUG("initial_sample=%i", initial_sample);
-					//DEBUG("initial_index=%i", initial_index);
-
-					in += 3;
-
-					/* got ADPCMMONOPACKET header
-					 *
-					 * note: we still have UB[3] hanging on i0
-					 *
-					 *  3]: 0 bytes to get even
-					 *
-					 */
-
-					state->index = initial_index;
-					state->sample = initial_sample;
-					outputp = output;
-					*outputp++ = initial_sample;
-					sample_number++;
-
-					int s7 = i0 & 7;
-
-					*outputp++ = adpcm_decode3bit(s7, state);
-					count = 1;
-					sample_number++;
-				} else if (amount_of_heading_bits == 6) {
-					if ((in + 1) >= last) break;
-
-					/*
-					 * [6,in:8,in1:2] [in1:6] (we are even!)
-					 * ----- 16 ----- -- 6 -- ...
-					 */
-
-					initial_sample =
-						(heading_bits << (16-6)) |            /* SI16 UB[6] */
-						(*(unsigned char*)in << (16-6-8)) |   /* SI16 UB[8] */
-						(*(unsigned char*)(in+1) >> 6);       /* SI16 UB[2] */
-					initial_sample = (int16_t)initial_sample;
-
-					initial_index = *(unsigned char*)(in+1) & 63;  /* UB[6] UB[6] (we are even!) */
-
-					//DEBUG("initial_sample=%i", initial_sample);
-					//DEBUG("initial_index=%i", initial_index);
-
-					in += 2;
-
-					/* got ADPCMMONOPACKET header
-					 */
-
-					state->index = initial_index;
-					state->sample = initial_sample;
-					outputp = output;
-					*outputp++ = initial_sample;
-					sample_number++;
-
-					count = 0;
-				} else {
-					DEBUG("exhaustion, amount_of_heading_bits=%i", amount_of_heading_bits);
-					exit(1);
-				}
-
-				heading_bits = 0;
-				amount_of_heading_bits = 0;
-
-				//DEBUG("sample_number=%li", sample_number);
-
-				while (in < last && count < 4095) {
-					/* i0
-					 */
-
-					int i0 = *(unsigned char*)in++;
-					int s0 = i0 >> 5;
-					int s1 = (i0 >> 2) & 7;
-
-					*outputp++ = adpcm_decode3bit(s0, state);
-					count++;
-					sample_number++;
-					if (count == 4095) {
-						heading_bits = i0 & 31;
-						amount_of_heading_bits = 5;
-						break;
-					}
-
-					*outputp++ = adpcm_decode3bit(s1, state);
-					count++;
-					sample_number++;
-					if (count == 4095) {
-						heading_bits = i0 & 3;
-						amount_of_heading_bits = 2;
-						break;
-					}
-
-					/* i1
-					 */
-
-					if (in > last) break;
-					int i1 = *(unsigned char*)in++;
-					int s2 = ((i0 & 3) << 1) | (i1 >> 7);
-					int s3 = (i1 >> 4) & 7;
-					int s4 = (i1 >> 1) & 7;
-
-					*outputp++ = adpcm_decode3bit(s2, state);
-					count++;
-					sample_number++;
-					if (count == 4095) {
-						heading_bits = i1 & 127;
-						amount_of_heading_bits = 7;
-						break;
-					}
-
-					*outputp++ = adpcm_decode3bit(s3, state);
-					count++;
-					sample_number++;
-					if (count == 4095) {
-						heading_bits = i1 & 15;
-						amount_of_heading_bits = 4;
-						break;
-					}
-
-					*outputp++ = adpcm_decode3bit(s4, state);
-					count++;
-					sample_number++;
-					if (count == 4095) {
-						heading_bits = i1 & 1;
-						amount_of_heading_bits = 1;
-						break;
-					}
-
-					/* i2
-					 */
-
-					if (in > last) break;
-					int i2 = *(unsigned char*)in++;
-					int s5 = ((i1 & 1) << 2) | (i2 >> 6);
-					int s6 = (i2 >> 3) & 7;
-					int s7 = i2 & 7;
-
-					*outputp++ = adpcm_decode3bit(s5, state);
-					count++;
-					sample_number++;
-					if (count == 4095) {
-						heading_bits = i2 & 63;
-						amount_of_heading_bits = 6;
-						break;
-					}
-
-					*outputp++ = adpcm_decode3bit(s6, state);
-					count++;
-					sample_number++;
-					if (count == 4095) {
-						heading_bits = i2 & 7;
-						amount_of_heading_bits = 3;
-						break;
-					}
-
-					*outputp++ = adpcm_decode3bit(s7, state);
-					count++;
-					sample_number++;
-				}
-
-				if (in < last && count != 4095) {
-					DEBUG("exhaustion, count=%i, last-in=%i", count, (int)(last-in));
-					exit(1);
-				}
-
-				int output_len = ((unsigned char*)outputp) - ((unsigned char*)output);
-				//DEBUG("count=%i, outputp-output=%i", count, output_len);
-
-				assert(write_exact(fd, output, output_len) == output_len);
+static void *pipe_decoder(void *arg)
+{
+	struct pipeline *pl = arg;
+	struct adpcm_stream stream[1];
+	struct pipe_out *o = NULL;
+	int64_t start = 0; /* stream offset of the current chunk */
+	int64_t pos = ADPCM_STREAM_START; /* stream bit position */
+	int started = 0, eof = 0, failed = 0;
+
+	while (!eof) {
+		struct pipe_in *c = ring_peek(pl->in);
+		const unsigned char *base = c->buf + PIPE_OVERLAP - c->prefix;
+		int64_t base_bits = (start - c->prefix) * 8;
+		int64_t nbits = (int64_t)(c->prefix + c->len) * 8;
+		int64_t bitpos;
+		int n;
+
+		eof = c->eof;
+
+		/* after an error the input is drained, so the reader ends
+		 */
+		if (failed) {
+			ring_release(pl->in);
+			continue;
+		}
+
+		if (!started) {
+			const char *error = NULL;
+			if (c->len == 0) {
+				error = "empty input";
+			} else if (adpcm_stream_init(stream, base, args->is_stereo ? 2 : 1)) {
+				error = "invalid channel count";
+			}
+			if (error) {
+				LOG(D0_ERROR, "error: %s", error);
+				o = ring_acquire(pl->out);
+				o->npackets = 0;
+				o->eof = o->error = 1;
+				ring_publish(pl->out);
+				ring_release(pl->in);
+				failed = 1;
+				continue;
+			}
+			pl->channels = stream->channels;
+			if (pl->in_size > 0) {
+				struct adpcm_layout layout[1];
+				adpcm_stream_layout(stream, pl->in_size * 8, layout);
+				pl->samples = layout->samples;
 			}
+			stats->code_size = stream->code_size;
+			started = 1;
+		}
 
-			/* close output
-			 */
+		bitpos = pos - base_bits;
+		assert(bitpos >= 0);
 
-			if (fd != STDOUT_FILENO) {
-				assert(close(fd) == 0);
-				fd = -1;
+		/* whole packets only, unless nothing more is coming
+		 */
+		while (bitpos + (eof ? ADPCM_PACKET_HEADER_BITS * stream->channels : stream->packet_bits) <= nbits) {
+			if (o == NULL) {
+				o = ring_acquire(pl->out);
+				o->npackets = 0;
+				o->eof = o->error = 0;
+			}
+			n = decode_packet(stream, base, nbits, &bitpos, o->samples + o->npackets * ADPCM_PACKET_SAMPLES * 2);
+			if (n <= 0) {
+				break;
 			}
+			o->counts[o->npackets++] = n * stream->channels;
+			if (o->npackets == PIPE_OUT_PACKETS) {
+				ring_publish(pl->out);
+				o = NULL;
+			}
+		}
 
-			break;
+		pos = base_bits + bitpos;
+		start += c->len;
+		ring_release(pl->in);
+
+		if (eof && nbits - bitpos >= 8) {
+			LOG(D0_WARN, "%lli trailing bits ignored", (long long)(nbits - bitpos));
 		}
-		case 3: /* 5 bits/sample */
-		{
-			int count = 0;
-			int heading_bits = 0;
-			int amount_of_heading_bits = 0;
-
-			while (in < last && count < 4095) {
-				if ((in + 4) >= last) break;
-
-				int i0 = *(unsigned char*)in++;
-				int i1 = *(unsigned char*)in++;
-				int i2 = *(unsigned char*)in++;
-				int i3 = *(unsigned char*)in++;
-				int i4 = *(unsigned char*)in++;
-
-				int s0 = i0 >> 3;
-				int s1 = ((i0 & 7) << 2) | (i1 >> 6);
-				int s2 = (i1 >> 1) & 31;
-				int s3 = ((i1 & 1) << 4) | (i2 >> 4);
-				int s4 = ((i2 & 15) << 1) | (i3 >> 7);
-				int s5 = (i3 >> 2) & 31;
-				int s6 = ((i3 & 3) << 3) | (i4 >> 5);
-				int s7 = i4 & 31;
-
-				*outputp++ = adpcm_decode5bit(s0, state);
-				*outputp++ = adpcm_decode5bit(s1, state);
-				*outputp++ = adpcm_decode5bit(s2, state);
-				*outputp++ = adpcm_decode5bit(s3, state);
-				*outputp++ = adpcm_decode5bit(s4, state);
-				*outputp++ = adpcm_decode5bit(s5, state);
-				*outputp++ = adpcm_decode5bit(s6, state);
-				count += 7; /* 7-samples so far */
-				sample_number += 7;
-
-				if (count >= 4095) {
-					assert(count == 4095);
-					heading_bits = i4 & 31;
-					amount_of_heading_bits = 5;
-					break;
-				}
-
-				*outputp++ = adpcm_decode5bit(s7, state);
-				count++; /* 8-samples (for each 3-byte input) */
-				sample_number++;
-			}
+	}
 
-			if (in < last && count != 4095) {
-				DEBUG("first packet is incomplete, count=%i, last-in=%i", count, (int)(last-in));
-				do {
-					if (in >= last) break;
-					int i0 = *(unsigned char*)in++;
-					int s0 = i0 >> 3;
-					*outputp++ = adpcm_decode5bit(s0, state);
-					count++;
-					sample_number++;
-
-					if (in >= last) break;
-					int i1 = *(unsigned char*)in++;
-					int s1 = ((i0 & 7) << 2) | (i1 >> 6);
-					int s2 = (i1 >> 1) & 31;
-					*outputp++ = adpcm_decode5bit(s1, state);
-					count++;
-					sample_number++;
-					*outputp++ = adpcm_decode5bit(s2, state);
-					count++;
-					sample_number++;
-
-					if (in >= last) break;
-					int i2 = *(unsigned char*)in++;
-					int s3 = ((i1 & 1) << 4) | (i2 >> 4);
-					*outputp++ = adpcm_decode5bit(s3, state);
-					count++;
-					sample_number++;
-
-					if (in >= last) break;
-					int i3 = *(unsigned char*)in++;
-					int s4 = ((i2 & 15) << 1) | (i3 >> 7);
-					int s5 = (i3 >> 2) & 31;
-					*outputp++ = adpcm_decode5bit(s4, state);
-					count++;
-					sample_number++;
-					*outputp++ = adpcm_decode5bit(s5, state);
-					count++;
-					sample_number++;
-
-					if (in >= last) break;
-					int i4 = *(unsigned char*)in++;
-					int s6 = ((i3 & 3) << 3) | (i4 >> 5);
-					int s7 = i4 & 31;
-					*outputp++ = adpcm_decode5bit(s6, state);
-					count++;
-					sample_number++;
-					*outputp++ = adpcm_decode5bit(s7, state);
-					count++;
-					sample_number++;
-				} while (0);
-			}
+	if (failed) {
+		return NULL;
+	}
+	if (o == NULL) {
+		o = ring_acquire(pl->out);
+		o->npackets = 0;
+		o->error = 0;
+	}
+	o->eof = 1;
+	ring_publish(pl->out);
+	return NULL;
+}
 
-			int output_len = ((unsigned char*)outputp) - ((unsigned char*)output);
-			//DEBUG("count=%i, outputp-output=%i", count, output_len);
+static int decode_pipelined(const char *input_path, const char *output_path)
+{
+	struct pipeline pl[1];
+	pthread_t reader, decoder;
+	struct stat st[1];
+	int i, fd = -1, ret = 0, eof = 0;
+
+	memset(pl, 0, sizeof(pl));
+	pl->in_size = -1;
+
+	if (strcmp(input_path, "-") == 0) {
+		pl->in_fd = STDIN_FILENO;
+	} else if ((pl->in_fd = open(input_path, O_RDONLY)) < 0) {
+		perror(input_path);
+		return 1;
+	}
+	if (fstat(pl->in_fd, st) == 0 && S_ISREG(st->st_mode)) {
+		pl->in_size = st->st_size;
+	}
 
-			/* write first ADPCMMONOPACKET
-			 */
+	for (i=0; i<PIPE_IN_SLOTS; i++) {
+		struct pipe_in *c = calloc(1, sizeof(struct pipe_in));
+		assert(c);
+		c->buf = malloc(PIPE_OVERLAP + PIPE_CHUNK);
+		assert(c->buf);
+		pl->in_slots[i] = c;
+	}
+	for (i=0; i<PIPE_OUT_SLOTS; i++) {
+		pl->out_slots[i] = malloc(sizeof(struct pipe_out));
+		assert(pl->out_slots[i]);
+	}
+	ring_init(pl->in, pl->in_slots, PIPE_IN_SLOTS);
+	ring_init(pl->out, pl->out_slots, PIPE_OUT_SLOTS);
 
-			int use_stdout = str_len(args->output_file) == 1 && args->output_file->s[0] == '-';
-			int fd;
-
-			if (use_stdout) {
-				fd = STDOUT_FILENO;
-			} else {
-				if ((fd = open(args->output_file->s, O_CREAT | O_WRONLY | O_TRUNC, 0644)) < 0) {
-					int save_errno = errno;
-					assert(fd == -1);
-					DEBUG("open(args->output_file->s=[%s], O_CREAT | O_WRONLY | O_TRUNC, 0644), errno=%i", args->output_file->s, save_errno);
-					errno = save_errno;
-					perror(args->output_file->s);
-					break;
-				}
-			}
-			assert(write_exact(fd, output, output_len) == output_len);
+	assert(pthread_create(&reader, NULL, pipe_reader, pl) == 0);
+	assert(pthread_create(&decoder, NULL, pipe_decoder, pl) == 0);
 
-			/* more data?
+	/* this thread is the writer, the output opens on the first slot
+	 * since the channel count comes from the decoder
+	 */
+	while (!eof) {
+		struct pipe_out *o = ring_peek(pl->out);
+		int16_t *samples = o->samples;
+
+		if (o->error) {
+			ret = 1;
+		} else if (fd < 0 && (fd = output_open(output_path, pl->channels, pl->samples)) < 0) {
+			ret = 1;
+		}
+		if (ret) {
+			/* keep draining so the other stages can finish
 			 */
+			eof = o->eof;
+			ring_release(pl->out);
+			continue;
+		}
+		for (i=0; i<o->npackets; i++) {
+			output_packet(fd, samples, o->counts[i]);
+			samples += ADPCM_PACKET_SAMPLES * 2;
+		}
+		eof = o->eof;
+		ring_release(pl->out);
+	}
 
-			while (in < last) {
-				if (amount_of_heading_bits == 5) {
-					if ((in + 2) >= last) break;
-					
-					/*
-					 * [5,in:8,in1:3] [in1:5,in2:1] [in2:7]
-					 * ----- 16 ----- ----- 6 ----- ...
-					 */
-
-					initial_sample =
-						(heading_bits << (16-5)) |            /* SI16 UB[5] */
-						(*(unsigned char*)in << (16-5-8)) |   /* SI16 UB[8] */
-						(*(unsigned char*)(in+1) >> 5);       /* SI16 UB[3] */
-					initial_sample = (int16_t)initial_sample;
-
-					initial_index =
-						((*(unsigned char*)(in+1) & 31) << 1) |  /* UB[6] UB[5] */
-						(*(unsigned char*)(in+2) >> 7);          /* UB[6] UB[1] */
-
-					int i0 = *(unsigned char*)(in+2) & 127; /* UB[7] for next delta */
-
-					//DEBUG("initial_sample=%i", initial_sample);
-					//DEBUG("initial_index=%i", initial_index);
-
-					in += 3;
-
-					/* got ADPCMMONOPACKET header
-					 *
-					 * note: we still have UB[7] hanging on i0
-					 *
-					 *  5|2] [3|5]: 1 bytes to get even
-					 *
-					 */
-
-					state->index = initial_index;
-					state->sample = initial_sample;
-					outputp = output;
-					*outputp++ = initial_sample;
-					sample_number++;
-
-					assert(in < last);
-
-					int i1 = *(unsigned char*)in++;
-
-					int s5 = (i0 >> 2) & 31;
-					int s6 = ((i0 & 3) << 3) | (i1 >> 5);
-					int s7 = i1 & 31;
-
-					*outputp++ = adpcm_decode5bit(s5, state);
-					*outputp++ = adpcm_decode5bit(s6, state);
-					*outputp++ = adpcm_decode5bit(s7, state);
-					count = 3;
-					sample_number += 3;
-				} else {
-					DEBUG("exhaustion, amount_of_heading_bits=%i", amount_of_heading_bits);
-					exit(1);
-				}
-
-				heading_bits = 0;
-				amount_of_heading_bits = 0;
-
-				//DEBUG("sample_number=%li", sample_number);
-
-				while (in < last && count < 4095) {
-					/* i0
-					 */
-
-					int i0 = *(unsigned char*)in++;
-					int s0 = i0 >> 3;
-					*outputp++ = adpcm_decode5bit(s0, state);
-					count++;
-					sample_number++;
-					if (count == 4095) {
-						DEBUG("wip"); exit(1);
-						break;
-					}
-
-					/* i1
-					 */
-
-					if (in >= last) break;
-					int i1 = *(unsigned char*)in++;
-					int s1 = ((i0 & 7) << 2) | (i1 >> 6);
-					int s2 = (i1 >> 1) & 31;
-					*outputp++ = adpcm_decode5bit(s1, state);
-					count++;
-					sample_number++;
-					if (count == 4095) {
-						DEBUG("wip"); exit(1);
-						break;
-					}
-
-					*outputp++ = adpcm_decode5bit(s2, state);
-					count++;
-					sample_number++;
-					if (count == 4095) {
-						DEBUG("wip"); exit(1);
-						break;
-					}
-
-					/* i2
-					 */
-
-					if (in >= last) break;
-					int i2 = *(unsigned char*)in++;
-					int s3 = ((i1 & 1) << 4) | (i2 >> 4);
-					*outputp++ = adpcm_decode5bit(s3, state);
-					count++;
-					sample_number++;
-					if (count == 4095) {
-						DEBUG("wip"); exit(1);
-						break;
-					}
-
-					/* i3
-					 */
-
-					if (in >= last) break;
-					int i3 = *(unsigned char*)in++;
-					int s4 = ((i2 & 15) << 1) | (i3 >> 7);
-					int s5 = (i3 >> 2) & 31;
-					*outputp++ = adpcm_decode5bit(s4, state);
-					count++;
-					sample_number++;
-					if (count == 4095) {
-						DEBUG("wip"); exit(1);
-						break;
-					}
-
-					*outputp++ = adpcm_decode5bit(s5, state);
-					count++;
-					sample_number++;
-					if (count == 4095) {
-						DEBUG("wip"); exit(1);
-						break;
-					}
-
-					/* i4
-					 */
-
-					if (in >= last) break;
-					int i4 = *(unsigned char*)in++;
-					int s6 = ((i3 & 3) << 3) | (i4 >> 5);
-					int s7 = i4 & 31;
-					*outputp++ = adpcm_decode5bit(s6, state);
-					count++;
-					sample_number++;
-					if (count == 4095) {
-						DEBUG("wip"); exit(1);
-						break;
-					}
-
-					*outputp++ = adpcm_decode5bit(s7, state);
-					count++;
-					sample_number++;
-					if (count == 4095) {
-						DEBUG("wip"); exit(1);
-						break;
-					}
-				}
-
-				if (in < last && count != 4095) {
-					DEBUG("exhaustion, count=%i, last-in=%i", count, (int)(last-in));
-					exit(1);
-				}
-
-				int output_len = ((unsigned char*)outputp) - ((unsigned char*)output);
-				//DEBUG("count=%i, outputp-output=%i", count, output_len);
-
-				assert(write_exact(fd, output, output_len) == output_len);
-			}
+	pthread_join(decoder, NULL);
+	pthread_join(reader, NULL);
+	stats->bytes_in += pl->bytes_in;
 
-			/* close output
-			 */
+	if (fd >= 0) {
+		ret |= output_close(fd, output_path);
+	}
 
-			if (fd != STDOUT_FILENO) {
-				assert(close(fd) == 0);
-				fd = -1;
-			}
+	for (i=0; i<PIPE_IN_SLOTS; i++) {
+		free(((struct pipe_in*)pl->in_slots[i])->buf);
+		free(pl->in_slots[i]);
+	}
+	for (i=0; i<PIPE_OUT_SLOTS; i++) {
+		free(pl->out_slots[i]);
+	}
+	if (pl->in_fd != STDIN_FILENO) {
+		close(pl->in_fd);
+	}
+	return ret;
+}
 
-			break;
+/* ADPCM audio tags of an flv, decoded as they are read so a pipe or a
+ * capture still being written can be followed; only one tag is held in
+ * memory at a time
+ */
+static int decode_flv(const char *flv_path, const char *output_path)
+{
+	struct adpcm_stream stream[1];
+	struct flv_audio a[1];
+	struct flv flv[1];
+	int16_t output[ADPCM_PACKET_SAMPLES * 2];
+	int64_t tags = 0, skipped = 0;
+	int i, n, fd = -1, channels = 0, ret = 0;
+	FILE *f;
+
+	if (strcmp(flv_path, "-") == 0) {
+		f = stdin;
+	} else if ((f = fopen(flv_path, "rb")) == NULL) {
+		perror(flv_path);
+		return 1;
+	}
+	if (flv_open(flv, f)) {
+		LOG(D0_ERROR, "error: [%s] is not an flv", flv_path);
+		ret = 1;
+		goto out;
+	}
+
+	while ((i = flv_next_audio(flv, a)) > 0) {
+		int64_t bitpos = ADPCM_STREAM_START, nbits = (int64_t)a->len * 8;
+
+		stats->bytes_in += a->len;
+		stats_phase(STATS_READ);
+
+		if (a->format != FLV_SOUND_ADPCM || a->len == 0) {
+			skipped++;
+			continue;
 		}
-		case 2: /* 4 bits/sample */
-		{
-			int count = 0;
-			int heading_bits = 0;
-			int amount_of_heading_bits = 0;
-
-			while (in < last && count < 4095) {
-				int i0 = *(unsigned char*)in++;
-
-				*outputp++ = adpcm_decode4bit(i0 >> 4, state);
-				count++;
-				sample_number++;
-
-				if (count >= 4095) {
-					assert(count == 4095);
-					heading_bits = i0 & 15;
-					amount_of_heading_bits = 4;
-					break;
-				}
-
-				*outputp++ = adpcm_decode4bit(i0 & 15, state);
-				count++;
-				sample_number++;
-			}
 
-			if (in < last && count != 4095) {
-				DEBUG("first packet is incomplete, count=%i, last-in=%i", count, (int)(last-in));
-				exit(1);
+		/* the first adpcm tag fixes the layout, every tag restarts the
+		 * stream with its own code size
+		 */
+		if (fd < 0) {
+			channels = a->channels;
+			if (!args->rate_set) {
+				args->rate = a->rate;
 			}
+			DEBUG("flv adpcm channels=%i rate=%i", channels, args->rate);
+			if ((fd = output_open(output_path, channels, 0)) < 0) {
+				ret = 1;
+				goto out;
+			}
+		} else if (a->channels != channels) {
+			LOG(D0_ERROR, "error: flv switches from %i to %i channels at %u ms", channels, a->channels, a->timestamp);
+			ret = 1;
+			break;
+		}
+		adpcm_stream_init(stream, a->data, channels);
+		stats->code_size = stream->code_size;
+		stats_phase(STATS_PARSE);
 
-			int output_len = ((unsigned char*)outputp) - ((unsigned char*)output);
-			//DEBUG("count=%i, outputp-output=%i", count, output_len);
+		TRACE("tag timestamp=%u len=%i code_size=%i", a->timestamp, a->len, stream->code_size);
+		while ((n = decode_packet(stream, a->data, nbits, &bitpos, output)) > 0) {
+			output_packet(fd, output, n * channels);
+		}
+		tags++;
+	}
+	if (i < 0) {
+		ret = 1;
+	}
+	if (skipped) {
+		LOG(D0_WARN, "%lli audio tags not adpcm, skipped", (long long)skipped);
+	}
+	if (fd < 0) {
+		if (!ret) {
+			LOG(D0_ERROR, "error: [%s] has no adpcm audio", flv_path);
+		}
+		ret = 1;
+	} else {
+		DEBUG("%lli adpcm tags decoded", (long long)tags);
+		ret |= output_close(fd, output_path);
+	}
 
-			/* write first ADPCMMONOPACKET
-			 */
+out:
+	flv_free(flv);
+	if (f != stdin) {
+		fclose(f);
+	}
+	return ret;
+}
 
-			int use_stdout = str_len(args->output_file) == 1 && args->output_file->s[0] == '-';
-			int fd;
-
-			if (use_stdout) {
-				fd = STDOUT_FILENO;
-			} else {
-				if ((fd = open(args->output_file->s, O_CREAT | O_WRONLY | O_TRUNC, 0644)) < 0) {
-					int save_errno = errno;
-					assert(fd == -1);
-					DEBUG("open(args->output_file->s=[%s], O_CREAT | O_WRONLY | O_TRUNC, 0644), errno=%i", args->output_file->s, save_errno);
-					errno = save_errno;
-					perror(args->output_file->s);
-					break;
-				}
-			}
-			assert(write_exact(fd, output, output_len) == output_len);
+/* inputs this large, or not seekable, are decoded in PIPE_CHUNK pieces
+ * instead of being read whole
+ */
+#define DECODE_WHOLE_MAX ((int64_t)256 << 20)
 
-			/* more data?
-			 */
+int doit(const char *adpcm_path, const char *output_path)
+{
+	DEFINE_STR(input);
+	struct stat st[1];
+	int ret;
 
-			while (in < last) {
-				//DEBUG("sample_number=%li", sample_number);
-				//DEBUG("amount_of_heading_bits=%i", amount_of_heading_bits);
-
-				if (amount_of_heading_bits == 4) {
-					if ((in + 2) >= last) break;
-
-					/*
-					 * [4,in:8,in1:4] [in1:4,in2:2] [in2:6]
-					 * ----- 16 ----- ----- 6 ----- ...
-					 */
-
-					initial_sample =
-						(heading_bits << (16-4)) |            /* SI16 UB[4] */
-						(*(unsigned char*)in << (16-4-8)) |   /* SI16 UB[8] */
-						(*(unsigned char*)(in+1) >> 4);       /* SI16 UB[4] */
-					initial_sample = (int16_t)initial_sample;
-
-					initial_index =
-						((*(unsigned char*)(in+1) & 15) << 2) |  /* UB[6] UB[4] */
-						(*(unsigned char*)(in+2) >> 6);          /* UB[6] UB[2] */
-
-					heading_bits = 0;
-					amount_of_heading_bits = 0;
-
-					int i0 = *(unsigned char*)(in+2) & 63; /* UB[6] for next delta */
-
-					//DEBUG("initial_sample=%i", initial_sample);
-					//DEBUG("initial_index=%i", initial_index);
-
-					in += 3;
-
-					/* got ADPCMMONOPACKET header
-					 *
-					 * note: we still have UB[6] hanging on i0
-					 *
-					 *  4|2] [2|4|2] [2|4|2] ...: can't get even
-					 *
-					 */
-
-					state->index = initial_index;
-					state->sample = initial_sample;
-					outputp = output;
-					*outputp++ = initial_sample;
-					sample_number++;
-
-					*outputp++ = adpcm_decode4bit(i0 >> 2, state);
-					count = 1;
-					sample_number++;
-
-					for (;;) {
-						if (in >= last) break;
-						int i1 = *(unsigned char*)in++;
-
-						/* i0 = 2]
-						 * i1 = [2|4|2]
-						 */
-
-						*outputp++ = adpcm_decode4bit(((i0 & 3) << 2) | (i1 >> 6), state);
-						count++;
-						sample_number++;
-						if (count >= 4095) {
-							assert(count == 4095);
-							heading_bits = i0 & 63;
-							amount_of_heading_bits = 6;
-							break;
-						}
-
-						*outputp++ = adpcm_decode4bit((i1 >> 2) & 15, state);
-						count++;
-						sample_number++;
-						if (count >= 4095) {
-							assert(count == 4095);
-							heading_bits = i1 & 3;
-							amount_of_heading_bits = 2;
-							break;
-						}
-
-						/*
-						 */
-
-						i0 = i1;
-					}
-				} else if (amount_of_heading_bits == 2) {
-					if ((in + 2) >= last) break;
-
-					/*
-					 * [2,in:8,in1:6] [in1:2,in2:4] [in2:4]
-					 * ----- 16 ----- ----- 6 ----- ...
-					 */
-
-					initial_sample =
-						(heading_bits << (16-2)) |            /* SI16 UB[2] */
-						(*(unsigned char*)in << (16-2-8)) |   /* SI16 UB[8] */
-						(*(unsigned char*)(in+1) >> 2);       /* SI16 UB[6] */
-					initial_sample = (int16_t)initial_sample;
-
-					initial_index =
-						((*(unsigned char*)(in+1) & 3) << 4) |   /* UB[6] UB[2] */
-						(*(unsigned char*)(in+2) >> 4);          /* UB[6] UB[4] */
-
-					heading_bits = 0;
-					amount_of_heading_bits = 0;
-
-					int i0 = *(unsigned char*)(in+2) & 15;   /* UB[4] for next delta */
-
-					//DEBUG("initial_sample=%i", initial_sample);
-					//DEBUG("initial_index=%i", initial_index);
-
-					in += 3;
-
-					/* got ADPCMMONOPACKET header
-					 *
-					 * note: we still have UB[4] hanging on i0
-					 *
-					 *  4]: 0 bytes to get even
-					 *
-					 */
-
-					state->index = initial_index;
-					state->sample = initial_sample;
-					outputp = output;
-					*outputp++ = initial_sample;
-					sample_number++;
-
-					*outputp++ = adpcm_decode4bit(i0, state);
-					count = 1;
-					sample_number++;
-
-					while (in < last && count < 4095) {
-						int i0 = *(unsigned char*)in++;
-
-						*outputp++ = adpcm_decode4bit(i0 >> 4, state);
-						count++;
-						sample_number++;
-
-						if (count >= 4095) {
-							assert(count == 4095);
-							heading_bits = i0 & 15;
-							amount_of_heading_bits = 4;
-							break;
-						}
-
-						*outputp++ = adpcm_decode4bit(i0 & 15, state);
-						count++;
-						sample_number++;
-					}
-				} else if (amount_of_heading_bits == 0) {
-					if ((in + 2) >= last) break;
-
-					/*
-					 * [in:8,in1:8] [in2:6] [in2:2]
-					 * ---- 16 ---- -- 6 -- ...
-					 */
-
-					initial_sample = (*(unsigned char*)(in) << 8) | (*(unsigned char*)(in+1));   /* SI16 */
-					initial_sample = (int16_t)initial_sample;
-					initial_index = *(unsigned char*)(in+2) >> 2;   /* UB[6] */
-
-					heading_bits = 0;
-					amount_of_heading_bits = 0;
-
-					int i0 = *(unsigned char*)(in+2) & 3; /* UB[2] for next delta */
-
-					//DEBUG("initial_sample=%i", initial_sample);
-					//DEBUG("initial_index=%i", initial_index);
-
-					in += 3;
-
-					/* got ADPCMMONOPACKET header
-					 *
-					 * note: we still have UB[2] hanging on i0
-					 *
-					 *  2] [2|4|2] [2|4|2] ...: can't get even
-					 *
-					 */
-
-					state->index = initial_index;
-					state->sample = initial_sample;
-					outputp = output;
-					*outputp++ = initial_sample;
-					sample_number++;
-
-					count = 0;
-
-					for (;;) {
-						if (in >= last) break;
-						int i1 = *(unsigned char*)in++;
-
-						/* i0 = 2]
-						 * i1 = [2|4|2]
-						 */
-
-						*outputp++ = adpcm_decode4bit(((i0 & 3) << 2) | (i1 >> 6), state);
-						count++;
-						sample_number++;
-						if (count >= 4095) {
-							assert(count == 4095);
-							heading_bits = i1 & 63;
-							amount_of_heading_bits = 6;
-							break;
-						}
-
-						*outputp++ = adpcm_decode4bit((i1 >> 2) & 15, state);
-						count++;
-						sample_number++;
-						if (count >= 4095) {
-							assert(count == 4095);
-							heading_bits = i1 & 3;
-							amount_of_heading_bits = 2;
-							break;
-						}
-
-						/*
-						 */
-
-						i0 = i1;
-					}
-				} else if (amount_of_heading_bits == 6) {
-					if ((in + 1) >= last) break;
-
-					/*
-					 * [6,in:8,in1:2] [in1:6] (we are even!)
-					 * ----- 16 ----- -- 6 -- ...
-					 */
-
-					initial_sample =
-						(heading_bits << (16-6)) |            /* SI16 UB[6] */
-						(*(unsigned char*)in << (16-6-8)) |   /* SI16 UB[8] */
-						(*(unsigned char*)(in+1) >> 6);       /* SI16 UB[2] */
-					initial_sample = (int16_t)initial_sample;
-
-					initial_index = *(unsigned char*)(in+1) & 63;  /* UB[6] UB[6] (we are even!) */
-
-					heading_bits = 0;
-					amount_of_heading_bits = 0;
-
-					//DEBUG("initial_sample=%i", initial_sample);
-					//DEBUG("initial_index=%i", initial_index);
-
-					in += 2;
-
-					/* got ADPCMMONOPACKET header
-					 */
-
-					state->index = initial_index;
-					state->sample = initial_sample;
-					outputp = output;
-					*outputp++ = initial_sample;
-					sample_number++;
-
-					count = 0;
-
-					while (in < last && count < 4095) {
-						int i0 = *(unsigned char*)in++;
-
-						*outputp++ = adpcm_decode4bit(i0 >> 4, state);
-						count++;
-						sample_number++;
-
-						if (count >= 4095) {
-							assert(count == 4095);
-							heading_bits = i0 & 15;
-							amount_of_heading_bits = 4;
-							break;
-						}
-
-						*outputp++ = adpcm_decode4bit(i0 & 15, state);
-						count++;
-						sample_number++;
-					}
-				} else {
-					DEBUG("exhaustion, amount_of_heading_bits=%i", amount_of_heading_bits);
-					exit(1);
-				}
-
-				if (in < last && count != 4095) {
-					DEBUG("exhaustion, count=%i, last-in=%i", count, (int)(last-in));
-					exit(1);
-				}
-
-				int output_len = ((unsigned char*)outputp) - ((unsigned char*)output);
-				//DEBUG("count=%i, outputp-output=%i", count, output_len);
-
-				assert(write_exact(fd, output, output_len) == output_len);
+	if (strcmp(adpcm_path, "-") == 0 ||
+	    (stat(adpcm_path, st) == 0 && (!S_ISREG(st->st_mode) || st->st_size >= DECODE_WHOLE_MAX))) {
+		return decode_pipelined(adpcm_path, output_path);
+	}
+	if (stat(adpcm_path, st) != 0 || st->st_size == 0) {
+		LOG(D0_ERROR, "error: [%s] is missing or empty", adpcm_path);
+		return 1;
+	}
 
-			}
+	str_from_file(input, adpcm_path);
 
-			/* close output
-			 */
+	stats->bytes_in += input->len;
+	stats_phase(STATS_READ);
 
-			if (fd != STDOUT_FILENO) {
-				assert(close(fd) == 0);
-				fd = -1;
-			}
+	ret = decode(input, output_path);
 
-			break;
-		}
-		case 0: /* 2 bits/sample */
-		{
-			int count = 0;
-			int heading_bits = 0;
-			int amount_of_heading_bits = 0;
-
-			while (in < last && count < 4095) {
-				int i0 = *(unsigned char*)in++;
-
-				*outputp++ = adpcm_decode2bit(i0 >> 6, state);
-				count++;
-				sample_number++;
-				if (count >= 4095) {
-					assert(count == 4095);
-					heading_bits = i0 & 63;
-					amount_of_heading_bits = 6;
-					break;
-				}
-
-				*outputp++ = adpcm_decode2bit((i0 >> 4) & 3, state);
-				count++;
-				sample_number++;
-				if (count >= 4095) {
-					assert(count == 4095);
-					heading_bits = i0 & 15;
-					amount_of_heading_bits = 4;
-					break;
-				}
-
-				*outputp++ = adpcm_decode2bit((i0 >> 2) & 3, state);
-				count++;
-				sample_number++;
-				if (count >= 4095) {
-					assert(count == 4095);
-					heading_bits = i0 & 3;
-					amount_of_heading_bits = 2;
-					break;
-				}
-
-				*outputp++ = adpcm_decode2bit(i0 & 3, state);
-				count++;
-				sample_number++;
-			}
+	str_free(input);
+	return ret;
+}
 
-			if (in < last && count != 4095) {
-				DEBUG("first packet is incomplete, count=%i, last-in=%i", count, (int)(last-in));
-				exit(1);
-			}
+/* decode every "input<tab>output" line of args->batch, payloads seen
+ * before are not decoded again but fanned out from the first output
+ */
+static int batch(void)
+{
+	DEFINE_STR(input);
+	struct arena job[1];
+	struct dedup dd[1];
+	char *line = NULL;
+	size_t linesz = 0;
+	ssize_t len;
+	int ret = 0;
+	FILE *f;
+
+	if (strcmp(args->batch, "-") == 0) {
+		f = stdin;
+	} else if ((f = fopen(args->batch, "r")) == NULL) {
+		perror(args->batch);
+		return 1;
+	}
 
-			int output_len = ((unsigned char*)outputp) - ((unsigned char*)output);
-			//DEBUG("count=%i, outputp-output=%i", count, output_len);
+	dedup_init(dd);
+	arena_init(job, 0);
 
-			/* write first ADPCMMONOPACKET
-			 */
+	/* the input of a job lives in the job arena, rewound per line, so
+	 * once the largest input has been seen nothing is allocated
+	 */
+	while ((len = getline(&line, &linesz, f)) > 0) {
+		struct stat st[1];
+		const struct dedup_entry *src;
+		char *output;
 
-			int use_stdout = str_len(args->output_file) == 1 && args->output_file->s[0] == '-';
-			int fd;
-
-			if (use_stdout) {
-				fd = STDOUT_FILENO;
-			} else {
-				if ((fd = open(args->output_file->s, O_CREAT | O_WRONLY | O_TRUNC, 0644)) < 0) {
-					int save_errno = errno;
-					assert(fd == -1);
-					DEBUG("open(args->output_file->s=[%s], O_CREAT | O_WRONLY | O_TRUNC, 0644), errno=%i", args->output_file->s, save_errno);
-					errno = save_errno;
-					perror(args->output_file->s);
-					break;
-				}
-			}
-			assert(write_exact(fd, output, output_len) == output_len);
+		if (line[len - 1] == '\n') {
+			line[--len] = 0;
+		}
+		if (len == 0) {
+			continue;
+		}
+		if ((output = strchr(line, '\t')) == NULL || output[1] == 0 || strcmp(output + 1, "-") == 0) {
+			LOG(D0_ERROR, "error: expected \"input<tab>output\" in [%s]", line);
+			ret = 1;
+			continue;
+		}
+		*output++ = 0;
 
-			/* more data?
+		if (stat(line, st) != 0 || st->st_size == 0) {
+			LOG(D0_ERROR, "error: [%s] is missing or empty", line);
+			ret = 1;
+			continue;
+		}
+		if (st->st_size >= DECODE_WHOLE_MAX) {
+			/* too large to hold for the dedup key, decoded in
+			 * chunks as doit would and not deduped
 			 */
+			ret |= decode_pipelined(line, output);
+			continue;
+		}
+		arena_reset(job);
+		str_arena(input, job);
+		str_from_file(input, line);
+		stats->bytes_in += input->len;
+		stats_phase(STATS_READ);
+
+		if ((src = dedup_lookup(dd, input->s, input->len))) {
+			DEBUG("[%s] same payload as [%s]", line, src->input);
+			if (dedup_fanout(dd, src->output, output)) {
+				ret = 1;
+			} else if (src->report) {
+				print_report(output, src->report);
+			}
+			stats_phase(STATS_WRITE);
+		} else if (decode(input, output)) {
+			ret = 1;
+		} else {
+			dedup_add(dd, line, output, report->s);
+		}
+	}
 
-			while (in < last) {
-				//DEBUG("sample_number=%li", sample_number);
-				//DEBUG("amount_of_heading_bits=%i", amount_of_heading_bits);
-
-				if (amount_of_heading_bits == 2) {
-					if ((in + 2) >= last) break;
-
-					/*
-					 * [2,in:8,in1:6] [in1:2,in2:4] [in2:4]
-					 * ----- 16 ----- ----- 6 ----- ...
-					 */
-
-					initial_sample =
-						(heading_bits << (16-2)) |            /* SI16 UB[2] */
-						(*(unsigned char*)in << (16-2-8)) |   /* SI16 UB[8] */
-						(*(unsigned char*)(in+1) >> 2);       /* SI16 UB[6] */
-					initial_sample = (int16_t)initial_sample;
-
-					initial_index =
-						((*(unsigned char*)(in+1) & 3) << 4) |   /* UB[6] UB[2] */
-						(*(unsigned char*)(in+2) >> 4);          /* UB[6] UB[4] */
-
-					heading_bits = 0;
-					amount_of_heading_bits = 0;
-
-					int i0 = *(unsigned char*)(in+2) & 15;   /* UB[4] for next delta */
-
-					//DEBUG("initial_sample=%i", initial_sample);
-					//DEBUG("initial_index=%i", initial_index);
-
-					in += 3;
-
-					/* got ADPCMMONOPACKET header
-					 *
-					 * note: we still have UB[4] hanging on i0
-					 *
-					 *  2|2]: 0 bytes to get even
-					 *
-					 */
-
-					state->index = initial_index;
-					state->sample = initial_sample;
-					outputp = output;
-					*outputp++ = initial_sample;
-					sample_number++;
-
-					*outputp++ = adpcm_decode2bit(i0 >> 2, state);
-					*outputp++ = adpcm_decode2bit(i0 & 3, state);
-
-					count = 2;
-					sample_number += 2;
-				} else if (amount_of_heading_bits == 6) {
-					if ((in + 1) >= last) break;
-
-					/*
-					 * [6,in:8,in1:2] [in1:6] (we are even!)
-					 * ----- 16 ----- -- 6 -- ...
-					 */
-
-					initial_sample =
-						(heading_bits << (16-6)) |            /* SI16 UB[6] */
-						(*(unsigned char*)in << (16-6-8)) |   /* SI16 UB[8] */
-						(*(unsigned char*)(in+1) >> 6);       /* SI16 UB[2] */
-					initial_sample = (int16_t)initial_sample;
-
-					initial_index = *(unsigned char*)(in+1) & 63;  /* UB[6] UB[6] (we are even!) */
-
-					heading_bits = 0;
-					amount_of_heading_bits = 0;
-
-					//DEBUG("initial_sample=%i", initial_sample);
-					//DEBUG("initial_index=%i", initial_index);
-
-					in += 2;
-
-					/* got ADPCMMONOPACKET header
-					 */
-
-					state->index = initial_index;
-					state->sample = initial_sample;
-					outputp = output;
-					*outputp++ = initial_sample;
-					sample_number++;
-
-					count = 0;
-				} else {
-					DEBUG("exhaustion, amount_of_heading_bits=%i", amount_of_heading_bits);
-					exit(1);
-				}
-
-				while (in < last && count < 4095) {
-					int i0 = *(unsigned char*)in++;
-
-					*outputp++ = adpcm_decode2bit(i0 >> 6, state);
-					count++;
-					sample_number++;
-					if (count >= 4095) {
-						assert(count == 4095);
-						heading_bits = i0 & 63;
-						amount_of_heading_bits = 6;
-						break;
-					}
-
-					*outputp++ = adpcm_decode2bit((i0 >> 4) & 3, state);
-					count++;
-					sample_number++;
-					if (count >= 4095) {
-						assert(count == 4095);
-						heading_bits = i0 & 15;
-						amount_of_heading_bits = 4;
-						break;
-					}
-
-					*outputp++ = adpcm_decode2bit((i0 >> 2) & 3, state);
-					count++;
-					sample_number++;
-					if (count >= 4095) {
-						assert(count == 4095);
-						heading_bits = i0 & 3;
-						amount_of_heading_bits = 2;
-						break;
-					}
-
-					*outputp++ = adpcm_decode2bit(i0 & 3, state);
-					count++;
-					sample_number++;
-				}
-
-				if (in < last && count != 4095) {
-					DEBUG("exhaustion, count=%i, last-in=%i", count, (int)(last-in));
-					exit(1);
-				}
-
-				int output_len = ((unsigned char*)outputp) - ((unsigned char*)output);
-				//DEBUG("count=%i, outputp-output=%i", count, output_len);
-
-				assert(write_exact(fd, output, output_len) == output_len);
+	dedup_print(dd, stderr);
 
-			}
+	free(line);
+	if (f != stdin) {
+		fclose(f);
+	}
+	dedup_free(dd);
+	str_free(input);
+	arena_free(job);
+	return ret;
+}
 
-			/* close output
-			 */
+/* parent directories of path, as mkdir -p
+ */
+static int make_parents(char *path)
+{
+	char *p;
+	for (p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = 0;
+		if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+			perror(path);
+			*p = '/';
+			return -1;
+		}
+		*p = '/';
+	}
+	return 0;
+}
 
-			if (fd != STDOUT_FILENO) {
-				assert(close(fd) == 0);
-				fd = -1;
-			}
+/* absolute paths and .. components would escape the output directory
+ */
+static int member_path_is_safe(const char *name)
+{
+	const char *p = name;
+	if (*name == 0 || *name == '/') {
+		return 0;
+	}
+	while (p) {
+		if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == 0)) {
+			return 0;
+		}
+		if ((p = strchr(p, '/'))) {
+			p++;
+		}
+	}
+	return 1;
+}
 
+/* decode every member of the archive -i, in stream order, into
+ * -o/<member path>.raw (or .flac)
+ */
+/* the ADPCM DefineSounds of a swf member into
+ * <output>/<member>_assets/sound-<id>.raw, as extract-assets names
+ * them, at their own channel count and (unless --rate) rate
+ */
+static int decode_swf_member(const char *member, struct str *input)
+{
+	DEFINE_STR(output);
+	struct swf swf[1] = {{.inflated = {NULL_STR}}};
+	struct swf_tag tag[1];
+	const int rate = args->rate;
+	int i, ret = 0, sounds = 0;
+
+	if (swf_open(swf, (unsigned char*)input->s, input->len)) {
+		LOG(D0_ERROR, "error: [%s] is not a supported swf", member);
+		swf_free(swf);
+		return 1;
+	}
+	while ((i = swf_next_tag(swf, tag)) > 0) {
+		struct swf_sound snd[1];
+		if (tag->code != SWF_TAG_DEFINE_SOUND) {
+			continue;
+		}
+		if (swf_define_sound(tag, snd)) {
+			LOG(D0_ERROR, "error: [%s] short DefineSound tag", member);
+			ret = 1;
+			continue;
+		}
+		if (snd->format != SWF_SOUND_ADPCM || snd->len == 0) {
+			DEBUG("[%s] sound %i is not adpcm or empty, skipped", member, snd->id);
+			continue;
+		}
+		str_copyf(output, "%s/%s_assets/sound-%04d.%s", args->output_file->s, member, snd->id, args->flac ? "flac" : "raw");
+		if (make_parents(output->s)) {
+			ret = 1;
 			break;
 		}
-		default:
-			DEBUG("exhaustion/not-implemented");
-			exit(1);
+		DEBUG("[%s] sound %i -> [%s]", member, snd->id, output->s);
+		if (!args->rate_set) {
+			args->rate = snd->rate;
 		}
+		ret |= decode_sound(snd->data, snd->len, snd->channels, output->s);
+		args->rate = rate;
+		sounds++;
+	}
+	if (i < 0) {
+		LOG(D0_WARN, "[%s] truncated tag list", member);
+	}
+	if (!sounds) {
+		LOG(D0_WARN, "[%s] has no adpcm sounds", member);
 	}
 
-	/* cleanup
-	 */
-	str_free(input);
+	swf_free(swf);
+	str_free(output);
+	return ret;
+}
 
-	return 0;
+static int decode_archive(void)
+{
+	DEFINE_STR(name);
+	DEFINE_STR(input);
+	DEFINE_STR(output);
+	struct archive *ar;
+	int i, ret = 0;
+
+	if ((ar = archive_open(args->input_file->s)) == NULL) {
+		return 1;
+	}
+
+	while ((i = archive_next(ar, name, input)) > 0) {
+		stats->bytes_in += input->len;
+		stats_phase(STATS_READ);
+
+		if (!member_path_is_safe(name->s)) {
+			LOG(D0_ERROR, "error: unsafe member path [%s], skipped", name->s);
+			ret = 1;
+			continue;
+		}
+		if (input->len == 0) {
+			LOG(D0_WARN, "[%s] is empty, skipped", name->s);
+			continue;
+		}
+		if (input->len >= 3 && strchr("FCZ", input->s[0]) && input->s[1] == 'W' && input->s[2] == 'S') {
+			ret |= decode_swf_member(name->s, input);
+			continue;
+		}
+		str_copyf(output, "%s/%s.%s", args->output_file->s, name->s, args->flac ? "flac" : "raw");
+		if (make_parents(output->s)) {
+			ret = 1;
+			break;
+		}
+		DEBUG("[%s] -> [%s]", name->s, output->s);
+		ret |= decode(input, output->s);
+	}
+	if (i < 0) {
+		ret = 1;
+	}
+
+	archive_close(ar);
+	str_free(name);
+	str_free(input);
+	str_free(output);
+	return ret;
 }
 
 int main(int argc, char **argv)
 {
 	struct getopt_x state[1];
+	int ret;
+
+	/* "adpcm_swf2raw extract-assets ..." reads as --extract-assets
+	 */
+	if (argc > 1 && strcmp(argv[1], "extract-assets") == 0) {
+		argv[1] = "--extract-assets";
+	}
 
 	if (process_args(state, argc, argv)) {
 		help(argv[0], state);
@@ -1856,11 +1366,42 @@ int main(int argc, char **argv)
 		exit(0);
 	}
 
-	if (doit(args->input_file->s)) {
-		return 1;
+	if (args->probe) {
+		return probe_all();
 	}
 
-	return 0;
+	if (args->daemon) {
+		return daemon_serve(args->daemon, workers());
+	}
+
+	if (args->extract_assets) {
+		return extract_assets(args->paths, args->npaths, workers(), args->manifest);
+	}
+
+	stats_start();
+
+	if (args->batch) {
+		ret = batch();
+	} else if (args->archive) {
+		ret = decode_archive();
+	} else if (args->flv) {
+		ret = decode_flv(args->input_file->s, args->output_file->s);
+	} else if (args->pipeline) {
+		ret = decode_pipelined(args->input_file->s, args->output_file->s);
+	} else {
+		ret = doit(args->input_file->s, args->output_file->s);
+	}
+
+	/* failed runs too, their counters show how far they got
+	 */
+	if (stats->enabled) {
+		stats->cache_hits = pcache->hits;
+		stats->cache_misses = pcache->misses;
+		stats_print(stderr);
+	}
+	packet_cache_free(pcache);
+
+	return ret ? 1 : 0;
 }
 
 #if 0
@@ -0,0 +1,557 @@
+/*
+
+Copyright (c) 2012, Alexandre Girao <alexgirao@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+ * reference: https://pkware.cachefly.net/webdocs/casestudies/APPNOTE.TXT
+ * reference: https://www.gnu.org/software/tar/manual/html_node/Standard.html
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "debug0.h"
+#include "str.h"
+#include "archive.h"
+
+struct zip_entry {
+	int64_t offset; /* of the local header */
+	int64_t csize, usize;
+	uint32_t crc;
+	int method;
+	int flags;
+	int64_t name; /* of the central directory name */
+	int name_len;
+};
+
+struct archive {
+	const char *path;
+
+	/* zip, mapped
+	 */
+	const unsigned char *map;
+	int64_t size;
+	struct zip_entry *entries;
+	int nentries, next;
+	z_stream z[1];
+	int z_ready;
+
+	/* tar, streamed through gzread
+	 */
+	gzFile gz;
+};
+
+static uint16_t le16(const unsigned char *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t le32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t le64(const unsigned char *p)
+{
+	return le32(p) | (uint64_t)le32(p + 4) << 32;
+}
+
+/* zip
+ */
+
+static int cmp_offset(const void *a, const void *b)
+{
+	const struct zip_entry *x = a, *y = b;
+	return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static int zip_load_directory(struct archive *ar)
+{
+	const unsigned char *m = ar->map, *eocd = NULL, *p, *end;
+	const uint64_t size = ar->size;
+	uint64_t cd_offset, cd_size, entries, i;
+	int64_t j;
+
+	for (j=ar->size-22; j>=0 && j>=ar->size-22-0xffff; j--) {
+		if (le32(m + j) == 0x06054b50) {
+			eocd = m + j;
+			break;
+		}
+	}
+	if (!eocd) {
+		return -1;
+	}
+	entries = le16(eocd + 10);
+	cd_size = le32(eocd + 12);
+	cd_offset = le32(eocd + 16);
+
+	/* zip64 end of central directory, through its locator
+	 */
+	if (eocd - m >= 20 && le32(eocd - 20) == 0x07064b50) {
+		uint64_t z64 = le64(eocd - 20 + 8);
+		if (size < 56 || z64 > size - 56 || le32(m + z64) != 0x06064b50) {
+			return -1;
+		}
+		entries = le64(m + z64 + 32);
+		cd_size = le64(m + z64 + 40);
+		cd_offset = le64(m + z64 + 48);
+	}
+	if (cd_offset > size || cd_size > size - cd_offset || entries > cd_size / 46) {
+		return -1;
+	}
+
+	ar->entries = calloc(entries ? entries : 1, sizeof(struct zip_entry));
+	assert(ar->entries);
+
+	p = m + cd_offset;
+	end = p + cd_size;
+	for (i=0; i<entries; i++) {
+		struct zip_entry *e = ar->entries + ar->nentries;
+		const unsigned char *x, *xend;
+		int nlen, xlen, clen;
+
+		if (end - p < 46 || le32(p) != 0x02014b50) {
+			return -1;
+		}
+		nlen = le16(p + 28);
+		xlen = le16(p + 30);
+		clen = le16(p + 32);
+		if (end - p < 46 + nlen + xlen + clen) {
+			return -1;
+		}
+		e->flags = le16(p + 8);
+		e->method = le16(p + 10);
+		e->crc = le32(p + 16);
+		e->csize = le32(p + 20);
+		e->usize = le32(p + 24);
+		e->offset = le32(p + 42);
+		e->name = p + 46 - m;
+		e->name_len = nlen;
+
+		/* zip64 extended information, only the saturated fields are
+		 * present, in this order; none may point or reach past the
+		 * file, usize within deflate's best ratio of it
+		 */
+		for (x = p + 46 + nlen, xend = x + xlen; xend - x >= 4; x += 4 + le16(x + 2)) {
+			const unsigned char *f = x + 4;
+			int flen = le16(x + 2);
+			uint64_t v;
+			if (le16(x) != 0x0001 || flen > xend - f) {
+				continue;
+			}
+			if (e->usize == 0xffffffff && flen >= 8) {
+				if ((v = le64(f)) / 1032 > size) {
+					return -1;
+				}
+				e->usize = v;
+				f += 8;
+				flen -= 8;
+			}
+			if (e->csize == 0xffffffff && flen >= 8) {
+				if ((v = le64(f)) > size) {
+					return -1;
+				}
+				e->csize = v;
+				f += 8;
+				flen -= 8;
+			}
+			if (e->offset == 0xffffffff && flen >= 8) {
+				if ((v = le64(f)) > size) {
+					return -1;
+				}
+				e->offset = v;
+			}
+		}
+		p += 46 + nlen + xlen + clen;
+
+		if (nlen && m[e->name + nlen - 1] == '/') {
+			continue; /* directory */
+		}
+		ar->nentries++;
+	}
+
+	/* stream order
+	 */
+	qsort(ar->entries, ar->nentries, sizeof(struct zip_entry), cmp_offset);
+	return 0;
+}
+
+static int zip_next(struct archive *ar, struct str *name, struct str *data)
+{
+	while (ar->next < ar->nentries) {
+		struct zip_entry *e = ar->entries + ar->next++;
+		const unsigned char *lh = ar->map + e->offset, *src;
+		int64_t start;
+
+		str_copyn(name, (const char*)ar->map + e->name, e->name_len);
+
+		if (e->offset > ar->size - 30 || le32(lh) != 0x04034b50) {
+			LOG(D0_ERROR, "error: [%s] bad local header for [%s]", ar->path, name->s);
+			return -1;
+		}
+		start = e->offset + 30 + le16(lh + 26) + le16(lh + 28);
+		if (start > ar->size || e->csize > ar->size - start) {
+			LOG(D0_ERROR, "error: [%s] truncated at [%s]", ar->path, name->s);
+			return -1;
+		}
+		if (e->flags & 1) {
+			LOG(D0_WARN, "[%s] [%s] is encrypted, skipped", ar->path, name->s);
+			continue;
+		}
+		if (e->usize / 1032 > e->csize) {
+			/* beyond deflate's best ratio, the sizes are lying
+			 */
+			LOG(D0_WARN, "[%s] [%s] has a bad size, skipped", ar->path, name->s);
+			continue;
+		}
+		src = ar->map + start;
+
+		str_alloc(data, e->usize + 1);
+		if (e->method == 0) {
+			if (e->csize != e->usize) {
+				LOG(D0_WARN, "[%s] [%s] stored with mismatched sizes, skipped", ar->path, name->s);
+				continue;
+			}
+			memcpy(data->s, src, e->usize);
+		} else if (e->method == 8) {
+			int ret;
+			if (!ar->z_ready) {
+				assert(inflateInit2(ar->z, -MAX_WBITS) == Z_OK);
+				ar->z_ready = 1;
+			} else {
+				assert(inflateReset(ar->z) == Z_OK);
+			}
+			ar->z->next_in = (unsigned char*)src;
+			ar->z->next_out = (unsigned char*)data->s;
+
+			/* avail_in and avail_out are 32 bits, large members go
+			 * through in slices
+			 */
+			do {
+				int64_t in_left = src + e->csize - ar->z->next_in;
+				int64_t out_left = (unsigned char*)data->s + e->usize - ar->z->next_out;
+				ar->z->avail_in = in_left > (1 << 30) ? 1 << 30 : in_left;
+				ar->z->avail_out = out_left > (1 << 30) ? 1 << 30 : out_left;
+				ret = inflate(ar->z, Z_NO_FLUSH);
+			} while (ret == Z_OK);
+			if (ret != Z_STREAM_END || ar->z->next_out != (unsigned char*)data->s + e->usize) {
+				LOG(D0_WARN, "[%s] [%s] failed to inflate, skipped", ar->path, name->s);
+				continue;
+			}
+		} else {
+			LOG(D0_WARN, "[%s] [%s] uses compression method %i, skipped", ar->path, name->s, e->method);
+			continue;
+		}
+		data->len = e->usize;
+		data->s[data->len] = 0;
+
+		if (crc32(crc32(0, NULL, 0), (unsigned char*)data->s, data->len) != e->crc) {
+			LOG(D0_WARN, "[%s] [%s] crc mismatch, skipped", ar->path, name->s);
+			continue;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+/* tar
+ */
+
+static int gz_read_full(gzFile gz, void *buf, int64_t len)
+{
+	while (len > 0) {
+		int i = gzread(gz, buf, len > (1 << 30) ? 1 << 30 : len);
+		if (i <= 0) {
+			return -1;
+		}
+		buf = (char*)buf + i;
+		len -= i;
+	}
+	return 0;
+}
+
+static int gz_skip(gzFile gz, int64_t len)
+{
+	char buf[0x10000];
+	while (len > 0) {
+		int n = len > sizeof(buf) ? sizeof(buf) : len;
+		if (gz_read_full(gz, buf, n)) {
+			return -1;
+		}
+		len -= n;
+	}
+	return 0;
+}
+
+static int64_t tar_number(const unsigned char *p, int len)
+{
+	int64_t v = 0;
+	int i;
+
+	if (p[0] & 0x80) { /* base-256, gnu */
+		/* -1 for negative values and for ones that do not fit in
+		 * 63 bits
+		 */
+		if (p[0] & 0x40) {
+			return -1;
+		}
+		v = p[0] & 0x3f;
+		for (i=1; i<len; i++) {
+			if (v >> 55) {
+				return -1;
+			}
+			v = (v << 8) | p[i];
+		}
+		return v;
+	}
+	for (i=0; i<len && (p[i] == ' ' || p[i] == 0); i++);
+	for (; i<len && p[i] >= '0' && p[i] <= '7'; i++) {
+		v = (v << 3) | (p[i] - '0');
+	}
+	return v;
+}
+
+/* "len key=value\n" records, path and size are the ones that matter
+ */
+static void pax_parse(const char *p, int64_t len, struct str *path, int64_t *size)
+{
+	const char *end = p + len;
+	while (p < end) {
+		char *q;
+		long n = strtol(p, &q, 10);
+		const char *key, *eq;
+		if (n <= 0 || n > end - p || *q != ' ') {
+			return;
+		}
+		key = q + 1;
+		eq = memchr(key, '=', p + n - key);
+		if (eq) {
+			const char *val = eq + 1;
+			int vlen = p + n - 1 - val;
+			if (eq - key == 4 && memcmp(key, "path", 4) == 0) {
+				str_copyn(path, val, vlen);
+			} else if (eq - key == 4 && memcmp(key, "size", 4) == 0) {
+				*size = strtoll(val, NULL, 10);
+			}
+		}
+		p += n;
+	}
+}
+
+/* longest GNU long name or pax header taken, and the read size of
+ * member data
+ */
+#define TAR_EXT_MAX (1 << 20)
+
+static int tar_next(struct archive *ar, struct str *name, struct str *data)
+{
+	DEFINE_STR(longname);
+	int64_t pax_size = -1;
+	unsigned char h[512];
+	int ret = 0;
+
+	for (;;) {
+		int64_t size;
+		int type, i;
+		unsigned sum = 0;
+
+		if (gz_read_full(ar->gz, h, 512)) {
+			break; /* eof without the zero blocks */
+		}
+		for (i=0; i<512 && h[i] == 0; i++);
+		if (i == 512) {
+			break;
+		}
+		for (i=0; i<512; i++) {
+			sum += i >= 148 && i < 156 ? ' ' : h[i];
+		}
+		if (sum != tar_number(h + 148, 8)) {
+			LOG(D0_ERROR, "error: [%s] bad tar header checksum", ar->path);
+			ret = -1;
+			break;
+		}
+		size = tar_number(h + 124, 12);
+		type = h[156];
+
+		if (type == 'L' || type == 'x') {
+			/* long name or pax extended header for the next member
+			 */
+			DEFINE_STR(ext);
+			if (size < 0 || size > TAR_EXT_MAX) {
+				LOG(D0_ERROR, "error: [%s] extended header of %lld bytes", ar->path, (long long)size);
+				ret = -1;
+				break;
+			}
+			str_alloc(ext, size + 1);
+			if (gz_read_full(ar->gz, ext->s, size) || gz_skip(ar->gz, -size & 511)) {
+				str_free(ext);
+				ret = -1;
+				break;
+			}
+			ext->s[size] = 0;
+			if (type == 'L') {
+				str_copyz(longname, ext->s);
+			} else {
+				pax_parse(ext->s, size, longname, &pax_size);
+			}
+			str_free(ext);
+			continue;
+		}
+		if (pax_size >= 0) {
+			size = pax_size;
+		}
+
+		if (str_len(longname)) {
+			str_copy(name, longname);
+		} else if (memcmp(h + 257, "ustar", 5) == 0 && h[345]) {
+			str_copyn(name, (char*)h + 345, strnlen((char*)h + 345, 155));
+			str_catc(name, '/');
+			str_catn(name, (char*)h, strnlen((char*)h, 100));
+		} else {
+			str_copyn(name, (char*)h, strnlen((char*)h, 100));
+		}
+		longname->len = 0;
+		pax_size = -1;
+
+		if (size < 0) {
+			LOG(D0_ERROR, "error: [%s] bad size for [%s]", ar->path, name->s);
+			ret = -1;
+			break;
+		}
+		if (type != '0' && type != 0 && type != '7') {
+			if (gz_skip(ar->gz, size + (-size & 511))) {
+				ret = -1;
+				break;
+			}
+			continue;
+		}
+
+		/* grown as the data arrives, a lying size ends in truncation
+		 * rather than in one huge allocation
+		 */
+		data->len = 0;
+		str_alloc(data, 1);
+		while (data->len < size) {
+			int64_t n = data->len > TAR_EXT_MAX ? data->len : TAR_EXT_MAX;
+			n = size - data->len > n ? n : size - data->len;
+			str_alloc(data, data->len + n + 1);
+			if (gz_read_full(ar->gz, data->s + data->len, n)) {
+				break;
+			}
+			data->len += n;
+		}
+		if (data->len < size || gz_skip(ar->gz, -size & 511)) {
+			LOG(D0_ERROR, "error: [%s] truncated at [%s]", ar->path, name->s);
+			ret = -1;
+			break;
+		}
+		data->s[size] = 0;
+		ret = 1;
+		break;
+	}
+
+	str_free(longname);
+	return ret;
+}
+
+struct archive *archive_open(const char *path)
+{
+	struct archive *ar = calloc(1, sizeof(struct archive));
+	unsigned char magic[4];
+	struct stat st[1];
+	int fd;
+
+	assert(ar);
+	ar->path = path;
+
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, st) != 0) {
+		perror(path);
+		free(ar);
+		return NULL;
+	}
+
+	if (pread(fd, magic, 4, 0) == 4 && magic[0] == 'P' && magic[1] == 'K' && (magic[2] == 3 || magic[2] == 5)) {
+		ar->size = st->st_size;
+		ar->map = mmap(NULL, ar->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (ar->map == MAP_FAILED) {
+			perror(path);
+			free(ar);
+			return NULL;
+		}
+		madvise((void*)ar->map, ar->size, MADV_SEQUENTIAL);
+		if (zip_load_directory(ar)) {
+			LOG(D0_ERROR, "error: [%s] bad zip central directory", path);
+			archive_close(ar);
+			return NULL;
+		}
+		return ar;
+	}
+
+	/* tar, gzread passes uncompressed input through
+	 */
+	if ((ar->gz = gzdopen(fd, "rb")) == NULL) {
+		close(fd);
+		free(ar);
+		return NULL;
+	}
+	gzbuffer(ar->gz, 1 << 17);
+	return ar;
+}
+
+int archive_next(struct archive *ar, struct str *name, struct str *data)
+{
+	return ar->map ? zip_next(ar, name, data) : tar_next(ar, name, data);
+}
+
+void archive_close(struct archive *ar)
+{
+	if (ar->map) {
+		munmap((void*)ar->map, ar->size);
+	}
+	if (ar->z_ready) {
+		inflateEnd(ar->z);
+	}
+	if (ar->gz) {
+		gzclose(ar->gz);
+	}
+	free(ar->entries);
+	free(ar);
+}
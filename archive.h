@@ -0,0 +1,35 @@
+#ifndef f5pc8ya0j3tk6wmz2r /* archive-h */
+#define f5pc8ya0j3tk6wmz2r /* archive-h */
+
+#include "str.h"
+
+#ifdef __cplusplus
+extern "C" { /* assume C declarations for C++ */
+#endif
+
+/* regular file members of a zip (stored or deflated, zip64 aware) or a
+ * tar (ustar, gnu long names, pax paths; gzip compressed or not) in the
+ * order they are stored, each read or inflated straight into the
+ * caller's buffer
+ */
+
+struct archive;
+
+/* NULL (logged) when path is not a readable zip or tar
+ */
+struct archive *archive_open(const char *path);
+
+/* loads the next member into name and data, returns 1, or 0 at the
+ * end, or -1 when the archive is truncated or corrupt; members that can
+ * not be read (encrypted, unknown method, bad crc) are logged and
+ * skipped
+ */
+int archive_next(struct archive *ar, struct str *name, struct str *data);
+
+void archive_close(struct archive *ar);
+
+#ifdef __cplusplus
+}; /* end of function prototypes */
+#endif
+
+#endif /* ! f5pc8ya0j3tk6wmz2r archive-h */
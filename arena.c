@@ -0,0 +1,161 @@
+/*
+
+Copyright (c) 2012, Alexandre Girao <alexgirao@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+#define HUGE_PAGE (2 << 20)
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size; /* mapped, header included */
+	size_t used;
+	int huge;
+};
+
+#define HEADER ((sizeof(struct arena_block) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static struct arena_block *block_new(struct arena *a, size_t min)
+{
+	size_t size = a->block_size;
+	struct arena_block *b = MAP_FAILED;
+	int huge = 0;
+
+	if (size < HEADER + min) {
+		size = (HEADER + min + HUGE_PAGE - 1) & ~(size_t)(HUGE_PAGE - 1);
+	}
+
+	if (size >= HUGE_PAGE) {
+#ifdef MAP_HUGETLB
+		size_t hsize = (size + HUGE_PAGE - 1) & ~(size_t)(HUGE_PAGE - 1);
+		b = mmap(NULL, hsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (b != MAP_FAILED) {
+			size = hsize;
+			huge = 1;
+		}
+#endif
+	}
+	if (b == MAP_FAILED) {
+		b = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		assert(b != MAP_FAILED);
+#ifdef MADV_HUGEPAGE
+		if (size >= HUGE_PAGE) {
+			madvise(b, size, MADV_HUGEPAGE);
+		}
+#endif
+	}
+	b->next = NULL;
+	b->size = size;
+	b->used = HEADER;
+	b->huge = huge;
+	a->blocks++;
+	a->bytes += size;
+	return b;
+}
+
+void arena_init(struct arena *a, size_t block_size)
+{
+	memset(a, 0, sizeof(*a));
+	a->block_size = block_size ? block_size : ARENA_BLOCK;
+}
+
+void *arena_alloc(struct arena *a, size_t n)
+{
+	struct arena_block *b = a->cur;
+	size_t need = (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	if (b == NULL) {
+		b = a->first = a->cur = block_new(a, need);
+	}
+
+	/* the next kept block that fits, else a new one at the end
+	 */
+	while (b->size - b->used < need) {
+		if (b->next == NULL) {
+			b->next = block_new(a, need);
+		}
+		b = a->cur = b->next;
+		if (b->size - b->used >= need) {
+			break;
+		}
+	}
+	a->last = (char*)b + b->used;
+	b->used += need;
+	return a->last;
+}
+
+void *arena_realloc(struct arena *a, void *p, size_t old, size_t n)
+{
+	struct arena_block *b = a->cur;
+	void *q;
+
+	if (p == NULL) {
+		return arena_alloc(a, n);
+	}
+	if (p == a->last && b) {
+		size_t start = (char*)p - (char*)b;
+		size_t need = (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+		if (start + need <= b->size) {
+			b->used = start + need;
+			return p;
+		}
+	}
+	q = arena_alloc(a, n);
+	memcpy(q, p, old < n ? old : n);
+	return q;
+}
+
+void arena_reset(struct arena *a)
+{
+	struct arena_block *b;
+	for (b=a->first; b; b=b->next) {
+		b->used = HEADER;
+	}
+	a->cur = a->first;
+	a->last = NULL;
+}
+
+void arena_free(struct arena *a)
+{
+	struct arena_block *b = a->first;
+	while (b) {
+		struct arena_block *next = b->next;
+		munmap(b, b->size);
+		b = next;
+	}
+	memset(a, 0, sizeof(*a));
+}
@@ -0,0 +1,53 @@
+#ifndef s2hv7ea4yq9dm1cx6p /* arena-h */
+#define s2hv7ea4yq9dm1cx6p /* arena-h */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" { /* assume C declarations for C++ */
+#endif
+
+/* bump allocator over a chain of mmap'd blocks, for one thread
+ *
+ * arena_reset rewinds to the first block and keeps every block, so a
+ * job loop that resets per job stops allocating once it has seen its
+ * largest job; blocks of 2 MiB and up are backed by huge pages when
+ * the system has them (hugetlbfs pool, else transparent huge pages)
+ */
+
+#define ARENA_ALIGN 64
+#define ARENA_BLOCK (4 << 20)
+
+struct arena_block;
+
+struct arena {
+	struct arena_block *first, *cur;
+	size_t block_size;
+	void *last; /* most recent allocation, can grow in place */
+	int64_t blocks;
+	int64_t bytes; /* mapped */
+};
+
+void arena_init(struct arena *a, size_t block_size);
+
+/* ARENA_ALIGN aligned, never NULL
+ */
+void *arena_alloc(struct arena *a, size_t n);
+
+/* grows p (old bytes) to n, in place when p is the latest allocation
+ * and its block has room, else moves it
+ */
+void *arena_realloc(struct arena *a, void *p, size_t old, size_t n);
+
+/* everything allocated so far is gone, the memory is kept
+ */
+void arena_reset(struct arena *a);
+
+void arena_free(struct arena *a);
+
+#ifdef __cplusplus
+}; /* end of function prototypes */
+#endif
+
+#endif /* ! s2hv7ea4yq9dm1cx6p arena-h */
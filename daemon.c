@@ -0,0 +1,403 @@
+/*
+
+Copyright (c) 2012, Alexandre Girao <alexgirao@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#define _GNU_SOURCE /* memfd_create */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "debug0.h"
+#include "str.h"
+#include "adpcm.h"
+#include "sample_format.h"
+#include "daemon.h"
+
+/* every worker blocks in accept on the shared socket and keeps its
+ * buffers across requests, so a warm request does no allocation
+ */
+struct worker {
+	pthread_t thread;
+	int listen_fd;
+	struct str payload[1]; /* request bytes, then file contents */
+	struct str out[1]; /* response header and pcm */
+	int16_t pcm[ADPCM_PACKET_SAMPLES * 2];
+};
+
+static int read_full(int fd, void *buf, int64_t len)
+{
+	int64_t got = 0;
+	while (got < len) {
+		ssize_t i = read(fd, (char*)buf + got, len - got);
+		if (i <= 0) {
+			if (i < 0 && errno == EINTR) continue;
+			if (i < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				LOG(D0_INFO, "client timed out, closing connection");
+			}
+			return -1;
+		}
+		got += i;
+	}
+	return 0;
+}
+
+static int flush(int fd, struct str *out)
+{
+	int sent = 0;
+	while (sent < out->len) {
+		ssize_t i = send(fd, out->s + sent, out->len - sent, MSG_NOSIGNAL);
+		if (i <= 0) {
+			if (i < 0 && errno == EINTR) continue;
+			return -1;
+		}
+		sent += i;
+	}
+	out->len = 0;
+	return 0;
+}
+
+static int load_file(struct str *s, const char *path)
+{
+	struct stat st[1];
+	int64_t got = 0;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return errno;
+	}
+	if (fstat(fd, st) != 0 || st->st_size > DAEMON_MAX_PAYLOAD) {
+		close(fd);
+		return EFBIG;
+	}
+	str_alloc(s, st->st_size + 1);
+	while (got < st->st_size) {
+		ssize_t i = pread(fd, s->s + got, st->st_size - got, got);
+		if (i <= 0) {
+			close(fd);
+			return i < 0 ? errno : EIO;
+		}
+		got += i;
+	}
+	close(fd);
+	s->len = got;
+	return 0;
+}
+
+static int reply_error(struct worker *w, int fd, int status)
+{
+	struct daemon_response rsp = {.magic = DAEMON_RESPONSE_MAGIC, .status = status};
+	w->out->len = 0;
+	str_catn(w->out, (char*)&rsp, sizeof(rsp));
+	return flush(fd, w->out);
+}
+
+static int send_fd(int fd, const void *buf, int len, int memfd)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = {.iov_base = (void*)buf, .iov_len = len};
+	struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control)};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	ssize_t i;
+
+	memset(control, 0, sizeof(control));
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+
+	while ((i = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR);
+	if (i <= 0) {
+		return -1;
+	}
+	/* the fd went with the first byte, the rest is plain data
+	 */
+	while (i < len) {
+		ssize_t j = send(fd, (const char*)buf + i, len - i, MSG_NOSIGNAL);
+		if (j <= 0) {
+			if (j < 0 && errno == EINTR) continue;
+			return -1;
+		}
+		i += j;
+	}
+	return 0;
+}
+
+/* decode the range straight into a sealed memfd sized from the packet
+ * math and pass it with SCM_RIGHTS, the pcm never crosses the socket
+ */
+static int serve_memfd(struct worker *w, int fd, const struct adpcm_stream *stream, const unsigned char *in,
+		       int64_t nbits, int64_t first, struct daemon_response *rsp)
+{
+	int64_t left = rsp->samples, bitpos, skip;
+	int width = sample_format_width(rsp->sample_format);
+	unsigned char *map = NULL, *dst;
+	int memfd, n, ret;
+
+	if ((memfd = memfd_create("adpcm_pcm", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0) {
+		return reply_error(w, fd, errno);
+	}
+	if (ftruncate(memfd, rsp->bytes) != 0) {
+		int status = errno;
+		close(memfd);
+		return reply_error(w, fd, status);
+	}
+	if (rsp->bytes && (map = mmap(NULL, rsp->bytes, PROT_WRITE, MAP_SHARED, memfd, 0)) == MAP_FAILED) {
+		int status = errno;
+		close(memfd);
+		return reply_error(w, fd, status);
+	}
+
+	bitpos = ADPCM_STREAM_START + first / ADPCM_PACKET_SAMPLES * stream->packet_bits;
+	skip = first % ADPCM_PACKET_SAMPLES;
+	dst = map;
+
+	while (left > 0) {
+		int take, count;
+
+		/* s16le full packets are decoded in place
+		 */
+		if (rsp->sample_format == SAMPLE_FORMAT_S16LE && skip == 0 && left >= ADPCM_PACKET_SAMPLES) {
+			n = adpcm_decode_packet(stream, in, nbits, &bitpos, (int16_t*)dst);
+			assert(n > 0);
+			dst += n * stream->channels * 2;
+			left -= n;
+			continue;
+		}
+
+		n = adpcm_decode_packet(stream, in, nbits, &bitpos, w->pcm);
+		assert(n > 0);
+		take = n - skip < left ? n - skip : left;
+		count = take * stream->channels;
+		sample_format_convert(rsp->sample_format, dst, w->pcm + skip * stream->channels, count);
+		dst += count * width;
+		left -= take;
+		skip = 0;
+	}
+	assert(dst - map == rsp->bytes);
+
+	/* writable mappings must be gone before F_SEAL_WRITE
+	 */
+	if (map) {
+		munmap(map, rsp->bytes);
+	}
+	if (fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+		int status = errno;
+		close(memfd);
+		return reply_error(w, fd, status);
+	}
+
+	ret = send_fd(fd, rsp, sizeof(*rsp), memfd);
+	close(memfd);
+	return ret;
+}
+
+/* returns nonzero when the connection is done
+ */
+static int serve_one(struct worker *w, int fd)
+{
+	struct daemon_request req[1];
+	struct daemon_response rsp = {.magic = DAEMON_RESPONSE_MAGIC};
+	struct adpcm_stream stream[1];
+	struct adpcm_layout layout[1];
+	int64_t nbits, bitpos, first, left, skip;
+	int width, n;
+
+	if (read_full(fd, req, sizeof(req))) {
+		return 1;
+	}
+	if (req->magic != DAEMON_REQUEST_MAGIC || req->len == 0 || req->len > DAEMON_MAX_PAYLOAD) {
+		LOG(D0_WARN, "bad request header, closing connection");
+		return 1;
+	}
+	str_alloc(w->payload, req->len + 1);
+	if (read_full(fd, w->payload->s, req->len)) {
+		return 1;
+	}
+	w->payload->len = req->len;
+
+	if (req->sample_format >= SAMPLE_FORMAT_COUNT) {
+		return reply_error(w, fd, EINVAL);
+	}
+	if (!(req->flags & DAEMON_INLINE)) {
+		char path[4096];
+		int status;
+		if (req->len >= sizeof(path)) {
+			return reply_error(w, fd, ENAMETOOLONG);
+		}
+		memcpy(path, w->payload->s, req->len);
+		path[req->len] = 0;
+		if ((status = load_file(w->payload, path))) {
+			return reply_error(w, fd, status);
+		}
+		if (w->payload->len == 0) {
+			return reply_error(w, fd, EINVAL);
+		}
+	}
+
+	const unsigned char *in = (unsigned char*)w->payload->s;
+
+	assert(adpcm_stream_init(stream, in, req->flags & DAEMON_STEREO ? 2 : 1) == 0);
+	nbits = (int64_t)w->payload->len * 8;
+	adpcm_stream_layout(stream, nbits, layout);
+
+	first = req->first_sample < 0 ? 0 : req->first_sample;
+	if (first > layout->samples) {
+		first = layout->samples;
+	}
+	left = layout->samples - first;
+	if (req->samples >= 0 && req->samples < left) {
+		left = req->samples;
+	}
+	width = sample_format_width(req->sample_format);
+
+	rsp.channels = stream->channels;
+	rsp.sample_format = req->sample_format;
+	rsp.samples = left;
+	rsp.bytes = left * stream->channels * width;
+
+	if (req->flags & DAEMON_MEMFD) {
+		return serve_memfd(w, fd, stream, in, nbits, first, &rsp);
+	}
+
+	w->out->len = 0;
+	str_catn(w->out, (char*)&rsp, sizeof(rsp));
+
+	/* packets carry their own initial sample and index, so the range
+	 * starts at its packet and only the head of it is dropped
+	 */
+	bitpos = ADPCM_STREAM_START + first / ADPCM_PACKET_SAMPLES * stream->packet_bits;
+	skip = first % ADPCM_PACKET_SAMPLES;
+
+	while (left > 0 && (n = adpcm_decode_packet(stream, in, nbits, &bitpos, w->pcm)) > 0) {
+		int take = n - skip < left ? n - skip : left;
+		int count = take * stream->channels;
+		if (take > 0) {
+			str_alloc(w->out, w->out->len + count * width);
+			sample_format_convert(req->sample_format, w->out->s + w->out->len, w->pcm + skip * stream->channels, count);
+			w->out->len += count * width;
+			left -= take;
+		}
+		skip = 0;
+		if (w->out->len > 0xf000 && flush(fd, w->out)) {
+			return 1;
+		}
+	}
+	assert(left == 0);
+
+	return flush(fd, w->out);
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	struct timeval tv = {.tv_sec = DAEMON_TIMEOUT};
+	for (;;) {
+		int fd = accept(w->listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno != EINTR && errno != ECONNABORTED) {
+				LOG(D0_ERROR, "accept failed, errno=%i", errno);
+				sleep(1);
+			}
+			continue;
+		}
+		/* an idle or stalled client must not hold the worker, any
+		 * read or send that waits longer drops the connection
+		 */
+		if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0
+		    || setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0) {
+			LOG(D0_ERROR, "setsockopt failed, errno=%i", errno);
+			close(fd);
+			continue;
+		}
+		while (serve_one(w, fd) == 0);
+		close(fd);
+	}
+	return NULL;
+}
+
+int daemon_serve(const char *path, int workers)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	struct worker *pool;
+	struct stat st[1];
+	int fd, i;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		LOG(D0_ERROR, "error: socket path too long [%s]", path);
+		return 1;
+	}
+	strcpy(addr.sun_path, path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+		perror("socket");
+		return 1;
+	}
+	if (lstat(path, st) == 0) {
+		if (!S_ISSOCK(st->st_mode)) {
+			LOG(D0_ERROR, "error: [%s] exists and is not a socket", path);
+			close(fd);
+			return 1;
+		}
+		unlink(path); /* stale socket from an earlier run */
+	}
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0) {
+		perror(path);
+		close(fd);
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	pool = calloc(workers, sizeof(struct worker));
+	assert(pool);
+	for (i=0; i<workers; i++) {
+		pool[i].listen_fd = fd;
+		assert(pthread_create(&pool[i].thread, NULL, worker_main, pool + i) == 0);
+	}
+	LOG(D0_INFO, "listening on %s with %i workers", path, workers);
+
+	for (i=0; i<workers; i++) {
+		pthread_join(pool[i].thread, NULL);
+	}
+	return 0;
+}
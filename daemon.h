@@ -0,0 +1,69 @@
+#ifndef x7kf0rwq2m9bj4su1c /* daemon-h */
+#define x7kf0rwq2m9bj4su1c /* daemon-h */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" { /* assume C declarations for C++ */
+#endif
+
+/* decode service over a local unix socket, a connection carries any
+ * number of requests, each answered before the next one is read
+ *
+ * request: struct daemon_request, then len bytes of input path (no
+ * trailing nul) or, with DAEMON_INLINE, of ADPCMSOUNDDATA
+ *
+ * response: struct daemon_response, then bytes of pcm in the requested
+ * sample format; on error status is an errno value and bytes is 0
+ *
+ * with DAEMON_MEMFD no pcm follows, the response carries (SCM_RIGHTS)
+ * a sealed memfd of exactly bytes to be mapped read only
+ *
+ * both ends run on the same host, fields are in native byte order
+ *
+ * a connection idle for DAEMON_TIMEOUT seconds, or that stalls a read
+ * or a send that long, is closed
+ */
+
+#define DAEMON_REQUEST_MAGIC 0x51524441 /* "ADRQ" */
+#define DAEMON_RESPONSE_MAGIC 0x53524441 /* "ADRS" */
+
+#define DAEMON_INLINE 1
+#define DAEMON_STEREO 2
+#define DAEMON_MEMFD 4
+
+#define DAEMON_MAX_PAYLOAD (256 << 20)
+#define DAEMON_TIMEOUT 10
+
+struct daemon_request {
+	uint32_t magic;
+	uint8_t flags;
+	uint8_t sample_format;
+	uint16_t reserved;
+	uint32_t len;
+	uint32_t reserved2;
+	int64_t first_sample; /* per channel */
+	int64_t samples; /* per channel, -1 up to the end */
+};
+
+struct daemon_response {
+	uint32_t magic;
+	int32_t status;
+	uint8_t channels;
+	uint8_t sample_format;
+	uint16_t reserved;
+	uint32_t reserved2;
+	int64_t samples; /* per channel, after clamping the range */
+	int64_t bytes;
+};
+
+/* listen on path and serve with a fixed pool of workers, only returns
+ * on setup errors
+ */
+int daemon_serve(const char *path, int workers);
+
+#ifdef __cplusplus
+}; /* end of function prototypes */
+#endif
+
+#endif /* ! x7kf0rwq2m9bj4su1c daemon-h */
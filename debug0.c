@@ -42,11 +42,15 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <unistd.h>
 #include <stdarg.h>
 #include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include "debug0.h"
 
 //#define USE_CLOCK_GETTIME
 
+int debug0_level = D0_DEBUG;
+
 static void get_current_timeval(struct timeval *tv)
 {
 #ifdef USE_CLOCK_GETTIME
@@ -74,44 +78,204 @@ static int write_exact(int fd, void *buf, int len)
 /* sub or zero */
 #define SOZ(a,b) ((a) > (b) ? (a) - (b) : 0)
 
-void debug0(char *file, int line, char *format, ...)
+/* the "YYYY-MM-DDTHH:MM:SS" part only changes once a second, so
+ * localtime_r and its formatting are cached per thread
+ */
+
+struct time_prefix {
+	time_t sec;
+	int len;
+	char s[32];
+};
+
+static const char *time_prefix(struct time_prefix *tp, time_t t)
 {
-	/* TODO: put timezone or use UTC
-	 */
+	if (tp->len == 0 || tp->sec != t) {
+		struct tm tm[1];
+		/* TODO: put timezone or use UTC
+		 */
+		assert(localtime_r(&t, tm) == tm);
+		tp->len = snprintf(tp->s, sizeof(tp->s), "%u-%.2u-%.2uT%.2u:%.2u:%.2u",
+				   tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
+				   tm->tm_hour, tm->tm_min, tm->tm_sec);
+		tp->sec = t;
+	}
+	return tp->s;
+}
 
-	time_t t;
-	struct tm tm[1];
-	struct timeval tv[1];
-	va_list valist1;
-	char buf[0x7fff];
+/* the time resolution (1/100 of millisecond) below is the same used by
+ * svlogd with -ttt option
+ */
+static int format_line(char *buf, int bufsz, struct time_prefix *tp, struct timeval *tv, const char *file, int line, const char *msg, int msglen)
+{
+	int n = snprintf(buf, bufsz, "%s.%.5u: %s:%i: ",
+			 time_prefix(tp, tv->tv_sec), (unsigned int)(tv->tv_usec/10),
+			 file, line);
+	if (n + msglen + 1 > bufsz) {
+		msglen = SOZ(bufsz, n + 1);
+	}
+	memcpy(buf + n, msg, msglen);
+	n += msglen;
+	buf[n++] = '\n';
+	return n;
+}
+
+/* async ring
+ */
+
+#define RING_SLOTS 1024 /* power of two */
+#define RING_MSG 240
+
+struct ring_slot {
+	atomic_ulong seq; /* ticket + 1 once published */
+	struct timeval tv;
+	const char *file;
+	int line;
+	int len;
+	char msg[RING_MSG];
+};
+
+static struct {
+	struct ring_slot slot[RING_SLOTS];
+	atomic_ulong head; /* next ticket for producers */
+	atomic_ulong tail; /* next ticket for the writer */
+	atomic_ulong dropped;
+	atomic_int running;
+	pthread_t thread;
+} ring[1];
+
+static void *ring_writer(void *arg)
+{
+	static char out[0xffff];
+	struct time_prefix tp[1] = {{0}};
+	unsigned long tail = atomic_load(&ring->tail);
+	int n = 0;
+
+	for (;;) {
+		struct ring_slot *slot = &ring->slot[tail & (RING_SLOTS - 1)];
+		if (atomic_load_explicit(&slot->seq, memory_order_acquire) == tail + 1) {
+			if (n + slot->len + 128 > sizeof(out)) {
+				write_exact(STDERR_FILENO, out, n);
+				n = 0;
+			}
+			n += format_line(out + n, sizeof(out) - n, tp, &slot->tv, slot->file, slot->line, slot->msg, slot->len);
+			atomic_store_explicit(&ring->tail, ++tail, memory_order_release);
+			continue;
+		}
+		if (n) {
+			write_exact(STDERR_FILENO, out, n);
+			n = 0;
+		}
+		if (!atomic_load(&ring->running) && atomic_load(&ring->head) == tail) {
+			break;
+		}
+		struct timespec ts = {0, 1000000};
+		nanosleep(&ts, NULL);
+	}
+	return arg;
+}
+
+int debug0_async_start(void)
+{
+	if (atomic_load(&ring->running)) {
+		return 0;
+	}
+	atomic_store(&ring->running, 1);
+	if (pthread_create(&ring->thread, NULL, ring_writer, NULL) != 0) {
+		atomic_store(&ring->running, 0);
+		return -1;
+	}
+	return 0;
+}
+
+void debug0_async_stop(void)
+{
+	unsigned long dropped;
+	if (!atomic_load(&ring->running)) {
+		return;
+	}
+	atomic_store(&ring->running, 0);
+	pthread_join(ring->thread, NULL);
+	if ((dropped = atomic_load(&ring->dropped))) {
+		debug0_log(D0_WARN, __FILE__, __LINE__, "%lu log messages dropped (ring full)", dropped);
+	}
+}
+
+static int ring_push(struct timeval *tv, const char *file, int line, const char *format, va_list va)
+{
+	unsigned long h = atomic_load(&ring->head);
+	struct ring_slot *slot;
 	int n;
-	long usec;
 
-	va_start(valist1, format);
+	do {
+		if (h - atomic_load_explicit(&ring->tail, memory_order_acquire) >= RING_SLOTS) {
+			atomic_fetch_add(&ring->dropped, 1);
+			return 0;
+		}
+	} while (!atomic_compare_exchange_weak(&ring->head, &h, h + 1));
 
-	get_current_timeval(tv);
+	slot = &ring->slot[h & (RING_SLOTS - 1)];
+	slot->tv = *tv;
+	slot->file = file;
+	slot->line = line;
+	n = vsnprintf(slot->msg, sizeof(slot->msg), format, va);
+	slot->len = n < 0 ? 0 : n >= sizeof(slot->msg) ? sizeof(slot->msg) - 1 : n;
+	atomic_store_explicit(&slot->seq, h + 1, memory_order_release);
+	return 1;
+}
 
-	t = tv->tv_sec;
-	usec = tv->tv_usec;
+static void debug0_v(int level, const char *file, int line, const char *format, va_list va)
+{
+	static __thread struct time_prefix tp[1];
+	struct timeval tv[1];
+	char msg[1024], buf[1024 + 256];
+	int n;
 
-	assert(localtime_r(&t, tm) == tm);
+	get_current_timeval(tv);
 
-	/* the time resolution (1/100 of millisecond) below is the
-	 * same used by svlogd with -ttt option
-	 */
+	if (atomic_load_explicit(&ring->running, memory_order_relaxed)) {
+		if (ring_push(tv, file, line, format, va) || level > D0_WARN) {
+			return;
+		}
+		/* ring full, errors and warnings are not dropped
+		 */
+	}
 
-	n = 0;
-	n = snprintf(buf+n, SOZ(sizeof(buf),n),
-		     "%u-%.2u-%.2uT%.2u:%.2u:%.2u.%.5u: %s:%i: ",
-		     tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
-		     tm->tm_hour, tm->tm_min, tm->tm_sec,
-		     (unsigned int)(usec/10),
-		     file, line
-		);
-	n += vsnprintf(buf+n, SOZ(sizeof(buf),n), format, valist1);
-	n += snprintf(buf+n, SOZ(sizeof(buf),n), "\n");
+	n = vsnprintf(msg, sizeof(msg), format, va);
+	if (n < 0) {
+		n = 0;
+	} else if (n >= sizeof(msg)) {
+		n = sizeof(msg) - 1;
+	}
+	n = format_line(buf, sizeof(buf), tp, tv, file, line, msg, n);
 
 	write_exact(STDERR_FILENO, buf, n);
+}
+
+void debug0_log(int level, const char *file, int line, const char *format, ...)
+{
+	va_list va;
+	va_start(va, format);
+	debug0_v(level, file, line, format, va);
+	va_end(va);
+}
 
-	va_end(valist1);
+void debug0(char *file, int line, char *format, ...)
+{
+	va_list va;
+	va_start(va, format);
+	debug0_v(D0_DEBUG, file, line, format, va);
+	va_end(va);
+}
+
+int debug0_level_from_name(const char *name)
+{
+	static const char *names[] = {NULL, "error", "warn", "info", "debug", "trace"};
+	int i;
+	for (i=D0_ERROR; i<=D0_TRACE; i++) {
+		if (strcmp(names[i], name) == 0) {
+			return i;
+		}
+	}
+	return -1;
 }
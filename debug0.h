@@ -1,24 +1,56 @@
 
-#ifndef NO_DEBUG
+/* log levels, lower is more important
+ */
+
+#define D0_ERROR 1
+#define D0_WARN 2
+#define D0_INFO 3
+#define D0_DEBUG 4
+#define D0_TRACE 5
+
+/* levels above DEBUG0_MAX_LEVEL are compiled out entirely, levels
+ * above debug0_level (runtime) cost a single compare; NO_DEBUG keeps
+ * errors and warnings only
+ */
+
+#ifdef NO_DEBUG
+#undef DEBUG0_MAX_LEVEL
+#define DEBUG0_MAX_LEVEL D0_WARN
+#endif
 
-#if defined (__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
-# define DEBUG(...) do {debug0(__FILE__, __LINE__, __VA_ARGS__);} while (0)
-#elif defined (__GNUC__)
-# define DEBUG(format...) do {debug0(__FILE__, __LINE__, format);} while (0)
+#ifndef DEBUG0_MAX_LEVEL
+#define DEBUG0_MAX_LEVEL D0_TRACE
 #endif
 
-#define DEBUG_DECL(decl) decl
-
-#else
+extern int debug0_level;
 
 #if defined (__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
-# define DEBUG(...)	    //
+# define LOG(level, ...) do {if ((level) <= DEBUG0_MAX_LEVEL && (level) <= debug0_level) debug0_log(level, __FILE__, __LINE__, __VA_ARGS__);} while (0)
+# define DEBUG(...) LOG(D0_DEBUG, __VA_ARGS__)
+# define TRACE(...) LOG(D0_TRACE, __VA_ARGS__)
 #elif defined (__GNUC__)
-# define DEBUG(format...)   //
+# define LOG(level, format...) do {if ((level) <= DEBUG0_MAX_LEVEL && (level) <= debug0_level) debug0_log(level, __FILE__, __LINE__, format);} while (0)
+# define DEBUG(format...) LOG(D0_DEBUG, format)
+# define TRACE(format...) LOG(D0_TRACE, format)
 #endif
 
+#ifndef NO_DEBUG
+#define DEBUG_DECL(decl) decl
+#else
 #define DEBUG_DECL(decl) //
-
 #endif
 
 void debug0(char *file, int line, char *format, ...) __attribute__ ((format (printf, 3, 4)));
+void debug0_log(int level, const char *file, int line, const char *format, ...) __attribute__ ((format (printf, 4, 5)));
+
+/* returns the level for a name (error, warn, info, debug, trace) or -1
+ */
+int debug0_level_from_name(const char *name);
+
+/* async mode: callers only format the message into a ring slot, a
+ * writer thread adds the time prefix and does the (batched) writes,
+ * messages are dropped (and counted) when the ring is full, except
+ * errors and warnings, which are then written by the caller
+ */
+int debug0_async_start(void);
+void debug0_async_stop(void);
@@ -0,0 +1,227 @@
+/*
+
+Copyright (c) 2012, Alexandre Girao <alexgirao@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#define _GNU_SOURCE /* copy_file_range */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h> /* FICLONE */
+
+#include "debug0.h"
+#include "hash.h"
+#include "dedup.h"
+
+void dedup_init(struct dedup *dd)
+{
+	memset(dd, 0, sizeof(*dd));
+	dd->cap = 1024;
+	dd->slots = calloc(dd->cap, sizeof(struct dedup_entry));
+	assert(dd->slots);
+	arena_init(dd->names, 1 << 20);
+}
+
+/* linear probing
+ */
+static struct dedup_entry *next_slot(struct dedup_entry *slots, int cap, const struct dedup_entry *e)
+{
+	return slots + ((e - slots + 1) & (cap - 1));
+}
+
+static void grow(struct dedup *dd)
+{
+	int i, cap = dd->cap * 2;
+	struct dedup_entry *slots = calloc(cap, sizeof(struct dedup_entry));
+	assert(slots);
+	for (i=0; i<dd->cap; i++) {
+		if (dd->slots[i].output) {
+			struct dedup_entry *e = slots + (dd->slots[i].key & (cap - 1));
+			while (e->output) {
+				e = next_slot(slots, cap, e);
+			}
+			*e = dd->slots[i];
+		}
+	}
+	free(dd->slots);
+	dd->slots = slots;
+	dd->cap = cap;
+}
+
+const struct dedup_entry *dedup_lookup(struct dedup *dd, const void *data, int64_t len)
+{
+	struct dedup_entry *e;
+	struct hash h[1];
+
+	dd->key = hash_xxh3_64(data, len);
+	dd->size = len;
+	hash_init(h, HASH_SHA256);
+	hash_update(h, data, len);
+	hash_final(h, dd->digest);
+	dd->inputs++;
+	dd->bytes_in += len;
+
+	for (e = dd->slots + (dd->key & (dd->cap - 1)); e->output; e = next_slot(dd->slots, dd->cap, e)) {
+		if (e->key != dd->key || e->size != len) {
+			continue;
+		}
+		if (memcmp(e->digest, dd->digest, sizeof(dd->digest)) == 0) {
+			return e;
+		}
+		dd->collisions++;
+		LOG(D0_WARN, "[%s] has the same hash but other bytes, decoded", e->input);
+	}
+	return NULL;
+}
+
+static char *keep(struct dedup *dd, const char *s)
+{
+	char *p = arena_alloc(dd->names, strlen(s) + 1);
+	strcpy(p, s);
+	return p;
+}
+
+void dedup_add(struct dedup *dd, const char *input, const char *output, const char *report)
+{
+	struct dedup_entry *e = dd->slots + (dd->key & (dd->cap - 1));
+
+	while (e->output) {
+		e = next_slot(dd->slots, dd->cap, e);
+	}
+	e->key = dd->key;
+	e->size = dd->size;
+	memcpy(e->digest, dd->digest, sizeof(dd->digest));
+	e->input = keep(dd, input);
+	e->output = keep(dd, output);
+	e->report = report ? keep(dd, report) : NULL;
+	dd->bytes_unique += dd->size;
+
+	/* keep the load factor under 1/2
+	 */
+	if (++dd->used * 2 > dd->cap) {
+		grow(dd);
+	}
+}
+
+static int copy_fd(int in, int out)
+{
+	char buf[0x10000];
+	ssize_t n;
+
+	/* in kernel copy, older kernels refuse to cross filesystems
+	 */
+	while ((n = copy_file_range(in, NULL, out, NULL, 1 << 30, 0)) > 0);
+	if (n == 0) {
+		return 0;
+	}
+	if (errno != EXDEV && errno != ENOSYS && errno != EINVAL) {
+		return -1;
+	}
+	while ((n = read(in, buf, sizeof(buf))) > 0) {
+		char *p = buf;
+		while (n > 0) {
+			ssize_t w = write(out, p, n);
+			if (w <= 0) {
+				return -1;
+			}
+			p += w;
+			n -= w;
+		}
+	}
+	return n;
+}
+
+int dedup_fanout(struct dedup *dd, const char *src, const char *dst)
+{
+	int in, out, ret;
+
+	if (strcmp(src, dst) == 0) {
+		return 0;
+	}
+	if (unlink(dst) != 0 && errno != ENOENT) {
+		perror(dst);
+		return 1;
+	}
+	if (link(src, dst) == 0) {
+		dd->linked++;
+		return 0;
+	}
+
+	/* EXDEV, EMLINK or no hardlinks on this filesystem
+	 */
+
+	if ((in = open(src, O_RDONLY)) < 0) {
+		perror(src);
+		return 1;
+	}
+	if ((out = open(dst, O_CREAT | O_WRONLY | O_TRUNC, 0644)) < 0) {
+		perror(dst);
+		close(in);
+		return 1;
+	}
+	if (ioctl(out, FICLONE, in) == 0) {
+		dd->reflinked++;
+		ret = 0;
+	} else if (copy_fd(in, out) == 0) {
+		dd->copied++;
+		ret = 0;
+	} else {
+		LOG(D0_ERROR, "error: failed to copy [%s] to [%s], errno=%i", src, dst, errno);
+		ret = 1;
+	}
+	close(in);
+	assert(close(out) == 0);
+	return ret;
+}
+
+void dedup_print(struct dedup *dd, FILE *f)
+{
+	fprintf(f, "{\"inputs\": %lld, \"unique\": %i, \"linked\": %lld, \"reflinked\": %lld, \"copied\": %lld",
+		(long long)dd->inputs, dd->used, (long long)dd->linked, (long long)dd->reflinked, (long long)dd->copied);
+	if (dd->collisions) {
+		fprintf(f, ", \"collisions\": %lld", (long long)dd->collisions);
+	}
+	fprintf(f, ", \"bytes_in\": %lld, \"bytes_unique\": %lld, \"dedup_ratio\": %.3f}\n",
+		(long long)dd->bytes_in, (long long)dd->bytes_unique,
+		dd->used ? (double)dd->inputs / dd->used : 1.0);
+}
+
+void dedup_free(struct dedup *dd)
+{
+	arena_free(dd->names);
+	free(dd->slots);
+	dd->slots = NULL;
+}
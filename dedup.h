@@ -0,0 +1,66 @@
+#ifndef q3vd81hz5ntr0xkw6e /* dedup-h */
+#define q3vd81hz5ntr0xkw6e /* dedup-h */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+#ifdef __cplusplus
+extern "C" { /* assume C declarations for C++ */
+#endif
+
+/* batch wide payload dedup: inputs are keyed by size and XXH3-64 of
+ * their bytes, the first output path decoded for a key is the source
+ * every later duplicate is linked, reflinked or copied from; a key
+ * match is confirmed by the SHA-256 of both payloads, so an XXH3
+ * collision decodes instead of fanning out the wrong pcm
+ */
+
+struct dedup_entry {
+	uint64_t key;
+	int64_t size;
+	unsigned char digest[32]; /* SHA-256 */
+	char *input; /* in dedup.names */
+	char *output; /* NULL for a free slot, in dedup.names */
+	char *report; /* json lines of output, in dedup.names */
+};
+
+struct dedup {
+	struct dedup_entry *slots;
+	int cap; /* power of two */
+	int used;
+	struct arena names[1]; /* output paths, for the whole batch */
+	int64_t inputs;
+	int64_t linked, reflinked, copied;
+	int64_t bytes_in, bytes_unique;
+	int64_t collisions;
+	uint64_t key; /* of the last dedup_lookup */
+	int64_t size;
+	unsigned char digest[32];
+};
+
+void dedup_init(struct dedup *dd);
+
+/* returns the entry of an earlier identical payload, or NULL
+ */
+const struct dedup_entry *dedup_lookup(struct dedup *dd, const void *data, int64_t len);
+
+/* records input, decoded to output, as the source for the payload of
+ * the last dedup_lookup that returned NULL, report (json lines about
+ * output, may be NULL) goes along
+ */
+void dedup_add(struct dedup *dd, const char *input, const char *output, const char *report);
+
+/* make dst a copy of src: hardlink, else reflink, else copy_file_range
+ */
+int dedup_fanout(struct dedup *dd, const char *src, const char *dst);
+
+void dedup_print(struct dedup *dd, FILE *f);
+void dedup_free(struct dedup *dd);
+
+#ifdef __cplusplus
+}; /* end of function prototypes */
+#endif
+
+#endif /* ! q3vd81hz5ntr0xkw6e dedup-h */
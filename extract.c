@@ -0,0 +1,698 @@
+/*
+
+Copyright (c) 2012, Alexandre Girao <alexgirao@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#define _GNU_SOURCE /* copy_file_range, splice */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+
+#include "debug0.h"
+#include "str.h"
+#include "adpcm.h"
+#include "hash.h"
+#include "swf.h"
+#include "manifest.h"
+#include "extract.h"
+
+/* a stack of paths shared by the workers, a worker that pops a
+ * directory pushes its entries back, the walk is over when the stack is
+ * empty and no worker holds an item
+ */
+struct item {
+	char *path;
+	int is_dir;
+};
+
+struct walk {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct item *items;
+	int n, a;
+	int busy;
+
+	struct manifest *manifest; /* NULL without --manifest */
+
+	/* summary
+	 */
+	int64_t swfs, adpcm, mp3, other, kept, unchanged, errors;
+};
+
+struct worker {
+	pthread_t thread;
+	struct walk *walk;
+	int id;
+
+	/* the swf being extracted, mapped: tag headers and adpcm payloads
+	 * are read through the map, mp3 payloads of FWS files are copied
+	 * from fd in kernel and never touched
+	 */
+	int fd;
+	const unsigned char *map;
+	int64_t map_len;
+
+	struct str pcm[1];
+	struct str path[1];
+	struct str tmp[1];
+	struct str sounds[1]; /* struct manifest_sound, for the manifest */
+};
+
+static void push(struct walk *w, char *path, int is_dir)
+{
+	pthread_mutex_lock(&w->lock);
+	if (w->n == w->a) {
+		w->a = w->a ? w->a * 2 : 256;
+		w->items = realloc(w->items, w->a * sizeof(struct item));
+		assert(w->items);
+	}
+	w->items[w->n].path = path;
+	w->items[w->n].is_dir = is_dir;
+	w->n++;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+static int pop(struct walk *w, struct item *it)
+{
+	int ret = 0;
+	pthread_mutex_lock(&w->lock);
+	while (w->n == 0 && w->busy > 0) {
+		pthread_cond_wait(&w->cond, &w->lock);
+	}
+	if (w->n > 0) {
+		*it = w->items[--w->n];
+		w->busy++;
+		ret = 1;
+	} else {
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return ret;
+}
+
+static void done(struct walk *w)
+{
+	pthread_mutex_lock(&w->lock);
+	if (--w->busy == 0 && w->n == 0) {
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->lock);
+}
+
+#define COUNT(w, field) __sync_fetch_and_add(&(w)->field, 1)
+
+static int has_swf_suffix(const char *name)
+{
+	size_t len = strlen(name);
+	return len > 4 && strcasecmp(name + len - 4, ".swf") == 0;
+}
+
+static void walk_dir(struct walk *w, const char *path)
+{
+	struct dirent *de;
+	DIR *d;
+
+	if ((d = opendir(path)) == NULL) {
+		LOG(D0_ERROR, "error: opendir [%s]: %s", path, strerror(errno));
+		COUNT(w, errors);
+		return;
+	}
+	while ((de = readdir(d))) {
+		int is_dir = de->d_type == DT_DIR, is_reg = de->d_type == DT_REG;
+		size_t len = strlen(de->d_name);
+		char *child;
+
+		if (de->d_name[0] == '.' && (len == 1 || (len == 2 && de->d_name[1] == '.'))) {
+			continue;
+		}
+		if (len > 7 && strcmp(de->d_name + len - 7, "_assets") == 0) {
+			continue; /* our own outputs */
+		}
+		if ((is_reg && !has_swf_suffix(de->d_name)) || (!is_dir && !is_reg && de->d_type != DT_UNKNOWN)) {
+			continue; /* symlinks are not followed */
+		}
+
+		child = malloc(strlen(path) + len + 2);
+		assert(child);
+		sprintf(child, "%s/%s", path, de->d_name);
+
+		if (de->d_type == DT_UNKNOWN) {
+			struct stat st[1];
+			if (lstat(child, st) != 0) {
+				free(child);
+				continue;
+			}
+			is_dir = S_ISDIR(st->st_mode);
+			is_reg = S_ISREG(st->st_mode);
+		}
+		if (is_dir || (is_reg && has_swf_suffix(de->d_name))) {
+			push(w, child, is_dir);
+		} else {
+			free(child);
+		}
+	}
+	closedir(d);
+}
+
+static int map_file(struct worker *wk, const char *path, struct stat *st)
+{
+	if ((wk->fd = open(path, O_RDONLY)) < 0 || fstat(wk->fd, st) != 0) {
+		if (wk->fd >= 0) close(wk->fd);
+		return -1;
+	}
+	wk->map_len = st->st_size;
+	wk->map = NULL;
+	if (wk->map_len == 0) {
+		return 0;
+	}
+	if ((wk->map = mmap(NULL, wk->map_len, PROT_READ, MAP_PRIVATE, wk->fd, 0)) == MAP_FAILED) {
+		close(wk->fd);
+		return -1;
+	}
+	return 0;
+}
+
+static void unmap_file(struct worker *wk)
+{
+	if (wk->map) {
+		munmap((void*)wk->map, wk->map_len);
+		wk->map = NULL;
+	}
+	close(wk->fd);
+}
+
+/* written under a temporary name and renamed, an interrupted run never
+ * leaves a short output that looks up to date
+ */
+static int open_tmp(struct worker *wk, const char *path)
+{
+	int fd;
+	str_copyf(wk->tmp, "%s.%i.tmp", path, wk->id);
+	if ((fd = open(wk->tmp->s, O_CREAT | O_WRONLY | O_TRUNC, 0644)) < 0) {
+		LOG(D0_ERROR, "error: open [%s]: %s", wk->tmp->s, strerror(errno));
+	}
+	return fd;
+}
+
+static int commit_tmp(struct worker *wk, int fd, const char *path, int failed)
+{
+	if (failed) {
+		LOG(D0_ERROR, "error: write [%s]: %s", wk->tmp->s, strerror(errno));
+		close(fd);
+		unlink(wk->tmp->s);
+		return -1;
+	}
+	if (close(fd) != 0 || rename(wk->tmp->s, path) != 0) {
+		LOG(D0_ERROR, "error: rename [%s]: %s", path, strerror(errno));
+		unlink(wk->tmp->s);
+		return -1;
+	}
+	return 0;
+}
+
+static int write_all(int fd, const char *p, size_t left)
+{
+	while (left > 0) {
+		ssize_t n = write(fd, p, left);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) {
+			return -1;
+		}
+		p += n;
+		left -= n;
+	}
+	return 0;
+}
+
+static int write_file(struct worker *wk, const char *path, const struct iovec *iov, int iovcnt)
+{
+	int fd, i, failed = 0;
+
+	if ((fd = open_tmp(wk, path)) < 0) {
+		return -1;
+	}
+	for (i=0; i<iovcnt && !failed; i++) {
+		failed = write_all(fd, iov[i].iov_base, iov[i].iov_len);
+	}
+	return commit_tmp(wk, fd, path, failed);
+}
+
+/* as much of [*off, *off + *len) as the kernel will move from in to out
+ * by itself: copy_file_range (reflinks where the filesystem can), else
+ * splice through a pipe; what is left is for the caller to write
+ */
+static void copy_range(int in, int64_t *off, int out, int64_t *len)
+{
+	loff_t o = *off;
+	ssize_t n = 0;
+	int p[2];
+
+	while (*len > 0 && (n = copy_file_range(in, &o, out, NULL, *len, 0)) > 0) {
+		*len -= n;
+	}
+	if (*len > 0 && n < 0 && pipe(p) == 0) {
+		while (*len > 0) {
+			ssize_t k = splice(in, &o, p[1], NULL, *len > 0x10000 ? 0x10000 : *len, SPLICE_F_MOVE);
+			if (k <= 0) {
+				break;
+			}
+			*len -= k;
+			while (k > 0 && (n = splice(p[0], NULL, out, NULL, k, SPLICE_F_MOVE)) > 0) {
+				k -= n;
+			}
+			if (k > 0) {
+				/* stuck in the pipe, give the range back and
+				 * let the caller rewrite it
+				 */
+				*len += k;
+				o -= k;
+				break;
+			}
+		}
+		close(p[0]);
+		close(p[1]);
+	}
+	*off = o;
+}
+
+/* bytes [off, off + len) of the swf file
+ */
+static int write_file_range(struct worker *wk, const char *path, int64_t off, int64_t len)
+{
+	int fd, failed = 0;
+
+	if ((fd = open_tmp(wk, path)) < 0) {
+		return -1;
+	}
+	copy_range(wk->fd, &off, fd, &len);
+	if (len > 0) {
+		/* output offset is where the kernel copy stopped
+		 */
+		failed = write_all(fd, (const char*)wk->map + off, len);
+	}
+	return commit_tmp(wk, fd, path, failed);
+}
+
+static int up_to_date(const char *path, const struct stat *swf_st)
+{
+	struct stat st[1];
+	return stat(path, st) == 0 && st->st_mtime >= swf_st->st_mtime;
+}
+
+static void put_le16(unsigned char *p, int v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/* canonical 44 byte header, 16-bit pcm
+ */
+static void wav_header(unsigned char *h, int channels, int rate, uint32_t data_bytes)
+{
+	memcpy(h, "RIFF", 4);
+	put_le32(h + 4, 36 + data_bytes);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	put_le32(h + 16, 16);
+	put_le16(h + 20, 1);
+	put_le16(h + 22, channels);
+	put_le32(h + 24, rate);
+	put_le32(h + 28, rate * channels * 2);
+	put_le16(h + 32, channels * 2);
+	put_le16(h + 34, 16);
+	memcpy(h + 36, "data", 4);
+	put_le32(h + 40, data_bytes);
+}
+
+/* the whole sound is decoded into wk->pcm, decoder output is s16le on
+ * little endian hosts which is what wav wants
+ */
+static int decode_adpcm(struct worker *wk, const struct swf_sound *snd)
+{
+	struct adpcm_stream stream[1];
+	struct adpcm_layout layout[1];
+	int64_t bitpos = ADPCM_STREAM_START, nbits = snd->len * 8, bytes;
+	int16_t *out;
+	int n;
+
+	if (snd->len == 0 || adpcm_stream_init(stream, snd->data, snd->channels)) {
+		return -1;
+	}
+	adpcm_stream_layout(stream, nbits, layout);
+	bytes = layout->samples * snd->channels * 2;
+	if (bytes > UINT32_MAX - 36) { /* the riff sizes are 32 bits */
+		return -1;
+	}
+	str_alloc(wk->pcm, bytes + 1);
+	out = (int16_t*)wk->pcm->s;
+	while ((n = adpcm_decode_packet(stream, snd->data, nbits, &bitpos, out)) > 0) {
+		out += n * snd->channels;
+	}
+	wk->pcm->len = (char*)out - wk->pcm->s;
+	return 0;
+}
+
+static void record_sound(struct worker *wk, const struct swf_sound *snd, int outputs)
+{
+	struct manifest_sound ms = {.id = snd->id, .format = snd->format, .outputs = outputs};
+	str_catn(wk->sounds, (char*)&ms, sizeof(ms));
+}
+
+static int extract_sound(struct worker *wk, const char *outdir, const struct swf *swf, const struct swf_sound *snd, const struct stat *swf_st)
+{
+	struct walk *w = wk->walk;
+	struct iovec iov[2];
+
+	if (snd->format == SWF_SOUND_ADPCM) {
+		unsigned char h[44];
+
+		COUNT(w, adpcm);
+		record_sound(wk, snd, MANIFEST_ADPCM | MANIFEST_WAV);
+
+		str_copyf(wk->path, "%s/sound-%04d.adpcm", outdir, snd->id);
+		if (!up_to_date(wk->path->s, swf_st)) {
+			iov[0].iov_base = (void*)snd->data;
+			iov[0].iov_len = snd->len;
+			if (write_file(wk, wk->path->s, iov, 1)) {
+				return -1;
+			}
+		}
+
+		str_catz(wk->path, ".wav");
+		if (up_to_date(wk->path->s, swf_st)) {
+			COUNT(w, kept);
+			return 0;
+		}
+		if (decode_adpcm(wk, snd)) {
+			LOG(D0_ERROR, "error: [%s] sound %i is not valid adpcm", outdir, snd->id);
+			return -1;
+		}
+		wav_header(h, snd->channels, snd->rate, wk->pcm->len);
+		iov[0].iov_base = h;
+		iov[0].iov_len = sizeof(h);
+		iov[1].iov_base = wk->pcm->s;
+		iov[1].iov_len = wk->pcm->len;
+		return write_file(wk, wk->path->s, iov, 2);
+	}
+
+	if (snd->format == SWF_SOUND_MP3) {
+		COUNT(w, mp3);
+		record_sound(wk, snd, MANIFEST_MP3);
+
+		/* MP3SOUNDDATA starts with SI16 SeekSamples, the frames follow
+		 */
+		if (snd->len < 2) {
+			return -1;
+		}
+		str_copyf(wk->path, "%s/sound-%04d.mp3", outdir, snd->id);
+		if (up_to_date(wk->path->s, swf_st)) {
+			COUNT(w, kept);
+			return 0;
+		}
+		if (!swf->compressed) {
+			return write_file_range(wk, wk->path->s, snd->offset + 2, snd->len - 2);
+		}
+		iov[0].iov_base = (void*)(snd->data + 2);
+		iov[0].iov_len = snd->len - 2;
+		return write_file(wk, wk->path->s, iov, 1);
+	}
+
+	DEBUG("[%s] sound %i, format %i, not extracted", outdir, snd->id, snd->format);
+	COUNT(w, other);
+	record_sound(wk, snd, 0);
+	return 0;
+}
+
+/* <dir>/<name up to the first dot>.<extension>_assets
+ */
+static void assets_dir(struct str *out, const char *path)
+{
+	const char *base = strrchr(path, '/'), *dot, *ext;
+
+	base = base ? base + 1 : path;
+	dot = strchr(base, '.');
+	ext = strrchr(base, '.');
+	ext = ext ? ext + 1 : base;
+
+	str_copyn(out, path, base - path);
+	str_catn(out, base, dot ? dot - base : strlen(base));
+	str_catf(out, ".%s_assets", ext);
+}
+
+static int64_t mtime_ns(const struct stat *st)
+{
+	return st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+/* every output the manifest recorded for an input is still there
+ */
+static int outputs_exist(struct worker *wk, const char *outdir, const struct manifest_entry *e)
+{
+	struct stat st[1];
+	uint32_t i;
+
+	for (i=0; i<e->nsounds; i++) {
+		const struct manifest_sound *ms = e->sounds + i;
+		if (ms->outputs & MANIFEST_ADPCM) {
+			str_copyf(wk->path, "%s/sound-%04d.adpcm", outdir, ms->id);
+			if (stat(wk->path->s, st) != 0) return 0;
+		}
+		if (ms->outputs & MANIFEST_WAV) {
+			str_copyf(wk->path, "%s/sound-%04d.adpcm.wav", outdir, ms->id);
+			if (stat(wk->path->s, st) != 0) return 0;
+		}
+		if (ms->outputs & MANIFEST_MP3) {
+			str_copyf(wk->path, "%s/sound-%04d.mp3", outdir, ms->id);
+			if (stat(wk->path->s, st) != 0) return 0;
+		}
+	}
+	return 1;
+}
+
+static int extract_swf(struct worker *wk, const char *path)
+{
+	DEFINE_STR(outdir);
+	struct manifest *m = wk->walk->manifest;
+	struct manifest_entry known[1];
+	struct swf swf[1] = {{.inflated = {NULL_STR}}};
+	struct swf_tag tag[1];
+	struct stat st[1];
+	uint64_t hash = 0;
+	int i, ret = 0, made_dir = 0, have_known = 0;
+
+	/* same size and mtime as last time, nothing to read
+	 */
+	if (m && stat(path, st) == 0 && manifest_get(m, path, known, wk->sounds) == 0) {
+		if (known->size == st->st_size && known->mtime == mtime_ns(st)) {
+			COUNT(wk->walk, unchanged);
+			return 0;
+		}
+		have_known = 1;
+	}
+
+	if (map_file(wk, path, st)) {
+		LOG(D0_ERROR, "error: [%s]: %s", path, strerror(errno));
+		return -1;
+	}
+	assets_dir(outdir, path);
+
+	/* touched or copied over but the same bytes, and the outputs are
+	 * still around, just refresh the record
+	 */
+	if (m) {
+		hash = hash_xxh3_64(wk->map, wk->map_len);
+		if (have_known && known->hash == hash && known->size == wk->map_len && outputs_exist(wk, outdir->s, known)) {
+			manifest_put(m, path, hash, st->st_size, mtime_ns(st), known->sounds, known->nsounds);
+			COUNT(wk->walk, unchanged);
+			unmap_file(wk);
+			str_free(outdir);
+			return 0;
+		}
+	}
+
+	if (swf_open(swf, wk->map, wk->map_len)) {
+		LOG(D0_ERROR, "error: [%s] is not a supported swf", path);
+		unmap_file(wk);
+		str_free(outdir);
+		swf_free(swf);
+		return -1;
+	}
+	COUNT(wk->walk, swfs);
+
+	wk->sounds->len = 0;
+
+	while ((i = swf_next_tag(swf, tag)) > 0) {
+		struct swf_sound snd[1];
+		if (tag->code != SWF_TAG_DEFINE_SOUND) {
+			continue;
+		}
+		if (swf_define_sound(tag, snd)) {
+			LOG(D0_ERROR, "error: [%s] short DefineSound tag", path);
+			ret = -1;
+			continue;
+		}
+		if (!made_dir) {
+			if (mkdir(outdir->s, 0755) != 0 && errno != EEXIST) {
+				LOG(D0_ERROR, "error: mkdir [%s]: %s", outdir->s, strerror(errno));
+				ret = -1;
+				break;
+			}
+			made_dir = 1;
+		}
+		if (extract_sound(wk, outdir->s, swf, snd, st)) {
+			ret = -1;
+		}
+	}
+	if (i < 0) {
+		LOG(D0_WARN, "[%s] truncated tag list", path);
+	}
+
+	/* failures are left out, they are tried again next run
+	 */
+	if (m && ret == 0) {
+		manifest_put(m, path, hash, st->st_size, mtime_ns(st), (struct manifest_sound*)wk->sounds->s, wk->sounds->len / sizeof(struct manifest_sound));
+	}
+
+	unmap_file(wk);
+	str_free(outdir);
+	swf_free(swf);
+	return ret;
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *wk = arg;
+	struct walk *w = wk->walk;
+	struct item it;
+
+	while (pop(w, &it)) {
+		if (it.is_dir) {
+			walk_dir(w, it.path);
+		} else if (extract_swf(wk, it.path)) {
+			COUNT(w, errors);
+		}
+		free(it.path);
+		done(w);
+	}
+	return NULL;
+}
+
+int extract_assets(const char **paths, int npaths, int workers, const char *manifest)
+{
+	struct manifest m[1];
+	struct walk w[1];
+	struct worker *wk;
+	int i;
+
+	memset(w, 0, sizeof(w));
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+
+	if (manifest) {
+		if (manifest_load(m, manifest)) {
+			manifest_free(m);
+			return 1;
+		}
+		w->manifest = m;
+	}
+
+	/* given files are taken whatever their name
+	 */
+	for (i=npaths-1; i>=0; i--) {
+		struct stat st[1];
+		char *p;
+		if (stat(paths[i], st) != 0) {
+			LOG(D0_ERROR, "error: file [%s] not found", paths[i]);
+			w->errors++;
+			continue;
+		}
+		p = strdup(paths[i]);
+		assert(p);
+		if (S_ISDIR(st->st_mode)) {
+			size_t len = strlen(p);
+			while (len > 1 && p[len - 1] == '/') {
+				p[--len] = 0;
+			}
+		}
+		push(w, p, S_ISDIR(st->st_mode));
+	}
+
+	wk = calloc(workers, sizeof(struct worker));
+	assert(wk);
+	for (i=0; i<workers; i++) {
+		wk[i].walk = w;
+		wk[i].id = i;
+		assert(pthread_create(&wk[i].thread, NULL, worker_main, wk + i) == 0);
+	}
+	for (i=0; i<workers; i++) {
+		pthread_join(wk[i].thread, NULL);
+		str_free(wk[i].pcm);
+		str_free(wk[i].path);
+		str_free(wk[i].tmp);
+		str_free(wk[i].sounds);
+	}
+	free(wk);
+	free(w->items);
+	pthread_mutex_destroy(&w->lock);
+	pthread_cond_destroy(&w->cond);
+
+	if (manifest) {
+		if (manifest_save(m)) {
+			w->errors++;
+		}
+		manifest_free(m);
+	}
+
+	fprintf(stderr, "{\"swf\": %lli, \"adpcm\": %lli, \"mp3\": %lli, \"other\": %lli, \"kept\": %lli, \"unchanged\": %lli, \"errors\": %lli}\n",
+		(long long)w->swfs, (long long)w->adpcm, (long long)w->mp3,
+		(long long)w->other, (long long)w->kept, (long long)w->unchanged, (long long)w->errors);
+
+	return w->errors != 0;
+}
@@ -0,0 +1,27 @@
+#ifndef b6xw1n4ge9rj2uq7tf /* extract-h */
+#define b6xw1n4ge9rj2uq7tf /* extract-h */
+
+#ifdef __cplusplus
+extern "C" { /* assume C declarations for C++ */
+#endif
+
+/* walks files and directories on a pool of threads, every .swf found
+ * (or file given) is parsed once and its DefineSound tags written next
+ * to it, as swf-extract-assets.sh did:
+ *
+ *   <dir>/<name>.<ext>_assets/sound-<id>.adpcm      ADPCMSOUNDDATA
+ *   <dir>/<name>.<ext>_assets/sound-<id>.adpcm.wav  decoded, s16le wav
+ *   <dir>/<name>.<ext>_assets/sound-<id>.mp3        MP3 frames
+ *
+ * outputs newer than their swf are kept; with a manifest file (see
+ * manifest.h) inputs it has seen unchanged are skipped without being
+ * read or parsed, a json summary goes to stderr, returns nonzero when
+ * any input failed
+ */
+int extract_assets(const char **paths, int npaths, int workers, const char *manifest);
+
+#ifdef __cplusplus
+}; /* end of function prototypes */
+#endif
+
+#endif /* ! b6xw1n4ge9rj2uq7tf extract-h */
@@ -0,0 +1,965 @@
+/*
+
+Copyright (c) 2012, Alexandre Girao <alexgirao@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+ * reference: https://xiph.org/flac/format.html
+ * reference: RFC 9639 (FLAC)
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "debug0.h"
+#include "hash.h"
+#include "flac.h"
+
+#define BPS 16
+#define MAX_LPC_ORDER 12
+#define MAX_FIXED_ORDER 4
+#define MAX_PORDER 8
+#define BATCH_FRAMES 64
+#define SEEK_SECONDS 10
+
+/* verbatim side channel plus per channel and frame overhead, encoded
+ * subframes are never larger than their verbatim estimate
+ */
+#define FRAME_BYTES ((FLAC_BLOCKSIZE * (BPS + 1) / 8 + 128) * 2 + 64)
+
+#define STREAMINFO_OFFSET 8 /* after "fLaC" and the block header */
+#define SEEKTABLE_OFFSET (STREAMINFO_OFFSET + 34 + 4)
+
+enum {
+	SUB_CONSTANT,
+	SUB_VERBATIM,
+	SUB_FIXED,
+	SUB_LPC
+};
+
+struct subframe {
+	int type;
+	int bps;
+	int order;
+	int precision, shift;
+	int32_t qlp[MAX_LPC_ORDER];
+	int porder, method;
+	int k[1 << MAX_PORDER];
+	const int32_t *x;
+	int32_t *residual;
+	int64_t bits;
+};
+
+struct frame {
+	int16_t samples[FLAC_BLOCKSIZE * 2];
+	int n; /* per channel */
+	int64_t number;
+	unsigned char *out;
+	int len;
+};
+
+struct batch {
+	struct frame *frames;
+	int count; /* filled */
+	int next; /* claimed by a worker */
+	int done;
+	int busy; /* submitted, not yet written */
+};
+
+/* per worker, all channel variants of one frame
+ */
+struct scratch {
+	int32_t ch[4][FLAC_BLOCKSIZE]; /* left, right, mid, side */
+	int32_t res[4][2][FLAC_BLOCKSIZE];
+	double xw[FLAC_BLOCKSIZE];
+};
+
+struct flac {
+	int fd;
+	int channels;
+	int rate;
+	int64_t base; /* offset of "fLaC", -1 when fd can not seek */
+	int64_t samples;
+	int64_t frames;
+	int64_t bytes; /* of frames */
+	int min_frame, max_frame;
+	int error;
+	struct hash md5[1];
+
+	struct batch batch[2];
+	int cur;
+
+	int seek_stride; /* frames */
+	int seek_points;
+	unsigned char *seektable;
+
+	pthread_t *threads;
+	int nthreads;
+	pthread_mutex_t lock;
+	pthread_cond_t wake, finished;
+	struct batch *work;
+	int quit;
+};
+
+static uint8_t crc8_table[256];
+static uint16_t crc16_table[256];
+static double tukey[FLAC_BLOCKSIZE];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static void init_tables(void)
+{
+	int i, j;
+	for (i=0; i<256; i++) {
+		uint8_t c8 = i;
+		uint16_t c16 = i << 8;
+		for (j=0; j<8; j++) {
+			c8 = c8 & 0x80 ? (c8 << 1) ^ 0x07 : c8 << 1;
+			c16 = c16 & 0x8000 ? (c16 << 1) ^ 0x8005 : c16 << 1;
+		}
+		crc8_table[i] = c8;
+		crc16_table[i] = c16;
+	}
+}
+
+/* tukey(0.5) window
+ */
+static void window(double *w, int n)
+{
+	int i, np = n / 4;
+	for (i=0; i<n; i++) {
+		w[i] = 1;
+	}
+	for (i=0; i<np; i++) {
+		w[i] = w[n - 1 - i] = 0.5 - 0.5 * cos(M_PI * i / np);
+	}
+}
+
+static void init_once(void)
+{
+	init_tables();
+	window(tukey, FLAC_BLOCKSIZE);
+}
+
+/* bit writer, msb first
+ */
+
+struct bitwriter {
+	unsigned char *p;
+	uint64_t acc;
+	int n; /* pending bits, < 32 between calls */
+};
+
+static inline void bw_put(struct bitwriter *bw, uint32_t v, int bits)
+{
+	bw->acc = (bw->acc << bits) | (v & (uint32_t)((1ULL << bits) - 1));
+	bw->n += bits;
+	if (bw->n >= 32) {
+		uint32_t w;
+		bw->n -= 32;
+		w = bw->acc >> bw->n;
+		bw->p[0] = w >> 24;
+		bw->p[1] = w >> 16;
+		bw->p[2] = w >> 8;
+		bw->p[3] = w;
+		bw->p += 4;
+	}
+}
+
+/* push out the whole pending bytes
+ */
+static void bw_flush(struct bitwriter *bw)
+{
+	while (bw->n >= 8) {
+		bw->n -= 8;
+		*bw->p++ = bw->acc >> bw->n;
+	}
+}
+
+static inline void bw_rice(struct bitwriter *bw, uint32_t u, int k)
+{
+	uint32_t q = u >> k;
+	while (q + k + 1 > 32) {
+		int z = q > 32 ? 32 : q;
+		bw_put(bw, 0, z);
+		q -= z;
+	}
+	bw_put(bw, (1U << k) | (u & ((1U << k) - 1)), q + k + 1);
+}
+
+static void bw_align(struct bitwriter *bw)
+{
+	if (bw->n & 7) {
+		bw_put(bw, 0, 8 - (bw->n & 7));
+	}
+	bw_flush(bw);
+}
+
+static inline uint32_t zigzag(int32_t r)
+{
+	return ((uint32_t)r << 1) ^ (uint32_t)(r >> 31);
+}
+
+/* residual coding: optimal partition order over rice parameters picked
+ * from partition sums, sum(u >> k) <= (sum(u) >> k) + 1 so the
+ * estimate is tight
+ */
+
+static int64_t rice_cost(uint64_t sum, int count, int *kp)
+{
+	int64_t best = -1;
+	int k, k0 = 0;
+
+	while (k0 < 30 && ((uint64_t)count << (k0 + 1)) <= sum) {
+		k0++;
+	}
+	for (k = k0 ? k0 - 1 : 0; k <= k0 + 1 && k <= 30; k++) {
+		int64_t bits = (int64_t)count * (k + 1) + (int64_t)(sum >> k);
+		if (best < 0 || bits < best) {
+			best = bits;
+			*kp = k;
+		}
+	}
+	return best;
+}
+
+static void rice_search(struct subframe *sf, int n)
+{
+	uint64_t sums[1 << MAX_PORDER];
+	const int32_t *res = sf->residual;
+	int order = sf->order;
+	int maxp = 0, p, j, i;
+
+	while (maxp < MAX_PORDER && n % (2 << maxp) == 0 && (n >> (maxp + 1)) > order) {
+		maxp++;
+	}
+
+	for (j=0; j<(1 << maxp); j++) {
+		int ps = n >> maxp;
+		int start = j ? j * ps - order : 0;
+		int end = (j + 1) * ps - order;
+		uint64_t sum = 0;
+		for (i=start; i<end; i++) {
+			sum += zigzag(res[i]);
+		}
+		sums[j] = sum;
+	}
+
+	sf->bits = -1;
+	for (p=maxp; p>=0; p--) {
+		int k[1 << MAX_PORDER];
+		int ps = n >> p, kmax = 0;
+		int64_t bits = 2 + 4;
+		for (j=0; j<(1 << p); j++) {
+			bits += rice_cost(sums[j], j ? ps : ps - order, k + j);
+			if (k[j] > kmax) {
+				kmax = k[j];
+			}
+		}
+		bits += (1 << p) * (kmax > 14 ? 5 : 4);
+		if (sf->bits < 0 || bits < sf->bits) {
+			sf->bits = bits;
+			sf->porder = p;
+			sf->method = kmax > 14;
+			memcpy(sf->k, k, sizeof(int) << p);
+		}
+		for (j=0; p && j<(1 << (p - 1)); j++) {
+			sums[j] = sums[2 * j] + sums[2 * j + 1];
+		}
+	}
+}
+
+/* fixed polynomial predictors
+ */
+
+static int fixed_best_order(const int32_t *x, int n)
+{
+	int64_t e[MAX_FIXED_ORDER + 1] = {0};
+	int i, order = 0;
+
+	if (n <= MAX_FIXED_ORDER) {
+		return 0;
+	}
+	for (i=MAX_FIXED_ORDER; i<n; i++) {
+		int64_t d0 = x[i];
+		int64_t d1 = d0 - x[i - 1];
+		int64_t d2 = d1 - (x[i - 1] - x[i - 2]);
+		int64_t d3 = d2 - (x[i - 1] - 2 * (int64_t)x[i - 2] + x[i - 3]);
+		int64_t d4 = d3 - (x[i - 1] - 3 * (int64_t)x[i - 2] + 3 * (int64_t)x[i - 3] - x[i - 4]);
+		e[0] += llabs(d0);
+		e[1] += llabs(d1);
+		e[2] += llabs(d2);
+		e[3] += llabs(d3);
+		e[4] += llabs(d4);
+	}
+	for (i=1; i<=MAX_FIXED_ORDER; i++) {
+		if (e[i] < e[order]) {
+			order = i;
+		}
+	}
+	return order;
+}
+
+static void fixed_residual(const int32_t *x, int n, int order, int32_t *res)
+{
+	int i;
+	res -= order;
+	switch (order) {
+	case 0: for (i=order; i<n; i++) res[i] = x[i]; break;
+	case 1: for (i=order; i<n; i++) res[i] = x[i] - x[i - 1]; break;
+	case 2: for (i=order; i<n; i++) res[i] = x[i] - 2 * x[i - 1] + x[i - 2]; break;
+	case 3: for (i=order; i<n; i++) res[i] = x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3]; break;
+	default: for (i=order; i<n; i++) res[i] = x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4]; break;
+	}
+}
+
+/* linear prediction
+ */
+
+static int lpc_order(double *xw, const int32_t *x, int n, int maxorder, double lpc[MAX_LPC_ORDER][MAX_LPC_ORDER], int precision)
+{
+	double ac[MAX_LPC_ORDER + 1], a[MAX_LPC_ORDER], err, best_bits = 0;
+	const double *w = tukey;
+	double wbuf[FLAC_BLOCKSIZE];
+	int i, j, order, best = 0;
+
+	if (n != FLAC_BLOCKSIZE) {
+		window(wbuf, n);
+		w = wbuf;
+	}
+	for (i=0; i<n; i++) {
+		xw[i] = x[i] * w[i];
+	}
+	/* four partial sums per lag keep the adds independent
+	 */
+	for (j=0; j<=maxorder; j++) {
+		double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+		for (i=j; i+3<n; i+=4) {
+			s0 += xw[i] * xw[i - j];
+			s1 += xw[i + 1] * xw[i + 1 - j];
+			s2 += xw[i + 2] * xw[i + 2 - j];
+			s3 += xw[i + 3] * xw[i + 3 - j];
+		}
+		for (; i<n; i++) {
+			s0 += xw[i] * xw[i - j];
+		}
+		ac[j] = (s0 + s1) + (s2 + s3);
+	}
+	if (ac[0] <= 0) {
+		return 0;
+	}
+	ac[0] *= 1.0 + 1e-10; /* keep it positive definite */
+
+	/* levinson-durbin, lpc[order - 1] predicts x[i] from x[i - 1 - j]
+	 */
+	err = ac[0];
+	for (order=1; order<=maxorder; order++) {
+		double r = -ac[order], bits;
+		for (j=0; j<order-1; j++) {
+			r -= a[j] * ac[order - 1 - j];
+		}
+		r /= err;
+		a[order - 1] = r;
+		for (j=0; j<(order-1)/2; j++) {
+			double t = a[j];
+			a[j] += r * a[order - 2 - j];
+			a[order - 2 - j] += r * t;
+		}
+		if ((order - 1) & 1) {
+			a[j] += a[j] * r;
+		}
+		err *= 1.0 - r * r;
+		for (j=0; j<order; j++) {
+			lpc[order - 1][j] = -a[j];
+		}
+		if (err <= 0) {
+			break;
+		}
+		bits = 0.5 * log2(0.5 * err / n);
+		bits = (bits > 0 ? bits : 0) * (n - order) + order * precision;
+		if (!best || bits < best_bits) {
+			best = order;
+			best_bits = bits;
+		}
+	}
+	return best;
+}
+
+static int quantize(const double *lpc, int order, int precision, int32_t *qlp, int *shiftp)
+{
+	int qmax = (1 << (precision - 1)) - 1, qmin = -qmax - 1;
+	double cmax = 0, error = 0;
+	int i, log2cmax, shift;
+
+	for (i=0; i<order; i++) {
+		if (fabs(lpc[i]) > cmax) {
+			cmax = fabs(lpc[i]);
+		}
+	}
+	if (cmax <= 0) {
+		return -1;
+	}
+	frexp(cmax, &log2cmax);
+	shift = precision - 1 - log2cmax;
+	if (shift > 15) {
+		shift = 15;
+	} else if (shift < 0) {
+		return -1;
+	}
+	for (i=0; i<order; i++) {
+		long q;
+		error += lpc[i] * (1 << shift);
+		q = lround(error);
+		q = q > qmax ? qmax : q < qmin ? qmin : q;
+		error -= q;
+		qlp[i] = q;
+	}
+	*shiftp = shift;
+	return 0;
+}
+
+/* precision is capped so that bps + precision + log2(order) <= 32, the
+ * prediction fits 32 bits and is accumulated a coefficient at a time
+ * over the whole block
+ */
+static void lpc_residual(const int32_t *x, int n, const int32_t *qlp, int order, int shift, int32_t *res)
+{
+	int32_t *sum = res;
+	int i, j;
+
+	for (i=order; i<n; i++) {
+		sum[i - order] = 0;
+	}
+	for (j=0; j<order; j++) {
+		int32_t q = qlp[j];
+		const int32_t *xj = x + order - 1 - j;
+		for (i=0; i<n-order; i++) {
+			sum[i] += q * xj[i];
+		}
+	}
+	for (i=0; i<n-order; i++) {
+		res[i] = x[i + order] - (sum[i] >> shift);
+	}
+}
+
+static int ilog2_ceil(int v)
+{
+	int l = 0;
+	while ((1 << l) < v) {
+		l++;
+	}
+	return l;
+}
+
+/* pick the cheapest of constant, fixed, lpc and verbatim, leaving the
+ * residual of the choice in sf->residual
+ */
+static void analyze(struct scratch *sc, const int32_t *x, int n, int bps, int32_t *res, int32_t *tmp, struct subframe *sf)
+{
+	double lpc[MAX_LPC_ORDER][MAX_LPC_ORDER];
+	struct subframe cand[1];
+	int i, order, precision;
+
+	memset(sf, 0, sizeof(*sf));
+	sf->x = x;
+	sf->bps = bps;
+
+	for (i=1; i<n && x[i] == x[0]; i++);
+	if (i == n) {
+		sf->type = SUB_CONSTANT;
+		sf->bits = 8 + bps;
+		return;
+	}
+
+	sf->type = SUB_FIXED;
+	sf->order = fixed_best_order(x, n);
+	sf->residual = res;
+	fixed_residual(x, n, sf->order, res);
+	rice_search(sf, n);
+	sf->bits += 8 + sf->order * bps;
+
+	/* qlp precision as libFLAC picks it for 16-bit input, kept low
+	 * enough for 32-bit decoder arithmetic
+	 */
+	precision = n <= 192 ? 7 : n <= 384 ? 8 : n <= 576 ? 9 : n <= 1152 ? 10 : n <= 2304 ? 11 : 12;
+
+	if (n > 32 && (order = lpc_order(sc->xw, x, n, MAX_LPC_ORDER < n - 1 ? MAX_LPC_ORDER : n - 1, lpc, precision)) > 0) {
+		int p = precision;
+		if (bps + p + ilog2_ceil(order) > 32) {
+			p = 32 - bps - ilog2_ceil(order);
+		}
+		*cand = *sf;
+		cand->type = SUB_LPC;
+		cand->order = order;
+		cand->precision = p;
+		cand->residual = tmp;
+		if (quantize(lpc[order - 1], order, p, cand->qlp, &cand->shift) == 0) {
+			lpc_residual(x, n, cand->qlp, order, cand->shift, tmp);
+			rice_search(cand, n);
+			cand->bits += 8 + order * bps + 4 + 5 + order * p;
+			if (cand->bits < sf->bits) {
+				*sf = *cand;
+			}
+		}
+	}
+
+	if (sf->bits >= 8 + (int64_t)n * bps) {
+		sf->type = SUB_VERBATIM;
+		sf->bits = 8 + (int64_t)n * bps;
+	}
+}
+
+static void write_subframe(struct bitwriter *bw, const struct subframe *sf, int n)
+{
+	int i, j;
+
+	switch (sf->type) {
+	case SUB_CONSTANT:
+		bw_put(bw, 0x00, 8);
+		bw_put(bw, sf->x[0], sf->bps);
+		return;
+	case SUB_VERBATIM:
+		bw_put(bw, 0x02, 8);
+		for (i=0; i<n; i++) {
+			bw_put(bw, sf->x[i], sf->bps);
+		}
+		return;
+	case SUB_FIXED:
+		bw_put(bw, (0x08 | sf->order) << 1, 8);
+		for (i=0; i<sf->order; i++) {
+			bw_put(bw, sf->x[i], sf->bps);
+		}
+		break;
+	default:
+		bw_put(bw, (0x20 | (sf->order - 1)) << 1, 8);
+		for (i=0; i<sf->order; i++) {
+			bw_put(bw, sf->x[i], sf->bps);
+		}
+		bw_put(bw, sf->precision - 1, 4);
+		bw_put(bw, sf->shift, 5);
+		for (i=0; i<sf->order; i++) {
+			bw_put(bw, sf->qlp[i], sf->precision);
+		}
+		break;
+	}
+
+	bw_put(bw, sf->method, 2);
+	bw_put(bw, sf->porder, 4);
+	for (j=0; j<(1 << sf->porder); j++) {
+		int ps = n >> sf->porder;
+		int start = j ? j * ps - sf->order : 0;
+		int end = (j + 1) * ps - sf->order;
+		int k = sf->k[j];
+		bw_put(bw, k, sf->method ? 5 : 4);
+		for (i=start; i<end; i++) {
+			bw_rice(bw, zigzag(sf->residual[i]), k);
+		}
+	}
+}
+
+static void put_utf8(struct bitwriter *bw, uint64_t v)
+{
+	int bytes, i;
+	if (v < 0x80) {
+		bw_put(bw, v, 8);
+		return;
+	}
+	for (bytes=2; bytes<7 && v >= (1ULL << (5 * bytes + 1)); bytes++);
+	bw_put(bw, ((0xff00 >> bytes) & 0xff) | (uint32_t)(v >> (6 * (bytes - 1))), 8);
+	for (i=bytes-2; i>=0; i--) {
+		bw_put(bw, 0x80 | ((v >> (6 * i)) & 0x3f), 8);
+	}
+}
+
+static void encode_frame(struct flac *fl, struct scratch *sc, struct frame *fr)
+{
+	struct subframe sf[4];
+	struct bitwriter bw[1] = {{.p = fr->out}};
+	int n = fr->n, assignment, i, c;
+	uint8_t crc8 = 0;
+	uint16_t crc16 = 0;
+	int a, b;
+
+	if (fl->channels == 1) {
+		for (i=0; i<n; i++) {
+			sc->ch[0][i] = fr->samples[i];
+		}
+		analyze(sc, sc->ch[0], n, BPS, sc->res[0][0], sc->res[0][1], sf);
+		assignment = 0;
+		a = 0;
+		b = -1;
+	} else {
+		/* pick the cheapest of left/right, left/side, right/side and
+		 * mid/side from the four analyses
+		 */
+		static const int pairs[4][3] = {{1, 0, 1}, {8, 0, 3}, {9, 3, 1}, {10, 2, 3}};
+		int64_t best = -1;
+		for (i=0; i<n; i++) {
+			int32_t l = fr->samples[2 * i], r = fr->samples[2 * i + 1];
+			sc->ch[0][i] = l;
+			sc->ch[1][i] = r;
+			sc->ch[2][i] = (l + r) >> 1;
+			sc->ch[3][i] = l - r;
+		}
+		for (c=0; c<4; c++) {
+			analyze(sc, sc->ch[c], n, c == 3 ? BPS + 1 : BPS, sc->res[c][0], sc->res[c][1], sf + c);
+		}
+		assignment = a = b = 0;
+		for (i=0; i<4; i++) {
+			int64_t bits = sf[pairs[i][1]].bits + sf[pairs[i][2]].bits;
+			if (best < 0 || bits < best) {
+				best = bits;
+				assignment = pairs[i][0];
+				a = pairs[i][1];
+				b = pairs[i][2];
+			}
+		}
+	}
+
+	bw_put(bw, 0xfff8, 16); /* sync, fixed blocksize */
+	bw_put(bw, n == FLAC_BLOCKSIZE ? 12 : n <= 256 ? 6 : 7, 4);
+	bw_put(bw, 0, 4); /* sample rate from STREAMINFO */
+	bw_put(bw, assignment, 4);
+	bw_put(bw, 4, 3); /* 16 bits per sample */
+	bw_put(bw, 0, 1);
+	put_utf8(bw, fr->number);
+	if (n != FLAC_BLOCKSIZE) {
+		bw_put(bw, n - 1, n <= 256 ? 8 : 16);
+	}
+	bw_flush(bw);
+	for (i=0; i<bw->p - fr->out; i++) {
+		crc8 = crc8_table[crc8 ^ fr->out[i]];
+	}
+	bw_put(bw, crc8, 8);
+
+	write_subframe(bw, sf + a, n);
+	if (b >= 0) {
+		write_subframe(bw, sf + b, n);
+	}
+	bw_align(bw);
+
+	fr->len = bw->p - fr->out;
+	for (i=0; i<fr->len; i++) {
+		crc16 = (crc16 << 8) ^ crc16_table[(crc16 >> 8) ^ fr->out[i]];
+	}
+	fr->out[fr->len++] = crc16 >> 8;
+	fr->out[fr->len++] = crc16;
+	assert(fr->len <= FRAME_BYTES);
+}
+
+/* thread pool, one batch in flight while the caller fills the other
+ */
+
+static void *worker_main(void *arg)
+{
+	struct flac *fl = arg;
+	struct scratch *sc = malloc(sizeof(struct scratch));
+
+	assert(sc);
+	pthread_mutex_lock(&fl->lock);
+	for (;;) {
+		struct batch *b;
+		int i;
+		while (!fl->quit && (!fl->work || fl->work->next == fl->work->count)) {
+			pthread_cond_wait(&fl->wake, &fl->lock);
+		}
+		if (fl->quit) {
+			break;
+		}
+		b = fl->work;
+		i = b->next++;
+		pthread_mutex_unlock(&fl->lock);
+
+		encode_frame(fl, sc, b->frames + i);
+
+		pthread_mutex_lock(&fl->lock);
+		if (++b->done == b->count) {
+			pthread_cond_broadcast(&fl->finished);
+		}
+	}
+	pthread_mutex_unlock(&fl->lock);
+	free(sc);
+	return NULL;
+}
+
+static int write_all(int fd, const void *buf, int64_t len)
+{
+	int64_t wrote = 0;
+	while (wrote < len) {
+		ssize_t i = write(fd, (const char*)buf + wrote, len - wrote);
+		if (i <= 0) {
+			if (i < 0 && errno == EINTR) continue;
+			return -1;
+		}
+		wrote += i;
+	}
+	return 0;
+}
+
+static void put_be(unsigned char *p, uint64_t v, int bytes)
+{
+	while (bytes--) {
+		p[bytes] = v;
+		v >>= 8;
+	}
+}
+
+static void finish_batch(struct flac *fl, struct batch *b)
+{
+	int i;
+
+	if (!b->busy) {
+		return;
+	}
+	pthread_mutex_lock(&fl->lock);
+	while (b->done < b->count) {
+		pthread_cond_wait(&fl->finished, &fl->lock);
+	}
+	if (fl->work == b) {
+		fl->work = NULL;
+	}
+	pthread_mutex_unlock(&fl->lock);
+
+	for (i=0; i<b->count; i++) {
+		struct frame *fr = b->frames + i;
+		if (fr->number % fl->seek_stride == 0 && fr->number / fl->seek_stride < fl->seek_points) {
+			unsigned char *pt = fl->seektable + 18 * (fr->number / fl->seek_stride);
+			put_be(pt, fr->number * FLAC_BLOCKSIZE, 8);
+			put_be(pt + 8, fl->bytes, 8);
+			put_be(pt + 16, fr->n, 2);
+		}
+		if (!fl->error && write_all(fl->fd, fr->out, fr->len)) {
+			LOG(D0_ERROR, "error: flac write failed, errno=%i", errno);
+			fl->error = 1;
+		}
+		fl->bytes += fr->len;
+		if (!fl->min_frame || fr->len < fl->min_frame) {
+			fl->min_frame = fr->len;
+		}
+		if (fr->len > fl->max_frame) {
+			fl->max_frame = fr->len;
+		}
+	}
+	b->busy = 0;
+	b->count = 0;
+}
+
+static void submit(struct flac *fl)
+{
+	struct batch *b = fl->batch + fl->cur;
+
+	finish_batch(fl, fl->batch + (fl->cur ^ 1));
+	if (b->count == 0) {
+		return;
+	}
+	pthread_mutex_lock(&fl->lock);
+	b->next = 0;
+	b->done = 0;
+	b->busy = 1;
+	fl->work = b;
+	pthread_cond_broadcast(&fl->wake);
+	pthread_mutex_unlock(&fl->lock);
+	fl->cur ^= 1;
+}
+
+static void streaminfo(struct flac *fl, unsigned char *p)
+{
+	unsigned char md5[HASH_MAX_DIGEST];
+
+	put_be(p, FLAC_BLOCKSIZE, 2);
+	put_be(p + 2, FLAC_BLOCKSIZE, 2);
+	put_be(p + 4, fl->min_frame, 3);
+	put_be(p + 7, fl->max_frame, 3);
+	put_be(p + 10, (uint64_t)fl->rate << 44 | (uint64_t)(fl->channels - 1) << 41 | (uint64_t)(BPS - 1) << 36 | (fl->samples & 0xfffffffffULL), 8);
+	if (fl->base >= 0 && fl->frames) {
+		hash_final(fl->md5, md5);
+		memcpy(p + 18, md5, 16);
+	} else {
+		memset(p + 18, 0, 16); /* unknown */
+	}
+}
+
+struct flac *flac_open(int fd, int channels, int rate, int64_t total_samples, int threads)
+{
+	struct flac *fl = calloc(1, sizeof(struct flac));
+	unsigned char head[SEEKTABLE_OFFSET];
+	int i, j;
+
+	assert(fl);
+	assert(channels == 1 || channels == 2);
+	pthread_once(&tables_once, init_once);
+
+	fl->fd = fd;
+	fl->channels = channels;
+	fl->rate = rate;
+	fl->base = lseek(fd, 0, SEEK_CUR);
+	hash_init(fl->md5, HASH_MD5);
+
+	/* a seek point every SEEK_SECONDS, placeholders are left for the
+	 * points a shorter stream never reaches
+	 */
+	fl->seek_stride = (int64_t)rate * SEEK_SECONDS / FLAC_BLOCKSIZE;
+	if (fl->seek_stride < 1) {
+		fl->seek_stride = 1;
+	}
+	if (fl->base >= 0 && total_samples > 0) {
+		int64_t frames = (total_samples + FLAC_BLOCKSIZE - 1) / FLAC_BLOCKSIZE;
+		fl->seek_points = (frames + fl->seek_stride - 1) / fl->seek_stride;
+		fl->seektable = malloc(18 * fl->seek_points);
+		assert(fl->seektable);
+		for (i=0; i<fl->seek_points; i++) {
+			memset(fl->seektable + 18 * i, 0xff, 8);
+			memset(fl->seektable + 18 * i + 8, 0, 10);
+		}
+	}
+
+	memcpy(head, "fLaC", 4);
+	head[4] = fl->seek_points ? 0x00 : 0x80; /* STREAMINFO, last block */
+	put_be(head + 5, 34, 3);
+	fl->samples = total_samples > 0 ? total_samples : 0;
+	streaminfo(fl, head + STREAMINFO_OFFSET);
+	fl->samples = 0;
+	head[SEEKTABLE_OFFSET - 4] = 0x80 | 3;
+	put_be(head + SEEKTABLE_OFFSET - 3, 18 * fl->seek_points, 3);
+	if (write_all(fd, head, fl->seek_points ? SEEKTABLE_OFFSET : SEEKTABLE_OFFSET - 4)
+	    || (fl->seek_points && write_all(fd, fl->seektable, 18 * fl->seek_points))) {
+		LOG(D0_ERROR, "error: flac write failed, errno=%i", errno);
+		fl->error = 1;
+	}
+
+	for (i=0; i<2; i++) {
+		fl->batch[i].frames = calloc(BATCH_FRAMES, sizeof(struct frame));
+		assert(fl->batch[i].frames);
+		for (j=0; j<BATCH_FRAMES; j++) {
+			fl->batch[i].frames[j].out = malloc(FRAME_BYTES);
+			assert(fl->batch[i].frames[j].out);
+		}
+	}
+
+	pthread_mutex_init(&fl->lock, NULL);
+	pthread_cond_init(&fl->wake, NULL);
+	pthread_cond_init(&fl->finished, NULL);
+	fl->nthreads = threads > 0 ? threads : 1;
+	fl->threads = calloc(fl->nthreads, sizeof(pthread_t));
+	assert(fl->threads);
+	for (i=0; i<fl->nthreads; i++) {
+		assert(pthread_create(fl->threads + i, NULL, worker_main, fl) == 0);
+	}
+
+	return fl;
+}
+
+void flac_write(struct flac *fl, const int16_t *samples, int n)
+{
+	int ch = fl->channels;
+
+	hash_update(fl->md5, samples, n * sizeof(int16_t));
+
+	while (n > 0) {
+		struct batch *b = fl->batch + fl->cur;
+		struct frame *fr = b->frames + b->count;
+		int take = (FLAC_BLOCKSIZE - fr->n) * ch;
+
+		if (take > n) {
+			take = n;
+		}
+		memcpy(fr->samples + fr->n * ch, samples, take * sizeof(int16_t));
+		fr->n += take / ch;
+		fl->samples += take / ch;
+		samples += take;
+		n -= take;
+
+		if (fr->n == FLAC_BLOCKSIZE) {
+			fr->number = fl->frames++;
+			if (++b->count == BATCH_FRAMES) {
+				submit(fl);
+				fl->batch[fl->cur].frames[0].n = 0;
+			} else {
+				b->frames[b->count].n = 0;
+			}
+		}
+	}
+}
+
+int64_t flac_close(struct flac *fl)
+{
+	struct batch *b = fl->batch + fl->cur;
+	int64_t ret;
+	int i, j;
+
+	if (b->count < BATCH_FRAMES && b->frames[b->count].n) {
+		b->frames[b->count].number = fl->frames++;
+		b->count++;
+	}
+	submit(fl);
+	finish_batch(fl, fl->batch);
+	finish_batch(fl, fl->batch + 1);
+
+	pthread_mutex_lock(&fl->lock);
+	fl->quit = 1;
+	pthread_cond_broadcast(&fl->wake);
+	pthread_mutex_unlock(&fl->lock);
+	for (i=0; i<fl->nthreads; i++) {
+		pthread_join(fl->threads[i], NULL);
+	}
+
+	/* sizes, total samples, MD5 and seek offsets are known now
+	 */
+	if (fl->base >= 0 && !fl->error) {
+		unsigned char info[34];
+		streaminfo(fl, info);
+		if (pwrite(fl->fd, info, 34, fl->base + STREAMINFO_OFFSET) != 34
+		    || (fl->seek_points && pwrite(fl->fd, fl->seektable, 18 * fl->seek_points, fl->base + SEEKTABLE_OFFSET) != 18 * fl->seek_points)) {
+			LOG(D0_ERROR, "error: flac header update failed, errno=%i", errno);
+			fl->error = 1;
+		}
+	}
+
+	ret = fl->error ? -1 : (fl->seek_points ? SEEKTABLE_OFFSET + 18 * fl->seek_points : SEEKTABLE_OFFSET - 4) + fl->bytes;
+
+	for (i=0; i<2; i++) {
+		for (j=0; j<BATCH_FRAMES; j++) {
+			free(fl->batch[i].frames[j].out);
+		}
+		free(fl->batch[i].frames);
+	}
+	pthread_mutex_destroy(&fl->lock);
+	pthread_cond_destroy(&fl->wake);
+	pthread_cond_destroy(&fl->finished);
+	free(fl->threads);
+	free(fl->seektable);
+	free(fl);
+	return ret;
+}
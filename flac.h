@@ -0,0 +1,39 @@
+#ifndef h2ws9dq6v1pe5zr8la /* flac-h */
+#define h2ws9dq6v1pe5zr8la /* flac-h */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" { /* assume C declarations for C++ */
+#endif
+
+/* native flac writer for 16-bit pcm, one fixed size frame per ADPCM
+ * packet, frames encoded by a pool of threads (fixed and LPC
+ * prediction, partitioned rice residuals) and written in order, with
+ * a SEEKTABLE and the STREAMINFO MD5 filled in when the output can seek
+ */
+
+#define FLAC_BLOCKSIZE 4096 /* ADPCM_PACKET_SAMPLES */
+
+struct flac;
+
+/* total_samples (per channel) sizes the seektable, it is corrected at
+ * close if the stream turns out shorter or longer
+ */
+struct flac *flac_open(int fd, int channels, int rate, int64_t total_samples, int threads);
+
+/* n interleaved samples, frames are cut every FLAC_BLOCKSIZE samples
+ * per channel whatever the call sizes
+ */
+void flac_write(struct flac *fl, const int16_t *samples, int n);
+
+/* flushes, patches the headers and frees fl, returns bytes written or
+ * -1 on write errors
+ */
+int64_t flac_close(struct flac *fl);
+
+#ifdef __cplusplus
+}; /* end of function prototypes */
+#endif
+
+#endif /* ! h2ws9dq6v1pe5zr8la flac-h */
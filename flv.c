@@ -0,0 +1,141 @@
+/*
+
+Copyright (c) 2012, Alexandre Girao <alexgirao@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "debug0.h"
+#include "str.h"
+#include "flv.h"
+
+static uint32_t be24(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+}
+
+static uint32_t be32(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | be24(p + 1);
+}
+
+static int skip(FILE *f, int64_t len)
+{
+	char buf[4096];
+	while (len > 0) {
+		size_t n = fread(buf, 1, len > sizeof(buf) ? sizeof(buf) : len, f);
+		if (n == 0) {
+			return -1;
+		}
+		len -= n;
+	}
+	return 0;
+}
+
+int flv_open(struct flv *flv, FILE *f)
+{
+	unsigned char h[9];
+	uint32_t data_offset;
+
+	memset(flv, 0, sizeof(*flv));
+	flv->f = f;
+
+	if (fread(h, 1, 9, f) != 9 || memcmp(h, "FLV", 3) != 0) {
+		return -1;
+	}
+	data_offset = be32(h + 5);
+	if (data_offset < 9 || skip(f, data_offset - 9 + 4)) { /* PreviousTagSize0 too */
+		return -1;
+	}
+	flv->offset = data_offset + 4;
+	return 0;
+}
+
+int flv_next_audio(struct flv *flv, struct flv_audio *a)
+{
+	static const int rates[4] = {5512, 11025, 22050, 44100};
+	unsigned char h[11];
+
+	for (;;) {
+		uint32_t size;
+		size_t n;
+
+		if ((n = fread(h, 1, 11, flv->f)) != 11) {
+			if (n != 0) {
+				LOG(D0_WARN, "flv stream ends inside a tag header at %lld", (long long)flv->offset);
+			}
+			return 0;
+		}
+		if (h[0] & 0x20) { /* Filter, encrypted or preprocessed */
+			LOG(D0_ERROR, "error: encrypted flv tag at %lld", (long long)flv->offset);
+			return -1;
+		}
+		size = be24(h + 1);
+
+		if ((h[0] & 0x1f) != FLV_TAG_AUDIO || size == 0) {
+			if (skip(flv->f, size + 4)) {
+				LOG(D0_WARN, "flv stream ends inside a tag at %lld", (long long)flv->offset);
+				return 0;
+			}
+			flv->offset += 11 + size + 4;
+			continue;
+		}
+
+		/* only one tag body is held, its size is bounded by UI24
+		 */
+		str_alloc(flv->body, size + 4);
+		if (fread(flv->body->s, 1, size + 4, flv->f) != size + 4) {
+			LOG(D0_WARN, "flv stream ends inside an audio tag at %lld", (long long)flv->offset);
+			return 0;
+		}
+		flv->body->len = size;
+		if (be32((unsigned char*)flv->body->s + size) != 11 + size) {
+			LOG(D0_WARN, "flv PreviousTagSize mismatch at %lld", (long long)flv->offset);
+		}
+		flv->offset += 11 + size + 4;
+
+		a->format = (unsigned char)flv->body->s[0] >> 4;
+		a->rate = rates[(flv->body->s[0] >> 2) & 3];
+		a->bits = flv->body->s[0] & 2 ? 16 : 8;
+		a->channels = flv->body->s[0] & 1 ? 2 : 1;
+		a->timestamp = be24(h + 4) | (uint32_t)h[7] << 24;
+		a->data = (unsigned char*)flv->body->s + 1;
+		a->len = size - 1;
+		return 1;
+	}
+}
+
+void flv_free(struct flv *flv)
+{
+	str_free(flv->body);
+}
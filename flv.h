@@ -0,0 +1,64 @@
+#ifndef x4jd9ru2c7bn5ks0hy /* flv-h */
+#define x4jd9ru2c7bn5ks0hy /* flv-h */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "str.h"
+
+#ifdef __cplusplus
+extern "C" { /* assume C declarations for C++ */
+#endif
+
+/* FLV (Video File Format Specification Version 10)
+ *
+ *   header: "FLV", UI8 Version, UI8 flags, UI32 DataOffset
+ *   UI32 PreviousTagSize0, then repeated: FLVTAG, UI32 PreviousTagSize
+ *
+ *   FLVTAG: UI8 TagType (8 audio, 9 video, 18 script), UI24 DataSize,
+ *   UI24 Timestamp, UI8 TimestampExtended, UI24 StreamID, Data
+ *
+ *   audio Data: UB[4] SoundFormat, UB[2] SoundRate, UB[1] SoundSize,
+ *   UB[1] SoundType, SoundData; for SoundFormat 1 every SoundData is
+ *   an ADPCMSOUNDDATA of its own, code size first
+ *
+ * multi-byte fields are big endian
+ */
+
+#define FLV_TAG_AUDIO 8
+#define FLV_SOUND_ADPCM 1
+
+struct flv {
+	FILE *f;
+	int64_t offset; /* of the next tag */
+	struct str body[1]; /* the current audio tag, at most 16M */
+};
+
+struct flv_audio {
+	int format;
+	int rate;
+	int bits;
+	int channels;
+	uint32_t timestamp; /* ms */
+	const unsigned char *data; /* SoundData */
+	int len;
+};
+
+/* reads and checks the header, tags are then pulled from f as they
+ * arrive so pipes and growing captures work, returns -1 if f is not flv
+ */
+int flv_open(struct flv *flv, FILE *f);
+
+/* returns 1 with the next audio tag, 0 at the end of the stream (a tag
+ * cut short by it is logged and dropped), -1 on a malformed stream;
+ * other tags are skipped without being kept
+ */
+int flv_next_audio(struct flv *flv, struct flv_audio *a);
+
+void flv_free(struct flv *flv);
+
+#ifdef __cplusplus
+}; /* end of function prototypes */
+#endif
+
+#endif /* ! x4jd9ru2c7bn5ks0hy flv-h */
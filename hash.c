@@ -0,0 +1,588 @@
+/*
+
+Copyright (c) 2012, Alexandre Girao <alexgirao@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+ * reference: https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+ * reference: FIPS 180-4 (SHA-256)
+ * reference: RFC 1321 (MD5)
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "hash.h"
+
+static const char *names[HASH_COUNT] = {"xxh3", "sha256", "md5"};
+
+int hash_from_name(const char *name)
+{
+	int i;
+	for (i=0; i<HASH_COUNT; i++) {
+		if (strcmp(names[i], name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+const char *hash_name(int algo)
+{
+	assert(algo >= 0 && algo < HASH_COUNT);
+	return names[algo];
+}
+
+static uint64_t read64(const unsigned char *p)
+{
+	return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+		(uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+static uint32_t read32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* XXH3 64-bit
+ */
+
+#define PRIME32_1 0x9E3779B1U
+#define PRIME32_2 0x85EBCA77U
+#define PRIME32_3 0xC2B2AE3DU
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+#define PRIME_MX1 0x165667919E3779F9ULL
+#define PRIME_MX2 0x9FB21C651E98DF25ULL
+
+#define SECRET_SIZE 192
+#define STRIPE_LEN 64
+#define STRIPES_PER_BLOCK ((SECRET_SIZE - STRIPE_LEN) / 8)
+
+static const unsigned char secret[SECRET_SIZE] = {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t mul128_fold64(uint64_t a, uint64_t b)
+{
+	unsigned __int128 p = (unsigned __int128)a * b;
+	return (uint64_t)p ^ (uint64_t)(p >> 64);
+}
+
+static uint64_t xxh64_avalanche(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+static uint64_t xxh3_avalanche(uint64_t h)
+{
+	h ^= h >> 37;
+	h *= PRIME_MX1;
+	h ^= h >> 32;
+	return h;
+}
+
+static uint64_t rrmxmx(uint64_t h, uint64_t len)
+{
+	h ^= rotl64(h, 49) ^ rotl64(h, 24);
+	h *= PRIME_MX2;
+	h ^= (h >> 35) + len;
+	h *= PRIME_MX2;
+	h ^= h >> 28;
+	return h;
+}
+
+static uint64_t mix16(const unsigned char *in, const unsigned char *sec)
+{
+	return mul128_fold64(read64(in) ^ read64(sec), read64(in + 8) ^ read64(sec + 8));
+}
+
+/* inputs up to 240 bytes
+ */
+static uint64_t xxh3_short(const unsigned char *in, uint64_t len)
+{
+	uint64_t acc;
+	int i;
+
+	if (len == 0) {
+		return xxh64_avalanche(read64(secret + 56) ^ read64(secret + 64));
+	}
+	if (len <= 3) {
+		uint32_t combined = ((uint32_t)in[0] << 16) | ((uint32_t)in[len >> 1] << 24) | in[len - 1] | ((uint32_t)len << 8);
+		return xxh64_avalanche(combined ^ (uint64_t)(read32(secret) ^ read32(secret + 4)));
+	}
+	if (len <= 8) {
+		uint64_t in64 = read32(in + len - 4) + ((uint64_t)read32(in) << 32);
+		return rrmxmx(in64 ^ (read64(secret + 8) ^ read64(secret + 16)), len);
+	}
+	if (len <= 16) {
+		uint64_t lo = read64(in) ^ (read64(secret + 24) ^ read64(secret + 32));
+		uint64_t hi = read64(in + len - 8) ^ (read64(secret + 40) ^ read64(secret + 48));
+		acc = len + __builtin_bswap64(lo) + hi + mul128_fold64(lo, hi);
+		return xxh3_avalanche(acc);
+	}
+	acc = len * PRIME64_1;
+	if (len <= 128) {
+		if (len > 32) {
+			if (len > 64) {
+				if (len > 96) {
+					acc += mix16(in + 48, secret + 96);
+					acc += mix16(in + len - 64, secret + 112);
+				}
+				acc += mix16(in + 32, secret + 64);
+				acc += mix16(in + len - 48, secret + 80);
+			}
+			acc += mix16(in + 16, secret + 32);
+			acc += mix16(in + len - 32, secret + 48);
+		}
+		acc += mix16(in, secret);
+		acc += mix16(in + len - 16, secret + 16);
+		return xxh3_avalanche(acc);
+	}
+	for (i=0; i<8; i++) {
+		acc += mix16(in + 16 * i, secret + 16 * i);
+	}
+	acc = xxh3_avalanche(acc);
+	for (i=8; i<(int)(len / 16); i++) {
+		acc += mix16(in + 16 * i, secret + 16 * (i - 8) + 3);
+	}
+	acc += mix16(in + len - 16, secret + 136 - 17);
+	return xxh3_avalanche(acc);
+}
+
+static void accumulate_512(uint64_t *acc, const unsigned char *in, const unsigned char *sec)
+{
+	int i;
+	for (i=0; i<8; i++) {
+		uint64_t v = read64(in + 8 * i);
+		uint64_t k = v ^ read64(sec + 8 * i);
+		acc[i ^ 1] += v;
+		acc[i] += (k & 0xffffffff) * (k >> 32);
+	}
+}
+
+static void scramble(uint64_t *acc, const unsigned char *sec)
+{
+	int i;
+	for (i=0; i<8; i++) {
+		uint64_t a = acc[i];
+		a ^= a >> 47;
+		a ^= read64(sec + 8 * i);
+		acc[i] = a * PRIME32_1;
+	}
+}
+
+static void consume_stripes(struct xxh3_state *st, const unsigned char *in, int n)
+{
+	int i;
+	while (n) {
+		int room = STRIPES_PER_BLOCK - st->stripes;
+		int k = n < room ? n : room;
+		for (i=0; i<k; i++) {
+			accumulate_512(st->acc, in + i * STRIPE_LEN, secret + (st->stripes + i) * 8);
+		}
+		st->stripes += k;
+		in += k * STRIPE_LEN;
+		n -= k;
+		if (st->stripes == STRIPES_PER_BLOCK) {
+			scramble(st->acc, secret + SECRET_SIZE - STRIPE_LEN);
+			st->stripes = 0;
+		}
+	}
+}
+
+static void xxh3_init(struct xxh3_state *st)
+{
+	static const uint64_t init[8] = {PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1};
+	memset(st, 0, sizeof(*st));
+	memcpy(st->acc, init, sizeof(init));
+}
+
+/* the last byte is always kept in the buffer, so a completed block is
+ * only scrambled when more input follows, as in the one shot hash
+ */
+static void xxh3_update(struct xxh3_state *st, const unsigned char *in, int64_t len)
+{
+	const int bufsz = sizeof(st->buffer);
+
+	st->total += len;
+
+	if (st->buffered + len <= bufsz) {
+		memcpy(st->buffer + st->buffered, in, len);
+		st->buffered += len;
+		return;
+	}
+
+	if (st->buffered) {
+		int fill = bufsz - st->buffered;
+		memcpy(st->buffer + st->buffered, in, fill);
+		in += fill;
+		len -= fill;
+		consume_stripes(st, st->buffer, bufsz / STRIPE_LEN);
+		st->buffered = 0;
+	}
+
+	if (len > bufsz) {
+		int64_t n = (len - 1) / STRIPE_LEN;
+		consume_stripes(st, in, n);
+		in += n * STRIPE_LEN;
+		len -= n * STRIPE_LEN;
+		/* keep the previous stripe around for the final one
+		 */
+		memcpy(st->buffer + bufsz - STRIPE_LEN, in - STRIPE_LEN, STRIPE_LEN);
+	}
+
+	memcpy(st->buffer, in, len);
+	st->buffered = len;
+}
+
+static uint64_t xxh3_digest(const struct xxh3_state *st0)
+{
+	struct xxh3_state st[1];
+	unsigned char last[STRIPE_LEN];
+	const unsigned char *lastp;
+	uint64_t result;
+	int i;
+
+	if (st0->total <= 240) {
+		return xxh3_short(st0->buffer, st0->total);
+	}
+
+	*st = *st0;
+	if (st->buffered >= STRIPE_LEN) {
+		consume_stripes(st, st->buffer, (st->buffered - 1) / STRIPE_LEN);
+		lastp = st->buffer + st->buffered - STRIPE_LEN;
+	} else {
+		int catchup = STRIPE_LEN - st->buffered;
+		memcpy(last, st->buffer + sizeof(st->buffer) - catchup, catchup);
+		memcpy(last + catchup, st->buffer, st->buffered);
+		lastp = last;
+	}
+	accumulate_512(st->acc, lastp, secret + SECRET_SIZE - STRIPE_LEN - 7);
+
+	result = st->total * PRIME64_1;
+	for (i=0; i<4; i++) {
+		result += mul128_fold64(st->acc[2 * i] ^ read64(secret + 11 + 16 * i),
+					st->acc[2 * i + 1] ^ read64(secret + 11 + 16 * i + 8));
+	}
+	return xxh3_avalanche(result);
+}
+
+uint64_t hash_xxh3_64(const void *data, int64_t len)
+{
+	struct xxh3_state st[1];
+	if (len <= 240) {
+		return xxh3_short(data, len);
+	}
+	xxh3_init(st);
+	xxh3_update(st, data, len);
+	return xxh3_digest(st);
+}
+
+/* SHA-256
+ */
+
+static const uint32_t k256[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR32(x, r) (((x) >> (r)) | ((x) << (32 - (r))))
+
+static void sha256_block(uint32_t *h, const unsigned char *p)
+{
+	uint32_t w[64];
+	uint32_t a, b, c, d, e, f, g, hh;
+	int i;
+
+	for (i=0; i<16; i++) {
+		w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+	}
+	for (i=16; i<64; i++) {
+		uint32_t s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	a = h[0]; b = h[1]; c = h[2]; d = h[3];
+	e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+
+	for (i=0; i<64; i++) {
+		uint32_t t1 = hh + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) + ((e & f) ^ (~e & g)) + k256[i] + w[i];
+		uint32_t t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		hh = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+	h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+static void sha256_init(struct sha256_state *st)
+{
+	static const uint32_t init[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+	memset(st, 0, sizeof(*st));
+	memcpy(st->h, init, sizeof(init));
+}
+
+static void sha256_update(struct sha256_state *st, const unsigned char *in, int64_t len)
+{
+	st->total += len;
+	if (st->buffered) {
+		int fill = 64 - st->buffered;
+		if (len < fill) {
+			memcpy(st->buffer + st->buffered, in, len);
+			st->buffered += len;
+			return;
+		}
+		memcpy(st->buffer + st->buffered, in, fill);
+		sha256_block(st->h, st->buffer);
+		in += fill;
+		len -= fill;
+		st->buffered = 0;
+	}
+	for (; len >= 64; in += 64, len -= 64) {
+		sha256_block(st->h, in);
+	}
+	memcpy(st->buffer, in, len);
+	st->buffered = len;
+}
+
+static void sha256_digest(const struct sha256_state *st0, unsigned char *out)
+{
+	struct sha256_state st[1];
+	uint64_t bits = st0->total * 8;
+	int i;
+
+	*st = *st0;
+	st->buffer[st->buffered++] = 0x80;
+	if (st->buffered > 56) {
+		memset(st->buffer + st->buffered, 0, 64 - st->buffered);
+		sha256_block(st->h, st->buffer);
+		st->buffered = 0;
+	}
+	memset(st->buffer + st->buffered, 0, 56 - st->buffered);
+	for (i=0; i<8; i++) {
+		st->buffer[56 + i] = bits >> (56 - 8 * i);
+	}
+	sha256_block(st->h, st->buffer);
+
+	for (i=0; i<32; i++) {
+		out[i] = st->h[i >> 2] >> (24 - 8 * (i & 3));
+	}
+}
+
+/* MD5
+ */
+
+static const uint32_t k_md5[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const unsigned char r_md5[16] = {7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21};
+
+static void md5_block(uint32_t *h, const unsigned char *p)
+{
+	uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+	int i;
+
+	for (i=0; i<64; i++) {
+		uint32_t f, t;
+		int g;
+		switch (i >> 4) {
+		case 0: f = (b & c) | (~b & d); g = i; break;
+		case 1: f = (d & b) | (~d & c); g = (5 * i + 1) & 15; break;
+		case 2: f = b ^ c ^ d; g = (3 * i + 5) & 15; break;
+		default: f = c ^ (b | ~d); g = (7 * i) & 15; break;
+		}
+		t = a + f + k_md5[i] + read32(p + 4 * g);
+		a = d; d = c; c = b;
+		b += (t << r_md5[(i >> 4) * 4 + (i & 3)]) | (t >> (32 - r_md5[(i >> 4) * 4 + (i & 3)]));
+	}
+
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+}
+
+static void md5_init(struct md5_state *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->h[0] = 0x67452301;
+	st->h[1] = 0xefcdab89;
+	st->h[2] = 0x98badcfe;
+	st->h[3] = 0x10325476;
+}
+
+static void md5_update(struct md5_state *st, const unsigned char *in, int64_t len)
+{
+	st->total += len;
+	if (st->buffered) {
+		int fill = 64 - st->buffered;
+		if (len < fill) {
+			memcpy(st->buffer + st->buffered, in, len);
+			st->buffered += len;
+			return;
+		}
+		memcpy(st->buffer + st->buffered, in, fill);
+		md5_block(st->h, st->buffer);
+		in += fill;
+		len -= fill;
+		st->buffered = 0;
+	}
+	for (; len >= 64; in += 64, len -= 64) {
+		md5_block(st->h, in);
+	}
+	memcpy(st->buffer, in, len);
+	st->buffered = len;
+}
+
+static void md5_digest(const struct md5_state *st0, unsigned char *out)
+{
+	struct md5_state st[1];
+	uint64_t bits = st0->total * 8;
+	int i;
+
+	*st = *st0;
+	st->buffer[st->buffered++] = 0x80;
+	if (st->buffered > 56) {
+		memset(st->buffer + st->buffered, 0, 64 - st->buffered);
+		md5_block(st->h, st->buffer);
+		st->buffered = 0;
+	}
+	memset(st->buffer + st->buffered, 0, 56 - st->buffered);
+	for (i=0; i<8; i++) {
+		st->buffer[56 + i] = bits >> (8 * i);
+	}
+	md5_block(st->h, st->buffer);
+
+	for (i=0; i<16; i++) {
+		out[i] = st->h[i >> 2] >> (8 * (i & 3));
+	}
+}
+
+/* dispatch
+ */
+
+void hash_init(struct hash *h, int algo)
+{
+	assert(algo >= 0 && algo < HASH_COUNT);
+	h->algo = algo;
+	switch (algo) {
+	case HASH_XXH3: xxh3_init(&h->u.xxh3); break;
+	case HASH_SHA256: sha256_init(&h->u.sha256); break;
+	case HASH_MD5: md5_init(&h->u.md5); break;
+	}
+}
+
+void hash_update(struct hash *h, const void *data, int64_t len)
+{
+	switch (h->algo) {
+	case HASH_XXH3: xxh3_update(&h->u.xxh3, data, len); break;
+	case HASH_SHA256: sha256_update(&h->u.sha256, data, len); break;
+	case HASH_MD5: md5_update(&h->u.md5, data, len); break;
+	}
+}
+
+int hash_final(struct hash *h, unsigned char *digest)
+{
+	uint64_t v;
+	int i;
+
+	switch (h->algo) {
+	case HASH_XXH3:
+		v = xxh3_digest(&h->u.xxh3);
+		/* canonical form is big endian, as printed by xxhsum
+		 */
+		for (i=0; i<8; i++) {
+			digest[i] = v >> (56 - 8 * i);
+		}
+		return 8;
+	case HASH_SHA256:
+		sha256_digest(&h->u.sha256, digest);
+		return 32;
+	default:
+		md5_digest(&h->u.md5, digest);
+		return 16;
+	}
+}
+
+int hash_final_hex(struct hash *h, char *hex)
+{
+	static const char digits[] = "0123456789abcdef";
+	unsigned char digest[HASH_MAX_DIGEST];
+	int i, n = hash_final(h, digest);
+
+	for (i=0; i<n; i++) {
+		hex[2 * i] = digits[digest[i] >> 4];
+		hex[2 * i + 1] = digits[digest[i] & 15];
+	}
+	hex[2 * n] = 0;
+	return 2 * n;
+}
@@ -0,0 +1,81 @@
+#ifndef m8zt2ck5qy0fw7db3h /* hash-h */
+#define m8zt2ck5qy0fw7db3h /* hash-h */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" { /* assume C declarations for C++ */
+#endif
+
+/* streaming digests of the decoded output: XXH3 64-bit (seed 0,
+ * default secret, same value as xxhsum -H3), SHA-256 and MD5 (the
+ * flac STREAMINFO signature)
+ */
+
+enum {
+	HASH_XXH3 = 0,
+	HASH_SHA256,
+	HASH_MD5,
+	HASH_COUNT
+};
+
+#define HASH_MAX_DIGEST 32
+
+struct xxh3_state {
+	uint64_t acc[8];
+	unsigned char buffer[256];
+	int buffered;
+	int stripes; /* stripes consumed in the current block */
+	uint64_t total;
+};
+
+struct sha256_state {
+	uint32_t h[8];
+	unsigned char buffer[64];
+	int buffered;
+	uint64_t total;
+};
+
+struct md5_state {
+	uint32_t h[4];
+	unsigned char buffer[64];
+	int buffered;
+	uint64_t total;
+};
+
+struct hash {
+	int algo;
+	union {
+		struct xxh3_state xxh3;
+		struct sha256_state sha256;
+		struct md5_state md5;
+	} u;
+};
+
+/* returns -1 for unknown names (xxh3, sha256, md5)
+ */
+int hash_from_name(const char *name);
+const char *hash_name(int algo);
+
+void hash_init(struct hash *h, int algo);
+void hash_update(struct hash *h, const void *data, int64_t len);
+
+/* writes the raw digest (HASH_MAX_DIGEST bytes at most), returns its
+ * length
+ */
+int hash_final(struct hash *h, unsigned char *digest);
+
+/* writes the digest as lowercase hex (2 * HASH_MAX_DIGEST + 1 bytes
+ * at most), returns its length
+ */
+int hash_final_hex(struct hash *h, char *hex);
+
+/* one shot XXH3 64-bit, the dedup key for whole payloads
+ */
+uint64_t hash_xxh3_64(const void *data, int64_t len);
+
+#ifdef __cplusplus
+}; /* end of function prototypes */
+#endif
+
+#endif /* ! m8zt2ck5qy0fw7db3h hash-h */
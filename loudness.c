@@ -0,0 +1,334 @@
+/*
+
+Copyright (c) 2012, Alexandre Girao <alexgirao@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+ * reference: ITU-R BS.1770-4, EBU R 128, EBU Tech 3341 and 3342
+ *
+ * the biquad recursion is serial by nature, the rest (int to double
+ * conversion, peaks, the polyphase true peak filter) are plain loops
+ * over the packet that the compiler vectorizes
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "str.h"
+#include "loudness.h"
+
+#define CHUNK 1024
+#define HIST (LOUDNESS_TP_TAPS - 1)
+
+static void blocks_add(struct loudness_blocks *b, double energy)
+{
+	if (b->n == b->a) {
+		b->a = b->a ? b->a * 2 : 1024;
+		b->energy = realloc(b->energy, b->a * sizeof(double));
+		assert(b->energy);
+	}
+	b->energy[b->n++] = energy;
+}
+
+static double energy_to_lufs(double e)
+{
+	return -0.691 + 10 * log10(e);
+}
+
+void loudness_init(struct loudness *ld, int channels, int rate)
+{
+	double f0, g, q, k, vh, vb, a0;
+	int p, j;
+
+	memset(ld, 0, sizeof(*ld));
+	ld->channels = channels;
+	ld->rate = rate;
+	ld->sub_len = (rate + 5) / 10;
+
+	/* stage 1, high shelf (head effects)
+	 */
+	f0 = 1681.974450955533;
+	g = 3.999843853973347;
+	q = 0.7071752369554196;
+	k = tan(M_PI * f0 / rate);
+	vh = pow(10.0, g / 20.0);
+	vb = pow(vh, 0.4996667741545416);
+	a0 = 1.0 + k / q + k * k;
+	ld->pre.b0 = (vh + vb * k / q + k * k) / a0;
+	ld->pre.b1 = 2.0 * (k * k - vh) / a0;
+	ld->pre.b2 = (vh - vb * k / q + k * k) / a0;
+	ld->pre.a1 = 2.0 * (k * k - 1.0) / a0;
+	ld->pre.a2 = (1.0 - k / q + k * k) / a0;
+
+	/* stage 2, RLB high-pass
+	 */
+	f0 = 38.13547087602444;
+	q = 0.5003270373238773;
+	k = tan(M_PI * f0 / rate);
+	a0 = 1.0 + k / q + k * k;
+	ld->rlb.b0 = 1.0;
+	ld->rlb.b1 = -2.0;
+	ld->rlb.b2 = 1.0;
+	ld->rlb.a1 = 2.0 * (k * k - 1.0) / a0;
+	ld->rlb.a2 = (1.0 - k / q + k * k) / a0;
+
+	/* true peak: windowed sinc interpolator split in phases
+	 */
+	for (p=0; p<LOUDNESS_TP_FACTOR; p++) {
+		for (j=0; j<LOUDNESS_TP_TAPS; j++) {
+			int taps = LOUDNESS_TP_FACTOR * LOUDNESS_TP_TAPS;
+			double m = j * LOUDNESS_TP_FACTOR + p;
+			double x = (m - (taps - 1) / 2.0) / LOUDNESS_TP_FACTOR;
+			double w = 0.5 * (1.0 - cos(2.0 * M_PI * (m + 0.5) / taps));
+			ld->tp_coef[p][j] = (x == 0 ? 1.0 : sin(M_PI * x) / (M_PI * x)) * w;
+		}
+	}
+}
+
+static inline double biquad(const struct loudness_biquad *f, double *z, double x)
+{
+	/* transposed direct form II
+	 */
+	double y = f->b0 * x + z[0];
+	z[0] = f->b1 * x - f->a1 * y + z[1];
+	z[1] = f->b2 * x - f->a2 * y;
+	return y;
+}
+
+/* a 100 ms sub-block is complete
+ */
+static void sub_block_done(struct loudness *ld)
+{
+	double e = ld->sub_sum / ld->sub_len;
+	int i;
+
+	ld->sub[ld->subs % 30] = e;
+	ld->subs++;
+	ld->sub_sum = 0;
+	ld->sub_fill = 0;
+
+	if (ld->subs >= 4) {
+		double m = 0;
+		for (i=1; i<=4; i++) {
+			m += ld->sub[(ld->subs - i) % 30];
+		}
+		blocks_add(ld->momentary, m / 4);
+	}
+	if (ld->subs >= 30) {
+		double s = 0;
+		for (i=0; i<30; i++) {
+			s += ld->sub[i];
+		}
+		blocks_add(ld->short_term, s / 30);
+	}
+}
+
+void loudness_update(struct loudness *ld, const int16_t *samples, int n)
+{
+	const int channels = ld->channels;
+	const double scale = 1.0 / 32768.0;
+	double x[CHUNK];
+	float xb[HIST + CHUNK], *xf = xb + HIST;
+	int frames = n / channels;
+	int i, j, p, c, done;
+
+	/* sample peak
+	 */
+	{
+		int pk = ld->sample_peak;
+		for (i=0; i<n; i++) {
+			int v = samples[i] < 0 ? -samples[i] : samples[i];
+			pk = v > pk ? v : pk;
+		}
+		ld->sample_peak = pk;
+	}
+
+	for (done=0; done<frames; ) {
+		int span = ld->sub_len - ld->sub_fill;
+		if (span > frames - done) span = frames - done;
+		if (span > CHUNK) span = CHUNK;
+
+		for (c=0; c<channels; c++) {
+			struct loudness_channel *ch = &ld->ch[c];
+			double sum = 0;
+			float tp = ld->true_peak;
+
+			memcpy(xb, ch->tp_hist, HIST * sizeof(float));
+			for (i=0; i<span; i++) {
+				x[i] = samples[(done + i) * channels + c] * scale;
+				xf[i] = x[i];
+			}
+
+			/* true peak, xb starts with the last taps - 1 samples
+			 * of the previous span
+			 */
+			for (p=0; p<LOUDNESS_TP_FACTOR; p++) {
+				const float *k = ld->tp_coef[p];
+				i = 0;
+#ifdef __SSE2__
+				{
+					const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+					__m128 vtp = _mm_set1_ps(tp);
+					for (; i + 4 <= span; i += 4) {
+						__m128 acc = _mm_setzero_ps();
+						for (j=0; j<LOUDNESS_TP_TAPS; j++) {
+							acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(k[j]), _mm_loadu_ps(xf + i - j)));
+						}
+						vtp = _mm_max_ps(vtp, _mm_and_ps(acc, abs_mask));
+					}
+					vtp = _mm_max_ps(vtp, _mm_shuffle_ps(vtp, vtp, _MM_SHUFFLE(1, 0, 3, 2)));
+					vtp = _mm_max_ps(vtp, _mm_shuffle_ps(vtp, vtp, _MM_SHUFFLE(2, 3, 0, 1)));
+					tp = _mm_cvtss_f32(vtp);
+				}
+#endif
+				for (; i<span; i++) {
+					float y = 0;
+					for (j=0; j<LOUDNESS_TP_TAPS; j++) {
+						y += k[j] * xf[i - j];
+					}
+					y = fabsf(y);
+					tp = y > tp ? y : tp;
+				}
+			}
+			ld->true_peak = tp;
+			memcpy(ch->tp_hist, xf + span - HIST, HIST * sizeof(float));
+
+			/* K-weighting and mean square, channel weights are 1.0
+			 * for mono and stereo
+			 */
+			for (i=0; i<span; i++) {
+				double y = biquad(&ld->rlb, ch->z[1], biquad(&ld->pre, ch->z[0], x[i]));
+				sum += y * y;
+			}
+			ld->sub_sum += sum;
+		}
+
+		ld->sub_fill += span;
+		done += span;
+		if (ld->sub_fill == ld->sub_len) {
+			sub_block_done(ld);
+		}
+	}
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+/* gated mean, absolute gate at -70 LUFS and a relative gate rel_gate LU
+ * below the mean of what passed the absolute one
+ */
+static double gated(const struct loudness_blocks *b, double rel_gate, double **kept, int64_t *nkept)
+{
+	const double abs_e = pow(10.0, (-70.0 + 0.691) / 10.0);
+	double sum = 0, rel_e;
+	int64_t i, n = 0;
+
+	for (i=0; i<b->n; i++) {
+		if (b->energy[i] > abs_e) {
+			sum += b->energy[i];
+			n++;
+		}
+	}
+	if (n == 0) {
+		return -HUGE_VAL;
+	}
+	rel_e = sum / n * pow(10.0, rel_gate / 10.0);
+
+	sum = 0;
+	n = 0;
+	for (i=0; i<b->n; i++) {
+		if (b->energy[i] > abs_e && b->energy[i] > rel_e) {
+			sum += b->energy[i];
+			if (kept) {
+				(*kept)[n] = energy_to_lufs(b->energy[i]);
+			}
+			n++;
+		}
+	}
+	if (nkept) {
+		*nkept = n;
+	}
+	return n ? energy_to_lufs(sum / n) : -HUGE_VAL;
+}
+
+static void cat_db(struct str *out, const char *name, double v)
+{
+	if (isfinite(v)) {
+		str_catf(out, "\"%s\": %.2f", name, v);
+	} else {
+		str_catf(out, "\"%s\": null", name);
+	}
+}
+
+void loudness_json(struct loudness *ld, struct str *out)
+{
+	double integrated, lra = 0;
+	double *st = NULL;
+	int64_t nst = 0;
+
+	integrated = gated(ld->momentary, -10.0, NULL, NULL);
+
+	if (ld->short_term->n) {
+		st = malloc(ld->short_term->n * sizeof(double));
+		assert(st);
+		gated(ld->short_term, -20.0, &st, &nst);
+		if (nst) {
+			qsort(st, nst, sizeof(double), cmp_double);
+			lra = st[(int64_t)((nst - 1) * 0.95 + 0.5)] - st[(int64_t)((nst - 1) * 0.10 + 0.5)];
+		}
+		free(st);
+	}
+
+	cat_db(out, "integrated_lufs", integrated);
+	str_catz(out, ", ");
+	cat_db(out, "loudness_range_lu", lra);
+	str_catz(out, ", ");
+	cat_db(out, "sample_peak_dbfs", 20 * log10(ld->sample_peak / 32768.0));
+	str_catz(out, ", ");
+	cat_db(out, "true_peak_dbtp", 20 * log10(fmax(ld->true_peak, ld->sample_peak / 32768.0)));
+}
+
+void loudness_free(struct loudness *ld)
+{
+	free(ld->momentary->energy);
+	free(ld->short_term->energy);
+	memset(ld->momentary, 0, sizeof(ld->momentary));
+	memset(ld->short_term, 0, sizeof(ld->short_term));
+}
@@ -0,0 +1,73 @@
+#ifndef t6jw0a3nxy8dc5rv2m /* loudness-h */
+#define t6jw0a3nxy8dc5rv2m /* loudness-h */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "str.h"
+
+#ifdef __cplusplus
+extern "C" { /* assume C declarations for C++ */
+#endif
+
+/* EBU R128 / ITU-R BS.1770-4 measurement, fed packet by packet
+ *
+ * K-weighting (pre-filter and RLB high-pass biquads), 100 ms
+ * sub-blocks combined into 400 ms gated blocks (integrated loudness)
+ * and 3 s short-term blocks (loudness range), plus sample peak and
+ * 4x oversampled true peak
+ */
+
+#define LOUDNESS_TP_FACTOR 4
+#define LOUDNESS_TP_TAPS 12 /* per phase */
+
+struct loudness_biquad {
+	double b0, b1, b2, a1, a2;
+};
+
+struct loudness_channel {
+	double z[2][2]; /* biquad state, pre-filter and high-pass */
+	float tp_hist[LOUDNESS_TP_TAPS - 1];
+};
+
+struct loudness_blocks {
+	double *energy;
+	int64_t n;
+	int64_t a;
+};
+
+struct loudness {
+	int channels;
+	int rate;
+	struct loudness_biquad pre;
+	struct loudness_biquad rlb;
+	float tp_coef[LOUDNESS_TP_FACTOR][LOUDNESS_TP_TAPS];
+	struct loudness_channel ch[2];
+
+	int sub_len; /* samples per 100 ms */
+	int sub_fill;
+	double sub_sum;
+	double sub[30]; /* ring of the last 3 s of sub-block energies */
+	int64_t subs;
+
+	struct loudness_blocks momentary[1]; /* 400 ms, 75% overlap */
+	struct loudness_blocks short_term[1]; /* 3 s, every 100 ms */
+
+	int sample_peak;
+	float true_peak;
+};
+
+void loudness_init(struct loudness *ld, int channels, int rate);
+void loudness_update(struct loudness *ld, const int16_t *samples, int n);
+
+/* appends the measurements as json object members, no braces
+ */
+void loudness_json(struct loudness *ld, struct str *out);
+
+void loudness_free(struct loudness *ld);
+
+#ifdef __cplusplus
+}; /* end of function prototypes */
+#endif
+
+#endif /* ! t6jw0a3nxy8dc5rv2m loudness-h */
@@ -0,0 +1,285 @@
+/*
+
+Copyright (c) 2012, Alexandre Girao <alexgirao@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+#include <sys/stat.h>
+
+#include "debug0.h"
+#include "str.h"
+#include "hash.h"
+#include "manifest.h"
+
+#define BOM 0x0a0b0c0du
+
+struct record {
+	uint64_t hash;
+	int64_t size;
+	int64_t mtime;
+	uint32_t path_len;
+	uint32_t nsounds;
+};
+
+static struct manifest_entry *find_slot(struct manifest_entry *slots, int cap, uint64_t key, const char *path)
+{
+	int i = key & (cap - 1);
+	while (slots[i].path && (slots[i].key != key || strcmp(slots[i].path, path) != 0)) {
+		i = (i + 1) & (cap - 1);
+	}
+	return slots + i;
+}
+
+static void grow(struct manifest *m)
+{
+	int i, cap = m->cap * 2;
+	struct manifest_entry *slots = calloc(cap, sizeof(struct manifest_entry));
+	assert(slots);
+	for (i=0; i<m->cap; i++) {
+		if (m->slots[i].path) {
+			*find_slot(slots, cap, m->slots[i].key, m->slots[i].path) = m->slots[i];
+		}
+	}
+	free(m->slots);
+	m->slots = slots;
+	m->cap = cap;
+}
+
+static void put(struct manifest *m, const char *path, int path_len, uint64_t hash, int64_t size, int64_t mtime, const struct manifest_sound *sounds, int nsounds)
+{
+	uint64_t key = hash_xxh3_64(path, path_len);
+	struct manifest_entry *e;
+	char *p;
+
+	/* path is not terminated when it comes from the file
+	 */
+	p = malloc(path_len + 1);
+	assert(p);
+	memcpy(p, path, path_len);
+	p[path_len] = 0;
+
+	e = find_slot(m->slots, m->cap, key, p);
+	if (e->path) {
+		free(p);
+		free(e->sounds);
+	} else {
+		e->path = p;
+		e->key = key;
+		m->used++;
+	}
+	e->hash = hash;
+	e->size = size;
+	e->mtime = mtime;
+	e->nsounds = nsounds;
+	e->sounds = NULL;
+	if (nsounds) {
+		e->sounds = malloc(nsounds * sizeof(struct manifest_sound));
+		assert(e->sounds);
+		memcpy(e->sounds, sounds, nsounds * sizeof(struct manifest_sound));
+	}
+
+	/* keep the load factor under 1/2
+	 */
+	if (m->used * 2 > m->cap) {
+		grow(m);
+	}
+}
+
+int manifest_load(struct manifest *m, const char *file)
+{
+	DEFINE_STR(buf);
+	const char *p, *end;
+	uint64_t count, i;
+	uint32_t bom;
+	int fd;
+
+	memset(m, 0, sizeof(*m));
+	m->file = file;
+	m->cap = 1024;
+	m->slots = calloc(m->cap, sizeof(struct manifest_entry));
+	assert(m->slots);
+	pthread_mutex_init(&m->lock, NULL);
+
+	if ((fd = open(file, O_RDONLY)) < 0) {
+		if (errno == ENOENT) {
+			return 0;
+		}
+		perror(file);
+		return -1;
+	}
+	for (;;) {
+		ssize_t n;
+		str_alloc(buf, buf->len + 0x10000);
+		if ((n = read(fd, buf->s + buf->len, buf->a - buf->len)) <= 0) {
+			if (n < 0 && errno == EINTR) continue;
+			break;
+		}
+		buf->len += n;
+	}
+	close(fd);
+
+	p = buf->s;
+	end = p + buf->len;
+	if (end - p < 20 || memcmp(p, MANIFEST_MAGIC, 8) != 0) {
+		LOG(D0_ERROR, "error: [%s] is not a manifest", file);
+		str_free(buf);
+		return -1;
+	}
+	memcpy(&bom, p + 8, 4);
+	memcpy(&count, p + 12, 8);
+	p += 20;
+	if (bom != BOM) {
+		LOG(D0_WARN, "[%s] written with another byte order, starting over", file);
+		str_free(buf);
+		return 0;
+	}
+
+	for (i=0; i<count; i++) {
+		struct record r;
+		if (end - p < sizeof(r)) {
+			break;
+		}
+		memcpy(&r, p, sizeof(r));
+		p += sizeof(r);
+		if (end - p < r.path_len + (int64_t)r.nsounds * sizeof(struct manifest_sound)) {
+			break;
+		}
+		/* sounds are 4 bytes, alignment is not a concern for the copy
+		 */
+		put(m, p, r.path_len, r.hash, r.size, r.mtime, (const struct manifest_sound*)(p + r.path_len), r.nsounds);
+		p += r.path_len + r.nsounds * sizeof(struct manifest_sound);
+	}
+	if (i < count) {
+		LOG(D0_WARN, "[%s] truncated after %llu of %llu records", file, (unsigned long long)i, (unsigned long long)count);
+	}
+
+	str_free(buf);
+	return 0;
+}
+
+int manifest_get(struct manifest *m, const char *path, struct manifest_entry *e, struct str *sounds)
+{
+	struct manifest_entry *s;
+	int ret = -1;
+
+	pthread_mutex_lock(&m->lock);
+	s = find_slot(m->slots, m->cap, hash_xxh3_64(path, strlen(path)), path);
+	if (s->path) {
+		int bytes = s->nsounds * sizeof(struct manifest_sound);
+		*e = *s;
+		str_alloc(sounds, bytes + 1);
+		memcpy(sounds->s, s->sounds, bytes);
+		sounds->len = bytes;
+		e->sounds = (struct manifest_sound*)sounds->s;
+		e->path = NULL;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&m->lock);
+	return ret;
+}
+
+void manifest_put(struct manifest *m, const char *path, uint64_t hash, int64_t size, int64_t mtime, const struct manifest_sound *sounds, int nsounds)
+{
+	pthread_mutex_lock(&m->lock);
+	put(m, path, strlen(path), hash, size, mtime, sounds, nsounds);
+	m->dirty = 1;
+	pthread_mutex_unlock(&m->lock);
+}
+
+static int write_all(FILE *f, const void *p, size_t len)
+{
+	return fwrite(p, 1, len, f) == len ? 0 : -1;
+}
+
+int manifest_save(struct manifest *m)
+{
+	DEFINE_STR(tmp);
+	uint32_t bom = BOM;
+	uint64_t count = m->used;
+	int i, ret = 0;
+	FILE *f;
+
+	if (!m->dirty) {
+		return 0;
+	}
+	str_copyf(tmp, "%s.tmp", m->file);
+	if ((f = fopen(tmp->s, "w")) == NULL) {
+		perror(tmp->s);
+		str_free(tmp);
+		return -1;
+	}
+	ret |= write_all(f, MANIFEST_MAGIC, 8);
+	ret |= write_all(f, &bom, 4);
+	ret |= write_all(f, &count, 8);
+	for (i=0; i<m->cap && !ret; i++) {
+		struct manifest_entry *e = m->slots + i;
+		struct record r;
+		if (!e->path) {
+			continue;
+		}
+		memset(&r, 0, sizeof(r));
+		r.hash = e->hash;
+		r.size = e->size;
+		r.mtime = e->mtime;
+		r.path_len = strlen(e->path);
+		r.nsounds = e->nsounds;
+		ret |= write_all(f, &r, sizeof(r));
+		ret |= write_all(f, e->path, r.path_len);
+		ret |= write_all(f, e->sounds, e->nsounds * sizeof(struct manifest_sound));
+	}
+	if (fclose(f) != 0 || ret || rename(tmp->s, m->file) != 0) {
+		perror(m->file);
+		unlink(tmp->s);
+		ret = -1;
+	} else {
+		m->dirty = 0;
+	}
+	str_free(tmp);
+	return ret;
+}
+
+void manifest_free(struct manifest *m)
+{
+	int i;
+	for (i=0; i<m->cap; i++) {
+		free(m->slots[i].path);
+		free(m->slots[i].sounds);
+	}
+	free(m->slots);
+	m->slots = NULL;
+	pthread_mutex_destroy(&m->lock);
+}
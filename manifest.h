@@ -0,0 +1,79 @@
+#ifndef n7ck2wf9s4ax0mh6jd /* manifest-h */
+#define n7ck2wf9s4ax0mh6jd /* manifest-h */
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "str.h"
+
+#ifdef __cplusplus
+extern "C" { /* assume C declarations for C++ */
+#endif
+
+/* what extract-assets did with every input: keyed by path, with the
+ * size, mtime and XXH3-64 it had and the sounds written for it, an
+ * input whose size and mtime did not change is skipped on a lookup
+ *
+ * on disk: MANIFEST_MAGIC, a byte order mark, the record count, then
+ * per record UI64 hash, SI64 size, SI64 mtime (ns), UI32 path length,
+ * UI32 sound count, the path and the sounds, host byte order
+ */
+
+#define MANIFEST_MAGIC "ADPCMMF1"
+
+/* outputs written for a sound
+ */
+#define MANIFEST_ADPCM 1
+#define MANIFEST_WAV 2
+#define MANIFEST_MP3 4
+
+struct manifest_sound {
+	uint16_t id;
+	uint8_t format; /* SoundFormat */
+	uint8_t outputs;
+};
+
+struct manifest_entry {
+	char *path; /* NULL for a free slot */
+	uint64_t key; /* of path */
+	uint64_t hash; /* of contents */
+	int64_t size;
+	int64_t mtime;
+	uint32_t nsounds;
+	struct manifest_sound *sounds;
+};
+
+struct manifest {
+	const char *file;
+	pthread_mutex_t lock;
+	struct manifest_entry *slots;
+	int cap; /* power of two */
+	int used;
+	int dirty;
+};
+
+/* a missing file starts an empty manifest, returns -1 on one that can
+ * not be read
+ */
+int manifest_load(struct manifest *m, const char *file);
+
+/* copies the record for path into e, sounds into the caller's buffer,
+ * returns 0, or -1 when there is none
+ */
+int manifest_get(struct manifest *m, const char *path, struct manifest_entry *e, struct str *sounds);
+
+/* adds or replaces the record for path
+ */
+void manifest_put(struct manifest *m, const char *path, uint64_t hash, int64_t size, int64_t mtime, const struct manifest_sound *sounds, int nsounds);
+
+/* rewrites the file when something changed, under a temporary name
+ */
+int manifest_save(struct manifest *m);
+
+void manifest_free(struct manifest *m);
+
+#ifdef __cplusplus
+}; /* end of function prototypes */
+#endif
+
+#endif /* ! n7ck2wf9s4ax0mh6jd manifest-h */
@@ -0,0 +1,199 @@
+/*
+
+Copyright (c) 2012, Alexandre Girao <alexgirao@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+/*
+ * pull style voice mixer
+ *
+ * mix_voice() is the decode loop of adpcm.c with the store replaced by
+ * a gain multiply-add into the accumulator, it is instantiated for every
+ * (bits per code, channels) like the packet decoders
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "adpcm.h"
+#include "adpcm_core.h"
+#include "mixer.h"
+
+static ALWAYS_INLINE int mix_voice(struct mixer_voice *v, float *acc, int frames, const int bits, const int channels)
+{
+	struct adpcm_state state[2];
+	struct bitreader br[1];
+	const float gl = v->gain[0], gr = v->gain[1];
+	const int header_bits = ADPCM_PACKET_HEADER_BITS * channels;
+	int64_t bitpos = v->bitpos;
+	int left = v->left, done = 0, i, n, c;
+
+	state[0] = v->state[0];
+	state[1] = v->state[1];
+	br_init(br, v->buf, v->nbits, bitpos);
+
+	while (done < frames) {
+		if (left == 0) {
+			int64_t avail;
+
+			/* packet boundary, the only place a loop may jump
+			 */
+			if (v->loop && (bitpos >= v->loop_end || v->nbits - bitpos < header_bits)) {
+				bitpos = v->loop_start;
+				br_init(br, v->buf, v->nbits, bitpos);
+			}
+			avail = v->nbits - bitpos - header_bits;
+			if (avail < 0) {
+				v->playing = 0;
+				break;
+			}
+			left = avail / (bits * channels) > ADPCM_PACKET_CODES ? ADPCM_PACKET_CODES : avail / (bits * channels);
+
+			for (c = 0; c < channels; c++) {
+				state[c].sample = (int16_t)br_get(br, 16); /* SI16 InitialSample */
+				state[c].index = br_get(br, 6);            /* UB[6] InitialIndex */
+			}
+			bitpos += header_bits;
+
+			acc[0] += state[0].sample * gl;
+			acc[1] += state[channels - 1].sample * gr;
+			acc += 2;
+			done++;
+			continue;
+		}
+
+		n = left < frames - done ? left : frames - done;
+
+		for (i = 0; i < n; i++) {
+			if (channels == 1) {
+				float s = decode_code(br_get(br, bits), &state[0], bits);
+				acc[0] += s * gl;
+				acc[1] += s * gr;
+			} else {
+				float l = decode_code(br_get(br, bits), &state[0], bits);
+				float r = decode_code(br_get(br, bits), &state[1], bits);
+				acc[0] += l * gl;
+				acc[1] += r * gr;
+			}
+			acc += 2;
+		}
+
+		left -= n;
+		done += n;
+		bitpos += (int64_t)n * bits * channels;
+	}
+
+	v->state[0] = state[0];
+	v->state[1] = state[1];
+	v->bitpos = bitpos;
+	v->left = left;
+
+	return done;
+}
+
+#define DEFINE_MIXER(bits, channels)					\
+	static int mix_voice_##bits##_##channels(struct mixer_voice *v, float *acc, int frames) \
+	{								\
+		return mix_voice(v, acc, frames, bits, channels);	\
+	}
+
+DEFINE_MIXER(2, 1)
+DEFINE_MIXER(3, 1)
+DEFINE_MIXER(4, 1)
+DEFINE_MIXER(5, 1)
+DEFINE_MIXER(2, 2)
+DEFINE_MIXER(3, 2)
+DEFINE_MIXER(4, 2)
+DEFINE_MIXER(5, 2)
+
+static mixer_voice_fn *const mixers[2][4] = {
+	{mix_voice_2_1, mix_voice_3_1, mix_voice_4_1, mix_voice_5_1},
+	{mix_voice_2_2, mix_voice_3_2, mix_voice_4_2, mix_voice_5_2}
+};
+
+int mixer_voice_init(struct mixer_voice *v, const unsigned char *buf, int64_t len, int channels)
+{
+	memset(v, 0, sizeof(*v));
+	if (len <= 0 || adpcm_stream_init(v->stream, buf, channels)) {
+		return -1;
+	}
+	v->buf = buf;
+	v->nbits = len * 8;
+	v->mix = mixers[channels - 1][v->stream->code_size];
+	mixer_voice_gain(v, 1, 0);
+	mixer_voice_rewind(v);
+	return 0;
+}
+
+void mixer_voice_gain(struct mixer_voice *v, float gain, float pan)
+{
+	float theta;
+
+	pan = pan < -1 ? -1 : pan > 1 ? 1 : pan;
+	theta = (pan + 1) * (float)M_PI / 4;
+	v->gain[0] = gain * cosf(theta) / 32768;
+	v->gain[1] = gain * sinf(theta) / 32768;
+}
+
+void mixer_voice_loop(struct mixer_voice *v, int64_t first, int64_t end)
+{
+	struct adpcm_layout layout[1];
+
+	adpcm_stream_layout(v->stream, v->nbits, layout);
+	if (end <= 0 || end > layout->packets) {
+		end = layout->packets;
+	}
+	if (first < 0 || first >= end) {
+		v->loop = 0;
+		return;
+	}
+	v->loop = 1;
+	v->loop_start = ADPCM_STREAM_START + first * v->stream->packet_bits;
+	v->loop_end = ADPCM_STREAM_START + end * v->stream->packet_bits;
+}
+
+void mixer_voice_rewind(struct mixer_voice *v)
+{
+	v->bitpos = ADPCM_STREAM_START;
+	v->left = 0;
+	v->playing = 1;
+}
+
+void mixer_mix(struct mixer_voice *voices, int nvoices, float *out, int frames)
+{
+	int i;
+
+	memset(out, 0, sizeof(float) * 2 * frames);
+	for (i = 0; i < nvoices; i++) {
+		mixer_voice_mix(voices + i, out, frames);
+	}
+}
@@ -0,0 +1,84 @@
+#ifndef q3vn8ej1wc5rb7ty2k /* mixer-h */
+#define q3vn8ej1wc5rb7ty2k /* mixer-h */
+
+#include <stdint.h>
+
+#include "adpcm.h"
+
+#ifdef __cplusplus
+extern "C" { /* assume C declarations for C++ */
+#endif
+
+/* pull style voice mixer
+ *
+ * a voice plays one ADPCMSOUNDDATA held by the caller, each pull decodes
+ * its next frames straight into an interleaved stereo float accumulator
+ * with the voice gain applied, there is no intermediate s16 buffer
+ *
+ * packets start from their own InitialSample/InitialIndex, so a voice
+ * can loop from any packet boundary back to any earlier one
+ */
+
+struct mixer_voice;
+
+typedef int mixer_voice_fn(struct mixer_voice *v, float *acc, int frames);
+
+struct mixer_voice {
+	struct adpcm_stream stream[1];
+	const unsigned char *buf;
+	int64_t nbits;
+
+	/* bit position of the next code, or of the next packet header when
+	 * left is 0
+	 */
+	int64_t bitpos;
+	int left; /* codes left in the current packet, per channel */
+	struct adpcm_state state[2];
+
+	float gain[2]; /* left and right, 1/32768 folded in */
+
+	int loop;
+	int64_t loop_start; /* bit positions of packet boundaries */
+	int64_t loop_end;
+
+	int playing;
+	mixer_voice_fn *mix;
+};
+
+/* sets up a voice over len bytes of ADPCMSOUNDDATA at unity gain,
+ * centered and not looping, returns -1 on invalid channel count or an
+ * empty payload
+ */
+int mixer_voice_init(struct mixer_voice *v, const unsigned char *buf, int64_t len, int channels);
+
+/* gain is linear, pan goes from -1 (left) to 1 (right) with constant
+ * power, for stereo voices it balances the two channels
+ */
+void mixer_voice_gain(struct mixer_voice *v, float gain, float pan);
+
+/* once playback reaches packet end it goes on from packet first, end 0
+ * means past the last packet, first -1 turns looping off
+ */
+void mixer_voice_loop(struct mixer_voice *v, int64_t first, int64_t end);
+
+/* back to the first packet
+ */
+void mixer_voice_rewind(struct mixer_voice *v);
+
+/* adds the next frames of the voice to acc (frames * 2 floats), returns
+ * the frames added, fewer than asked once a non looping voice ends
+ */
+static inline int mixer_voice_mix(struct mixer_voice *v, float *acc, int frames)
+{
+	return v->playing ? v->mix(v, acc, frames) : 0;
+}
+
+/* clears out (frames * 2 floats) and mixes every voice into it
+ */
+void mixer_mix(struct mixer_voice *voices, int nvoices, float *out, int frames);
+
+#ifdef __cplusplus
+}; /* end of function prototypes */
+#endif
+
+#endif /* ! q3vn8ej1wc5rb7ty2k mixer-h */
@@ -0,0 +1,142 @@
+/*
+
+Copyright (c) 2012, Alexandre Girao <alexgirao@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "adpcm.h"
+#include "hash.h"
+#include "packet_cache.h"
+
+void packet_cache_init(struct packet_cache *pc, int size)
+{
+	memset(pc, 0, sizeof(*pc));
+	pc->entries = calloc(size, sizeof(struct packet_cache_entry));
+	assert(pc->entries);
+	pc->size = size;
+}
+
+/* the packet at bitpos, len bits long, to dst from its first bit, the
+ * bits past len cleared; buf holds nbits
+ */
+static void copy_bits(unsigned char *dst, const unsigned char *buf, int64_t nbits, int64_t bitpos, int64_t len)
+{
+	const unsigned char *p = buf + (bitpos >> 3);
+	const int64_t avail = ((nbits + 7) >> 3) - (bitpos >> 3);
+	const int64_t bytes = (len + 7) >> 3;
+	const int shift = bitpos & 7;
+	int64_t i;
+
+	if (shift == 0) {
+		memcpy(dst, p, bytes);
+	} else {
+		for (i=0; i<bytes; i++) {
+			dst[i] = p[i] << shift | (i + 1 < avail ? p[i + 1] >> (8 - shift) : 0);
+		}
+	}
+	if (len & 7) {
+		dst[bytes - 1] &= 0xff << (8 - (len & 7));
+	}
+}
+
+int packet_cache_decode(struct packet_cache *pc, const struct adpcm_stream *st, const unsigned char *buf, int64_t nbits, int64_t *bitpos, int16_t *out)
+{
+	const int header_bits = ADPCM_PACKET_HEADER_BITS * st->channels;
+	struct packet_cache_entry *e, *victim = pc->entries;
+	int64_t avail = nbits - *bitpos, len, ncodes;
+	const int64_t start = *bitpos;
+	uint64_t hash;
+	int i, n;
+
+	if (avail < header_bits) {
+		return 0;
+	}
+	ncodes = (avail - header_bits) / (st->bits_per_code * st->channels);
+	ncodes = ncodes > ADPCM_PACKET_CODES ? ADPCM_PACKET_CODES : ncodes;
+	len = header_bits + ncodes * st->bits_per_code * st->channels;
+
+	copy_bits(pc->scratch, buf, nbits, *bitpos, len);
+	hash = hash_xxh3_64(pc->scratch, (len + 7) >> 3);
+	pc->clock++;
+
+	for (i=0; i<pc->size; i++) {
+		e = pc->entries + i;
+		if (e->nbits == len && e->hash == hash && e->code_size == st->code_size && e->channels == st->channels
+		    && memcmp(e->packet, pc->scratch, (len + 7) >> 3) == 0) {
+			memcpy(out, e->samples, sizeof(int16_t) * e->n * e->channels);
+			e->used = pc->clock;
+			*bitpos += len;
+			pc->hits++;
+			return e->n;
+		}
+		if (e->used < victim->used) {
+			victim = e;
+		}
+	}
+
+	pc->misses++;
+	if ((n = adpcm_decode_packet(st, buf, nbits, bitpos, out)) <= 0) {
+		return n;
+	}
+	assert(*bitpos == start + len && n == ncodes + 1);
+
+	if (!victim->packet) {
+		victim->packet = malloc(PACKET_CACHE_MAX_BYTES);
+		victim->samples = malloc(sizeof(int16_t) * ADPCM_PACKET_SAMPLES * 2);
+		assert(victim->packet && victim->samples);
+	}
+	victim->hash = hash;
+	victim->nbits = len;
+	victim->code_size = st->code_size;
+	victim->channels = st->channels;
+	victim->n = n;
+	victim->used = pc->clock;
+	memcpy(victim->packet, pc->scratch, (len + 7) >> 3);
+	memcpy(victim->samples, out, sizeof(int16_t) * n * st->channels);
+
+	return n;
+}
+
+void packet_cache_free(struct packet_cache *pc)
+{
+	int i;
+
+	for (i=0; i<pc->size; i++) {
+		free(pc->entries[i].packet);
+		free(pc->entries[i].samples);
+	}
+	free(pc->entries);
+	pc->entries = NULL;
+	pc->size = 0;
+}
@@ -0,0 +1,56 @@
+#ifndef c6wq2n8xr4je0tk5ms /* packet_cache-h */
+#define c6wq2n8xr4je0tk5ms /* packet_cache-h */
+
+#include <stdint.h>
+
+#include "adpcm.h"
+
+#ifdef __cplusplus
+extern "C" { /* assume C declarations for C++ */
+#endif
+
+/* memoization of decoded packets
+ *
+ * a packet's samples depend on its own bits alone (InitialSample and
+ * InitialIndex included) plus the code size and channel count, so runs
+ * of identical packets (digital silence, looped beds) are decoded once
+ * and copied after that; entries are keyed by XXH3-64 of the packet
+ * bits, realigned to a byte boundary, and confirmed by comparing them,
+ * the least recently used one is replaced
+ */
+
+/* a stereo 5-bit packet, 40994 bits */
+#define PACKET_CACHE_MAX_BYTES 5128
+
+struct packet_cache_entry {
+	uint64_t hash;
+	int64_t nbits; /* 0 for a free entry */
+	int code_size;
+	int channels;
+	int n; /* samples per channel */
+	uint64_t used; /* clock of the last hit, for the LRU */
+	unsigned char *packet; /* PACKET_CACHE_MAX_BYTES */
+	int16_t *samples; /* ADPCM_PACKET_SAMPLES * 2 */
+};
+
+struct packet_cache {
+	struct packet_cache_entry *entries;
+	int size; /* 0 when disabled */
+	uint64_t clock;
+	unsigned char scratch[PACKET_CACHE_MAX_BYTES];
+	int64_t hits, misses;
+};
+
+void packet_cache_init(struct packet_cache *pc, int size);
+
+/* adpcm_decode_packet() through the cache, same arguments and result
+ */
+int packet_cache_decode(struct packet_cache *pc, const struct adpcm_stream *st, const unsigned char *buf, int64_t nbits, int64_t *bitpos, int16_t *out);
+
+void packet_cache_free(struct packet_cache *pc);
+
+#ifdef __cplusplus
+}; /* end of function prototypes */
+#endif
+
+#endif /* ! c6wq2n8xr4je0tk5ms packet_cache-h */
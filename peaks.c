@@ -0,0 +1,240 @@
+/*
+
+Copyright (c) 2012, Alexandre Girao <alexgirao@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "debug0.h"
+#include "peaks.h"
+
+static void acc_reset(struct peaks_acc *a)
+{
+	a->min = 32767;
+	a->max = -32768;
+	a->sumsq = 0;
+	a->count = 0;
+}
+
+static void put_le(struct str *s, uint32_t v, int bytes)
+{
+	while (bytes--) {
+		str_catc(s, v & 0xff);
+		v >>= 8;
+	}
+}
+
+int peaks_init(struct peaks *pk, int channels, const char *buckets)
+{
+	const char *cp = buckets;
+	int i, j;
+
+	memset(pk, 0, sizeof(*pk));
+	pk->channels = channels;
+
+	while (*cp) {
+		char *end;
+		long b = strtol(cp, &end, 10);
+		if (end == cp || b <= 0 || b > 0x7fffffff || pk->nlevels == PEAKS_MAX_LEVELS) {
+			return -1;
+		}
+		if (pk->nlevels && b <= pk->level[pk->nlevels - 1].bucket) {
+			return -1; /* ascending only */
+		}
+		pk->level[pk->nlevels++].bucket = b;
+		cp = *end == ',' ? end + 1 : end;
+		if (*end && *end != ',') {
+			return -1;
+		}
+	}
+	if (pk->nlevels == 0) {
+		return -1;
+	}
+
+	/* a level whose bucket is a multiple of a finer one is built from
+	 * that level's buckets instead of from the samples
+	 */
+	for (i=0; i<pk->nlevels; i++) {
+		struct peaks_level *l = &pk->level[i];
+		l->parent = -1;
+		for (j=i-1; j>=0; j--) {
+			if (l->bucket % pk->level[j].bucket == 0) {
+				l->parent = j;
+				break;
+			}
+		}
+		for (j=0; j<channels; j++) {
+			acc_reset(&l->acc[j]);
+		}
+	}
+	return 0;
+}
+
+static void level_push(struct peaks *pk, int li, int ch, const struct peaks_acc *in);
+
+static void level_emit(struct peaks *pk, int li, int ch)
+{
+	struct peaks_level *l = &pk->level[li];
+	struct peaks_acc *a = &l->acc[ch];
+	int rms = a->count ? (int)(sqrt((double)a->sumsq / a->count) + 0.5) : 0;
+	int i;
+
+	put_le(l->data, (uint16_t)a->min, 2);
+	put_le(l->data, (uint16_t)a->max, 2);
+	put_le(l->data, rms > 0xffff ? 0xffff : rms, 2);
+	if (ch == pk->channels - 1) {
+		l->buckets++;
+	}
+
+	for (i=li+1; i<pk->nlevels; i++) {
+		if (pk->level[i].parent == li) {
+			level_push(pk, i, ch, a);
+		}
+	}
+	acc_reset(a);
+}
+
+static void level_push(struct peaks *pk, int li, int ch, const struct peaks_acc *in)
+{
+	struct peaks_acc *a = &pk->level[li].acc[ch];
+	if (in->min < a->min) a->min = in->min;
+	if (in->max > a->max) a->max = in->max;
+	a->sumsq += in->sumsq;
+	a->count += in->count;
+	if (a->count == pk->level[li].bucket) {
+		level_emit(pk, li, ch);
+	}
+}
+
+/* samples are interleaved, n counts all of them
+ */
+void peaks_update(struct peaks *pk, const int16_t *samples, int n)
+{
+	const int channels = pk->channels;
+	int frames = n / channels;
+	int li, ch;
+
+	for (li=0; li<pk->nlevels; li++) {
+		struct peaks_level *l = &pk->level[li];
+		if (l->parent >= 0) {
+			continue;
+		}
+		const int16_t *s = samples;
+		int left = frames;
+		while (left) {
+			int span = l->bucket - l->acc[0].count < left ? l->bucket - l->acc[0].count : left;
+			for (ch=0; ch<channels; ch++) {
+				struct peaks_acc *a = &l->acc[ch];
+				int mn = a->min, mx = a->max, i;
+				int64_t sq = 0;
+				/* tight loop over the packet while it is in L1
+				 */
+				for (i=0; i<span; i++) {
+					int v = s[i * channels + ch];
+					mn = v < mn ? v : mn;
+					mx = v > mx ? v : mx;
+					sq += v * v;
+				}
+				a->min = mn;
+				a->max = mx;
+				a->sumsq += sq;
+				a->count += span;
+			}
+			s += span * channels;
+			left -= span;
+			if (l->acc[0].count == l->bucket) {
+				/* channels are emitted together so entries stay
+				 * interleaved
+				 */
+				for (ch=0; ch<channels; ch++) {
+					level_emit(pk, li, ch);
+				}
+			}
+		}
+	}
+}
+
+int peaks_write(struct peaks *pk, const char *path, int rate)
+{
+	DEFINE_STR(out);
+	int li, ch, fd, ret = 0;
+
+	/* flush partial buckets, finer levels first so that the coarser
+	 * ones built from them see everything
+	 */
+	for (li=0; li<pk->nlevels; li++) {
+		for (ch=0; ch<pk->channels; ch++) {
+			if (pk->level[li].acc[ch].count) {
+				level_emit(pk, li, ch);
+			}
+		}
+	}
+
+	str_copyn(out, "ADPK", 4);
+	put_le(out, 1, 1);
+	put_le(out, pk->channels, 1);
+	put_le(out, pk->nlevels, 2);
+	put_le(out, rate, 4);
+	for (li=0; li<pk->nlevels; li++) {
+		struct peaks_level *l = &pk->level[li];
+		put_le(out, l->bucket, 4);
+		put_le(out, l->buckets, 4);
+		if (str_len(l->data)) {
+			str_catn(out, l->data->s, l->data->len);
+		}
+	}
+
+	if ((fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644)) < 0) {
+		perror(path);
+		ret = -1;
+	} else {
+		if (write(fd, out->s, out->len) != out->len) {
+			LOG(D0_ERROR, "error: short write to [%s]", path);
+			ret = -1;
+		}
+		close(fd);
+	}
+
+	str_free(out);
+	return ret;
+}
+
+void peaks_free(struct peaks *pk)
+{
+	int li;
+	for (li=0; li<pk->nlevels; li++) {
+		str_free(pk->level[li].data);
+	}
+}
@@ -0,0 +1,57 @@
+#ifndef b2xk7wq9d0sm4fe1ny /* peaks-h */
+#define b2xk7wq9d0sm4fe1ny /* peaks-h */
+
+#include <stdint.h>
+
+#include "str.h"
+
+#ifdef __cplusplus
+extern "C" { /* assume C declarations for C++ */
+#endif
+
+/* waveform summary: min, max and rms per bucket of N samples, for
+ * several bucket sizes at once (mipmap style)
+ *
+ * sidecar layout, all little endian:
+ *
+ *   "ADPK", u8 version (1), u8 channels, u16 levels, u32 rate
+ *   per level: u32 bucket size, u32 buckets, then buckets * channels
+ *   entries of s16 min, s16 max, u16 rms
+ */
+
+#define PEAKS_MAX_LEVELS 8
+
+struct peaks_acc {
+	int min;
+	int max;
+	int64_t sumsq;
+	int count;
+};
+
+struct peaks_level {
+	int bucket;
+	int parent; /* level this one is built from, -1 for samples */
+	int64_t buckets;
+	struct peaks_acc acc[2]; /* per channel */
+	struct str data[1];
+};
+
+struct peaks {
+	int channels;
+	int nlevels;
+	struct peaks_level level[PEAKS_MAX_LEVELS];
+};
+
+/* buckets is a comma separated list of sizes, e.g. "256,1024,4096",
+ * returns -1 if it does not parse
+ */
+int peaks_init(struct peaks *pk, int channels, const char *buckets);
+void peaks_update(struct peaks *pk, const int16_t *samples, int n);
+int peaks_write(struct peaks *pk, const char *path, int rate);
+void peaks_free(struct peaks *pk);
+
+#ifdef __cplusplus
+}; /* end of function prototypes */
+#endif
+
+#endif /* ! b2xk7wq9d0sm4fe1ny peaks-h */
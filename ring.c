@@ -0,0 +1,124 @@
+/*
+
+Copyright (c) 2012, Alexandre Girao <alexgirao@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <limits.h>
+#include <assert.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "ring.h"
+
+#define SPINS 256
+
+static void futex_wait(_Atomic uint32_t *word, uint32_t old)
+{
+	syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, old, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *word)
+{
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* returns once *word is no longer old; sleeping is raised before the
+ * last look so the other side, which stores then reads the flag (both
+ * sequentially consistent), can not miss us
+ */
+static void wait_change(_Atomic uint32_t *word, uint32_t old, _Atomic int *sleeping)
+{
+	int i;
+
+	for (i=0; i<SPINS; i++) {
+		if (atomic_load_explicit(word, memory_order_acquire) != old) {
+			return;
+		}
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	}
+	atomic_store(sleeping, 1);
+	while (atomic_load(word) == old) {
+		futex_wait(word, old);
+	}
+	atomic_store(sleeping, 0);
+}
+
+void ring_init(struct ring *r, void **slots, uint32_t size)
+{
+	assert(size && (size & (size - 1)) == 0);
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	atomic_init(&r->consumer_sleeping, 0);
+	atomic_init(&r->producer_sleeping, 0);
+	r->slots = slots;
+	r->size = size;
+}
+
+void *ring_acquire(struct ring *r)
+{
+	uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	uint32_t tail;
+
+	while (head - (tail = atomic_load_explicit(&r->tail, memory_order_acquire)) == r->size) {
+		wait_change(&r->tail, tail, &r->producer_sleeping);
+	}
+	return r->slots[head & (r->size - 1)];
+}
+
+void ring_publish(struct ring *r)
+{
+	atomic_store(&r->head, atomic_load_explicit(&r->head, memory_order_relaxed) + 1);
+	if (atomic_load(&r->consumer_sleeping)) {
+		futex_wake(&r->head);
+	}
+}
+
+void *ring_peek(struct ring *r)
+{
+	uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	uint32_t head;
+
+	while ((head = atomic_load_explicit(&r->head, memory_order_acquire)) == tail) {
+		wait_change(&r->head, head, &r->consumer_sleeping);
+	}
+	return r->slots[tail & (r->size - 1)];
+}
+
+void ring_release(struct ring *r)
+{
+	atomic_store(&r->tail, atomic_load_explicit(&r->tail, memory_order_relaxed) + 1);
+	if (atomic_load(&r->producer_sleeping)) {
+		futex_wake(&r->tail);
+	}
+}
@@ -0,0 +1,52 @@
+#ifndef m1zq6bw8kt3re0hx5v /* ring-h */
+#define m1zq6bw8kt3re0hx5v /* ring-h */
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#ifdef __cplusplus
+extern "C" { /* assume C declarations for C++ */
+#endif
+
+/* single producer, single consumer ring of preallocated slots
+ *
+ * head is only written by the producer and tail by the consumer, each
+ * on its own cache line; the fast path is one acquire load and one
+ * release store, a side that finds the ring full (or empty) spins a
+ * little and then sleeps on a futex until the other side moves
+ */
+
+#define RING_CACHE_LINE 64
+
+struct ring {
+	_Alignas(RING_CACHE_LINE) _Atomic uint32_t head; /* slots published */
+	_Atomic int consumer_sleeping;
+
+	_Alignas(RING_CACHE_LINE) _Atomic uint32_t tail; /* slots released */
+	_Atomic int producer_sleeping;
+
+	_Alignas(RING_CACHE_LINE) void **slots;
+	uint32_t size; /* power of two */
+};
+
+/* size slots, every one of them owned by the ring from now on
+ */
+void ring_init(struct ring *r, void **slots, uint32_t size);
+
+/* producer: the next slot to fill, waits while all of them are in
+ * flight, then ring_publish hands it over
+ */
+void *ring_acquire(struct ring *r);
+void ring_publish(struct ring *r);
+
+/* consumer: the oldest published slot, waits while there is none, then
+ * ring_release gives it back to the producer
+ */
+void *ring_peek(struct ring *r);
+void ring_release(struct ring *r);
+
+#ifdef __cplusplus
+}; /* end of function prototypes */
+#endif
+
+#endif /* ! m1zq6bw8kt3re0hx5v ring-h */
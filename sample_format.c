@@ -0,0 +1,204 @@
+/*
+
+Copyright (c) 2012, Alexandre Girao <alexgirao@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+ * conversion of decoded s16 samples to the output sample formats
+ *
+ * each packet is converted right after decoding, while it is still
+ * hot in cache, so no extra pass over the output is needed; the SSE2
+ * (and SSSE3 for s24le, picked at run time) paths handle 8 samples per
+ * iteration and the scalar loops take care of the tail and of other
+ * architectures
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <tmmintrin.h>
+#define HAVE_SSSE3 1
+#endif
+
+#include "sample_format.h"
+
+static const struct {
+	const char *name;
+	int width;
+} formats[SAMPLE_FORMAT_COUNT] = {
+	[SAMPLE_FORMAT_S16LE] = {"s16le", 2},
+	[SAMPLE_FORMAT_S16BE] = {"s16be", 2},
+	[SAMPLE_FORMAT_S24LE] = {"s24le", 3},
+	[SAMPLE_FORMAT_U8] = {"u8", 1},
+	[SAMPLE_FORMAT_F32LE] = {"f32le", 4},
+};
+
+int sample_format_from_name(const char *name)
+{
+	int i;
+	for (i=0; i<SAMPLE_FORMAT_COUNT; i++) {
+		if (strcmp(formats[i].name, name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+const char *sample_format_name(int fmt)
+{
+	assert(fmt >= 0 && fmt < SAMPLE_FORMAT_COUNT);
+	return formats[fmt].name;
+}
+
+int sample_format_width(int fmt)
+{
+	assert(fmt >= 0 && fmt < SAMPLE_FORMAT_COUNT);
+	return formats[fmt].width;
+}
+
+static void to_s16le(unsigned char *d, const int16_t *s, int n)
+{
+	int i;
+	for (i=0; i<n; i++) {
+		d[2*i] = s[i] & 0xff;
+		d[2*i+1] = (s[i] >> 8) & 0xff;
+	}
+}
+
+static void to_s16be(unsigned char *d, const int16_t *s, int n)
+{
+	int i = 0;
+#ifdef __SSE2__
+	for (; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i*)(d + 2*i), v);
+	}
+#endif
+	for (; i<n; i++) {
+		d[2*i] = (s[i] >> 8) & 0xff;
+		d[2*i+1] = s[i] & 0xff;
+	}
+}
+
+#ifdef HAVE_SSSE3
+/* 8 samples (16 bytes) in, 24 bytes out: the low byte of each s24 is
+ * zero, the two upper bytes are the s16 bytes; returns the samples done
+ */
+__attribute__((target("ssse3")))
+static int to_s24le_ssse3(unsigned char *d, const int16_t *s, int n)
+{
+	const __m128i lo = _mm_setr_epi8(-1, 0, 1, -1, 2, 3, -1, 4, 5, -1, 6, 7, -1, 8, 9, -1);
+	const __m128i hi = _mm_setr_epi8(10, 11, -1, 12, 13, -1, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+	int i;
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+		_mm_storeu_si128((__m128i*)(d + 3*i), _mm_shuffle_epi8(v, lo));
+		_mm_storel_epi64((__m128i*)(d + 3*i + 16), _mm_shuffle_epi8(v, hi));
+	}
+	return i;
+}
+#endif
+
+static void to_s24le(unsigned char *d, const int16_t *s, int n)
+{
+	int i = 0;
+#ifdef HAVE_SSSE3
+	if (__builtin_cpu_supports("ssse3")) {
+		i = to_s24le_ssse3(d, s, n);
+	}
+#endif
+	for (; i<n; i++) {
+		d[3*i] = 0;
+		d[3*i+1] = s[i] & 0xff;
+		d[3*i+2] = (s[i] >> 8) & 0xff;
+	}
+}
+
+static void to_u8(unsigned char *d, const int16_t *s, int n)
+{
+	int i = 0;
+#ifdef __SSE2__
+	const __m128i bias = _mm_set1_epi8(-128);
+	for (; i + 16 <= n; i += 16) {
+		__m128i a = _mm_srai_epi16(_mm_loadu_si128((const __m128i*)(s + i)), 8);
+		__m128i b = _mm_srai_epi16(_mm_loadu_si128((const __m128i*)(s + i + 8)), 8);
+		_mm_storeu_si128((__m128i*)(d + i), _mm_xor_si128(_mm_packs_epi16(a, b), bias));
+	}
+#endif
+	for (; i<n; i++) {
+		d[i] = (s[i] >> 8) + 128;
+	}
+}
+
+static void to_f32le(unsigned char *d, const int16_t *s, int n)
+{
+	const float scale = 1.0f / 32768.0f;
+	int i = 0;
+#if defined(__SSE2__) && (!defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+	const __m128 vscale = _mm_set1_ps(scale);
+	for (; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+		/* sign extend s16 to s32: unpack into the upper half then
+		 * arithmetic shift down
+		 */
+		__m128i l = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		__m128i h = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		_mm_storeu_ps((float*)(d + 4*i), _mm_mul_ps(_mm_cvtepi32_ps(l), vscale));
+		_mm_storeu_ps((float*)(d + 4*i + 16), _mm_mul_ps(_mm_cvtepi32_ps(h), vscale));
+	}
+#endif
+	for (; i<n; i++) {
+		union {float f; uint32_t u;} x;
+		x.f = s[i] * scale;
+		d[4*i] = x.u & 0xff;
+		d[4*i+1] = (x.u >> 8) & 0xff;
+		d[4*i+2] = (x.u >> 16) & 0xff;
+		d[4*i+3] = (x.u >> 24) & 0xff;
+	}
+}
+
+void sample_format_convert(int fmt, void *dst, const int16_t *src, int n)
+{
+	switch (fmt) {
+	case SAMPLE_FORMAT_S16LE: to_s16le(dst, src, n); break;
+	case SAMPLE_FORMAT_S16BE: to_s16be(dst, src, n); break;
+	case SAMPLE_FORMAT_S24LE: to_s24le(dst, src, n); break;
+	case SAMPLE_FORMAT_U8: to_u8(dst, src, n); break;
+	case SAMPLE_FORMAT_F32LE: to_f32le(dst, src, n); break;
+	default:
+		assert(0);
+	}
+}
@@ -0,0 +1,37 @@
+#ifndef k3v9qz0wcm5tb7x1ja /* sample_format-h */
+#define k3v9qz0wcm5tb7x1ja /* sample_format-h */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" { /* assume C declarations for C++ */
+#endif
+
+enum sample_format {
+	SAMPLE_FORMAT_S16LE = 0, /* native decoder output */
+	SAMPLE_FORMAT_S16BE,
+	SAMPLE_FORMAT_S24LE,
+	SAMPLE_FORMAT_U8,
+	SAMPLE_FORMAT_F32LE,
+	SAMPLE_FORMAT_COUNT
+};
+
+/* returns -1 for unknown names
+ */
+int sample_format_from_name(const char *name);
+const char *sample_format_name(int fmt);
+
+/* bytes per converted sample
+ */
+int sample_format_width(int fmt);
+
+/* convert n decoded samples into dst, dst must hold
+ * n * sample_format_width(fmt) bytes
+ */
+void sample_format_convert(int fmt, void *dst, const int16_t *src, int n);
+
+#ifdef __cplusplus
+}; /* end of function prototypes */
+#endif
+
+#endif /* ! k3v9qz0wcm5tb7x1ja sample_format-h */
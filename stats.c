@@ -0,0 +1,75 @@
+/*
+
+Copyright (c) 2012, Alexandre Girao <alexgirao@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <assert.h>
+
+#include "stats.h"
+
+struct stats stats[1] = {{.code_size = -1}};
+
+int64_t stats_clock(void)
+{
+	struct timespec ts[1];
+	assert(clock_gettime(CLOCK_MONOTONIC, ts) == 0);
+	return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+void stats_start(void)
+{
+	stats->start = stats->mark = stats_clock();
+}
+
+void stats_print(FILE *f)
+{
+	static const char *names[STATS_PHASES] = {"read", "parse", "decode", "write"};
+	int64_t elapsed = stats_clock() - stats->start;
+	int i;
+
+	fprintf(f, "{\"bytes_in\": %lld, \"bytes_out\": %lld, \"packets\": %lld, \"samples\": %lld, \"code_size\": %i, \"bits_per_code\": %i",
+		(long long)stats->bytes_in, (long long)stats->bytes_out,
+		(long long)stats->packets, (long long)stats->samples,
+		stats->code_size, stats->code_size < 0 ? 0 : stats->code_size + 2);
+	if (stats->cache_hits || stats->cache_misses) {
+		fprintf(f, ", \"packet_cache\": {\"hits\": %lld, \"misses\": %lld, \"hit_rate\": %.4f}",
+			(long long)stats->cache_hits, (long long)stats->cache_misses,
+			(double)stats->cache_hits / (stats->cache_hits + stats->cache_misses));
+	}
+	fprintf(f, ", \"time_ms\": {");
+	for (i=0; i<STATS_PHASES; i++) {
+		fprintf(f, "%s\"%s\": %.3f", i ? ", " : "", names[i], stats->ns[i] / 1e6);
+	}
+	fprintf(f, ", \"total\": %.3f}", elapsed / 1e6);
+	fprintf(f, ", \"msamples_per_sec\": %.3f", elapsed > 0 ? stats->samples * 1e3 / elapsed : 0.0);
+	fprintf(f, "}\n");
+}
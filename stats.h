@@ -0,0 +1,63 @@
+#ifndef r7dm2hx0pe4nq8wl5c /* stats-h */
+#define r7dm2hx0pe4nq8wl5c /* stats-h */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" { /* assume C declarations for C++ */
+#endif
+
+/* decode counters, sampled at packet granularity
+ *
+ * read is loading the input, parse is the stream header, decode is
+ * everything between writes (packet headers included) and write is
+ * format conversion plus the write itself
+ */
+
+enum stats_phase {
+	STATS_READ = 0,
+	STATS_PARSE,
+	STATS_DECODE,
+	STATS_WRITE,
+	STATS_PHASES
+};
+
+struct stats {
+	int enabled;
+	int64_t bytes_in;
+	int64_t bytes_out;
+	int64_t packets;
+	int64_t samples;
+	int code_size; /* -1 until known */
+	int64_t cache_hits; /* --packet-cache */
+	int64_t cache_misses;
+	int64_t ns[STATS_PHASES];
+	int64_t start; /* monotonic ns */
+	int64_t mark;
+};
+
+extern struct stats stats[1];
+
+int64_t stats_clock(void);
+
+void stats_start(void);
+
+/* charge the time since the last mark to phase and move the mark
+ */
+static inline void stats_phase(int phase)
+{
+	if (stats->enabled) {
+		int64_t now = stats_clock();
+		stats->ns[phase] += now - stats->mark;
+		stats->mark = now;
+	}
+}
+
+void stats_print(FILE *f);
+
+#ifdef __cplusplus
+}; /* end of function prototypes */
+#endif
+
+#endif /* ! r7dm2hx0pe4nq8wl5c stats-h */
@@ -38,21 +38,22 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdarg.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
 
+#include "arena.h"
 #include "str.h"
 
 #define FATAL(msg) do {fprintf(stderr, "fatal:%s:%i:%s\n", __FILE__, __LINE__, msg); exit(1);} while (0)
 
-static void *realloc_(void *x, int m, int n)
+/* realloc can grow in place, only the first m bytes are meaningful
+ */
+static void *realloc_(void *x, int64_t m, int64_t n)
 {
-  void *y = malloc(n);
-  if (!y) return NULL;
-  memcpy(y, x, m);
-  free(x);
-  return y;
+  return realloc(x, n);
 }
 
-static int bdiff(const void *s, int n, const void *t)
+static int bdiff(const void *s, int64_t n, const void *t)
 {
   const char *x=s;
   const char *y=t;
@@ -69,7 +70,7 @@ static int bdiff(const void *s, int n, const void *t)
     - ((int)(unsigned char)*y);
 }
 
-static void bcopyl(void *to, int n, const void *from)
+static void bcopyl(void *to, int64_t n, const void *from)
 {
   char *t = to;
   const char *f = from;
@@ -81,7 +82,7 @@ static void bcopyl(void *to, int n, const void *from)
   }
 }
 
-static void bcopyr(void *to, int n, const void *from)
+static void bcopyr(void *to, int64_t n, const void *from)
 {
   char *t = (char*)to + n;
   const char *f = (char*)from + n;
@@ -93,7 +94,7 @@ static void bcopyr(void *to, int n, const void *from)
   }
 }
 
-static int sdiffn(const char *s, const char *t, int len)
+static int sdiffn(const char *s, const char *t, int64_t len)
 {
   char x;
 
@@ -116,12 +117,12 @@ static int sdiffn(const char *s, const char *t, int len)
 /* alloc/free
  */
 
-void str_alloc(struct str *x, int n)
+void str_alloc(struct str *x, int64_t n)
 {
   if (x->s) {
     if (n > x->a) {
-      int i = n + (n >> 3) + 30;
-      void *p = realloc_(x->s, x->len, i);
+      int64_t i = n + (n >> 3) + 30;
+      void *p = x->arena ? arena_realloc(x->arena, x->s, x->len, i) : realloc_(x->s, x->len, i);
       if (p) {
         x->a = i;
         x->s = p;
@@ -131,12 +132,20 @@ void str_alloc(struct str *x, int n)
     }
     return;
   }
-  x->s = malloc(n);
+  x->s = x->arena ? arena_alloc(x->arena, n) : malloc(n);
   assert(x->s);
   x->a = n;
   x->len = 0;
 }
 
+void str_arena(struct str *x, struct arena *arena)
+{
+  x->s = NULL;
+  x->len = 0;
+  x->a = 0;
+  x->arena = arena;
+}
+
 void str_free(struct str *x)
 {
   if (x->s) {
@@ -144,7 +153,9 @@ void str_free(struct str *x)
     x->s = NULL;
     x->len = 0;
     x->a = 0;
-    free(p);
+    if (!x->arena) {
+      free(p);
+    }
     p = NULL;
   }
 }
@@ -152,7 +163,7 @@ void str_free(struct str *x)
 /* copy
  */
 
-void str_copyn(struct str *sa, const char *s, int n)
+void str_copyn(struct str *sa, const char *s, int64_t n)
 {
   str_alloc(sa, n + 1);
   memcpy(sa->s, s, n);
@@ -182,7 +193,7 @@ void str_copyc(struct str *sa, int c)
 /* cat
  */
 
-void str_catn(struct str *sa, const char *s, int n)
+void str_catn(struct str *sa, const char *s, int64_t n)
 {
   if (!sa->s) {
     str_copyn(sa, s, n);
@@ -266,18 +277,19 @@ void str_vformat(struct str *sa, int cat, const char *fmt, va_list va)
   }
 #else
   int n;
+  int64_t at;
   va_list va2;
 
   va_copy(va2, va);
 
   assert(sa->s == NULL || sa->len <= sa->a);
 
-  cat = cat ? sa->len : 0;
+  at = cat ? sa->len : 0;
 
   /* get needed size, n does not include the trailing '\0'
    */
   if (sa->s) {
-    n = vsnprintf(sa->s + cat, sa->a - cat, fmt, va);
+    n = vsnprintf(sa->s + at, sa->a - at, fmt, va);
   } else {
     n = vsnprintf(NULL, 0, fmt, va); /* this behaviour requires a C99 standard */
   }
@@ -287,17 +299,17 @@ void str_vformat(struct str *sa, int cat, const char *fmt, va_list va)
     exit(1);
   }
 
-  if (sa->s && (cat + n) < sa->a) {
-    /* string is allocated and required space (cat + n) is lesser than
+  if (sa->s && (at + n) < sa->a) {
+    /* string is allocated and required space (at + n) is lesser than
      * allocated buffer, meaning that all non-zero bytes plus the null
      * terminator ('\0') fits in sa->a
      */
-    sa->len = cat + n;
+    sa->len = at + n;
   } else {
     /* no buffer or insufficient buffer size
      */
-    str_alloc(sa, cat + n + 1); /* +1 for null terminator, snprintf requires it */
-    sa->len = cat + vsnprintf(sa->s + cat, sa->a - cat, fmt, va2);
+    str_alloc(sa, at + n + 1); /* +1 for null terminator, snprintf requires it */
+    sa->len = at + vsnprintf(sa->s + at, sa->a - at, fmt, va2);
   }
 
   va_end(va2);
@@ -385,9 +397,9 @@ void str_catftime(struct str *sa, const char *fmt, struct tm *tm)
 /* diff
  */
 
-int str_diffn(struct str *a, char *b, int bl)
+int str_diffn(struct str *a, char *b, int64_t bl)
 {
-  int x = a->len - bl;
+  int64_t x = a->len - bl;
   int y = 0;
 
   if (x > 0) {
@@ -399,7 +411,7 @@ int str_diffn(struct str *a, char *b, int bl)
   } else {
     y = bdiff(a->s, a->len, b);
   }
-  return y ? y : x;
+  return y ? y : (int)x;
 }
 
 int str_diffz(struct str *a, char *b)
@@ -418,7 +430,7 @@ int str_diff(struct str *a, struct str *b)
 
 void str_upper(struct str *s)
 {
-  int i;
+  int64_t i;
   char c;
   for (i=0; i<s->len; i++, c++) {
     c = s->s[i];
@@ -430,7 +442,7 @@ void str_upper(struct str *s)
 
 void str_lower(struct str *s)
 {
-  int i;
+  int64_t i;
   char c;
   for (i=0; i<s->len; i++, c++) {
     c = s->s[i];
@@ -443,9 +455,9 @@ void str_lower(struct str *s)
 /* shift
  */
 
-void str_shiftr(struct str *s, int start, int end, int n, int pad)
+void str_shiftr(struct str *s, int64_t start, int64_t end, int64_t n, int pad)
 {
-  int i, window_size;
+  int64_t i, window_size;
   char *ss;
 
   if (start < 0) {
@@ -480,9 +492,9 @@ void str_shiftr(struct str *s, int start, int end, int n, int pad)
   }
 }
 
-void str_shiftl(struct str *s, int start, int end, int n, int pad)
+void str_shiftl(struct str *s, int64_t start, int64_t end, int64_t n, int pad)
 {
-  int i, window_size;
+  int64_t i, window_size;
   char *ss;
 
   if (start < 0) {
@@ -514,43 +526,41 @@ void str_shiftl(struct str *s, int start, int end, int n, int pad)
   }
 }
 
-void str_shiftr2(struct str *s, int start, int n, int pad)
+void str_shiftr2(struct str *s, int64_t start, int64_t n, int pad)
 {
   str_shiftr(s, start, s->len + n, n, pad);
 }
 
-void str_shiftl2(struct str *s, int start, int n, int pad)
+void str_shiftl2(struct str *s, int64_t start, int64_t n, int pad)
 {
   str_shiftl(s, start, s->len, n, pad);
 }
 
-static off_t get_file_size(const char *f)
+/* plain read(2) straight into the buffer, stdio would allocate a FILE
+ * and its own buffer per file
+ */
+void str_from_file(struct str *s, const char *file)
 {
   struct stat st[1];
-  assert(stat(f, st) == 0);
-  return st->st_size;
-}
-
-static void *get_file_data(const char *fname, off_t fsz, void *buf)
-{
-  FILE *f = fopen(fname, "rb");
-  assert(buf);
-  assert(f);
-  assert(fread(buf, fsz, 1, f) == 1);
-  fclose(f);
-  return buf;
-}
+  off_t fsz, got = 0;
+  int fd = open(file, O_RDONLY);
 
-void str_from_file(struct str *s, const char *file)
-{
-  off_t fsz = get_file_size(file);
+  assert(fd >= 0);
+  assert(fstat(fd, st) == 0);
+  fsz = st->st_size;
   str_alloc(s, fsz + 1);
-  get_file_data(file, fsz, s->s);
+  while (got < fsz) {
+    ssize_t i = read(fd, s->s + got, fsz - got);
+    if (i < 0 && errno == EINTR) continue;
+    assert(i > 0);
+    got += i;
+  }
+  close(fd);
   s->s[fsz] = 0;
   s->len = fsz;
 }
 
-int str_len(struct str *x)
+int64_t str_len(struct str *x)
 {
   return x->s ? x->len : 0;
 }
@@ -2,6 +2,7 @@
 #define nqces94afs4ka2k2fi /* str-h */
 
 #include <time.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" { /* assume C declarations for C++ */
@@ -13,24 +14,32 @@ extern "C" { /* assume C declarations for C++ */
 #define __attribute__(x)
 #endif
 
+struct arena;
+
 struct str {
   char *s;
-  int len; /* can be changed between 0 and a-1 (inclusive) to truncate string */
-  int a; /* allocated */
+  int64_t len; /* can be changed between 0 and a-1 (inclusive) to truncate string */
+  int64_t a; /* allocated */
+  struct arena *arena; /* NULL for the heap */
 };
 
-#define NULL_STR {NULL, 0, 0}
+#define NULL_STR {NULL, 0, 0, NULL}
 #define DEFINE_STR(sym) struct str sym[1] = {NULL_STR}
 
-void str_alloc(struct str *x, int n);
+/* an empty string whose buffer comes from arena, dropped (not freed)
+ * by str_free and gone when the arena is reset
+ */
+void str_arena(struct str *x, struct arena *arena);
+
+void str_alloc(struct str *x, int64_t n);
 void str_free(struct str *x);
 
-void str_copyn(struct str *, const char *, int);
+void str_copyn(struct str *, const char *, int64_t);
 void str_copy(struct str *, const struct str *);
 void str_copyz(struct str *, const char *);
 void str_copyc(struct str *sa, int c);
 
-void str_catn(struct str *, const char *, int);
+void str_catn(struct str *, const char *, int64_t);
 void str_cat(struct str *, const struct str *);
 void str_catz(struct str *, const char *);
 void str_catc(struct str *sa, int c);
@@ -39,14 +48,14 @@ void str_vformat(struct str *sa, int cat, const char *fmt, va_list va);
 void str_copyf(struct str *sa, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
 void str_catf(struct str *sa, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
 
-int str_diffn(struct str *a, char *b, int bl);
+int str_diffn(struct str *a, char *b, int64_t bl);
 int str_diff(struct str *a, struct str *b);
 int str_diffz(struct str *a, char *b);
 
 void str_upper(struct str *s);
 void str_lower(struct str *s);
 
-int str_len(struct str *s);
+int64_t str_len(struct str *s);
 int str_is_empty(struct str *s);
 
 /*
@@ -60,10 +69,10 @@ int str_is_empty(struct str *s);
  *   likewise, end is always len (shift from end of string)
  */
 
-void str_shiftr(struct str *s, int start, int end, int n, int pad);
-void str_shiftl(struct str *s, int start, int end, int n, int pad);
-void str_shiftr2(struct str *s, int start, int n, int pad);
-void str_shiftl2(struct str *s, int start, int n, int pad);
+void str_shiftr(struct str *s, int64_t start, int64_t end, int64_t n, int pad);
+void str_shiftl(struct str *s, int64_t start, int64_t end, int64_t n, int pad);
+void str_shiftr2(struct str *s, int64_t start, int64_t n, int pad);
+void str_shiftl2(struct str *s, int64_t start, int64_t n, int pad);
 
 void str_from_file(struct str *s, const char *file);
 
@@ -0,0 +1,192 @@
+/*
+
+Copyright (c) 2012, Alexandre Girao <alexgirao@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <zlib.h>
+
+#include "debug0.h"
+#include "str.h"
+#include "swf.h"
+
+static uint32_t le32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static int inflate_body(struct swf *swf, const unsigned char *buf, int64_t len, int64_t file_length)
+{
+	struct str *out = swf->inflated;
+	int64_t cap;
+	z_stream z[1];
+	int ret;
+
+	if (file_length < SWF_HEADER_SIZE) {
+		return -1;
+	}
+
+	/* FileLength is only an upper bound, anyone can write 4 GiB in a
+	 * 21 byte file, so the buffer starts near the best deflate ratio
+	 * of the input and grows with what actually inflates
+	 */
+	cap = file_length < 64 * len ? file_length : 64 * len;
+	str_alloc(out, cap + 1);
+	memcpy(out->s, buf, SWF_HEADER_SIZE);
+	out->len = SWF_HEADER_SIZE;
+
+	memset(z, 0, sizeof(z));
+	assert(inflateInit(z) == Z_OK);
+	z->next_in = (unsigned char*)buf + SWF_HEADER_SIZE;
+	do {
+		int64_t in_left = buf + len - z->next_in;
+		if (out->len == cap) {
+			cap = cap < file_length / 2 ? cap * 2 : file_length;
+			str_alloc(out, cap + 1);
+		}
+		z->next_out = (unsigned char*)out->s + out->len;
+		z->avail_out = cap - out->len > (1 << 30) ? 1 << 30 : cap - out->len;
+		z->avail_in = in_left > (1 << 30) ? 1 << 30 : in_left;
+		ret = inflate(z, Z_NO_FLUSH);
+		out->len = (char*)z->next_out - out->s;
+	} while (ret == Z_OK && out->len < file_length);
+	inflateEnd(z);
+
+	/* some writers put a wrong FileLength, take what inflated
+	 */
+	if (ret != Z_STREAM_END && ret != Z_BUF_ERROR && ret != Z_OK) {
+		return -1;
+	}
+	swf->buf = (unsigned char*)out->s;
+	swf->len = out->len;
+	return 0;
+}
+
+int swf_open(struct swf *swf, const unsigned char *buf, int64_t len)
+{
+	int64_t file_length;
+	int nbits;
+
+	swf->buf = NULL;
+	swf->len = 0;
+	swf->pos = 0;
+
+	if (len < SWF_HEADER_SIZE || buf[1] != 'W' || buf[2] != 'S') {
+		return -1;
+	}
+	swf->version = buf[3];
+	file_length = le32(buf + 4);
+
+	if (buf[0] == 'F') {
+		swf->compressed = 0;
+		swf->buf = buf;
+		swf->len = len < file_length ? len : file_length;
+	} else if (buf[0] == 'C') {
+		swf->compressed = 1;
+		if (inflate_body(swf, buf, len, file_length)) {
+			return -1;
+		}
+	} else {
+		return -1; /* ZWS, lzma */
+	}
+
+	/* RECT is 5 bits of nbits then four nbits fields, byte aligned,
+	 * followed by FrameRate and FrameCount
+	 */
+	if (swf->len < SWF_HEADER_SIZE + 1) {
+		return -1;
+	}
+	nbits = swf->buf[SWF_HEADER_SIZE] >> 3;
+	swf->pos = SWF_HEADER_SIZE + (5 + 4 * nbits + 7) / 8 + 4;
+	if (swf->pos > swf->len) {
+		return -1;
+	}
+	return 0;
+}
+
+int swf_next_tag(struct swf *swf, struct swf_tag *tag)
+{
+	const unsigned char *p = swf->buf + swf->pos;
+	int64_t left = swf->len - swf->pos;
+	int hdr;
+
+	if (left < 2) {
+		return left == 0 ? 0 : -1; /* End is sometimes missing */
+	}
+	hdr = p[0] | p[1] << 8;
+	tag->code = hdr >> 6;
+	tag->len = hdr & 0x3f;
+	p += 2;
+	left -= 2;
+	if (tag->len == 0x3f) {
+		if (left < 4) {
+			return -1;
+		}
+		tag->len = le32(p);
+		p += 4;
+		left -= 4;
+	}
+	if (tag->len > left) {
+		return -1;
+	}
+	tag->body = p;
+	tag->offset = p - swf->buf;
+	swf->pos = tag->offset + tag->len;
+	return tag->code != SWF_TAG_END;
+}
+
+int swf_define_sound(const struct swf_tag *tag, struct swf_sound *sound)
+{
+	static const int rates[4] = {5512, 11025, 22050, 44100};
+	const unsigned char *p = tag->body;
+
+	if (tag->code != SWF_TAG_DEFINE_SOUND || tag->len < 7) {
+		return -1;
+	}
+	sound->id = p[0] | p[1] << 8;
+	sound->format = p[2] >> 4;
+	sound->rate = rates[(p[2] >> 2) & 3];
+	sound->bits = p[2] & 2 ? 16 : 8;
+	sound->channels = p[2] & 1 ? 2 : 1;
+	sound->samples = le32(p + 3);
+	sound->data = p + 7;
+	sound->len = tag->len - 7;
+	sound->offset = tag->offset + 7;
+	return 0;
+}
+
+void swf_free(struct swf *swf)
+{
+	str_free(swf->inflated);
+	swf->buf = NULL;
+}
@@ -0,0 +1,90 @@
+#ifndef q8m2tz5hw0ky7vd3nc /* swf-h */
+#define q8m2tz5hw0ky7vd3nc /* swf-h */
+
+#include <stdint.h>
+
+#include "str.h"
+
+#ifdef __cplusplus
+extern "C" { /* assume C declarations for C++ */
+#endif
+
+/* SWF File Format Specification Version 10
+ *
+ *   UI8[3]  Signature, FWS or CWS (zlib compressed after the header)
+ *   UI8     Version
+ *   UI32    FileLength, uncompressed, header included
+ *   RECT    FrameSize
+ *   UI16    FrameRate, UI16 FrameCount
+ *   tags, each a RECORDHEADER (UI16 code << 6 | length, length 0x3f
+ *   meaning an UI32 length follows) and its body, up to End
+ */
+
+#define SWF_HEADER_SIZE 8
+
+#define SWF_TAG_END 0
+#define SWF_TAG_DEFINE_SOUND 14
+
+enum swf_sound_format {
+	SWF_SOUND_PCM = 0, /* native endian */
+	SWF_SOUND_ADPCM = 1,
+	SWF_SOUND_MP3 = 2,
+	SWF_SOUND_PCM_LE = 3,
+	SWF_SOUND_NELLYMOSER_16K = 4,
+	SWF_SOUND_NELLYMOSER_8K = 5,
+	SWF_SOUND_NELLYMOSER = 6,
+	SWF_SOUND_SPEEX = 11
+};
+
+struct swf {
+	const unsigned char *buf; /* uncompressed file, header included */
+	int64_t len;
+	int version;
+	int compressed;
+	int64_t pos; /* next tag */
+	struct str inflated[1]; /* buf of a CWS file */
+};
+
+struct swf_tag {
+	int code;
+	const unsigned char *body;
+	int64_t len;
+	int64_t offset; /* of body, in the uncompressed file */
+};
+
+/* DefineSound: UI16 SoundId, UB[4] SoundFormat, UB[2] SoundRate,
+ * UB[1] SoundSize, UB[1] SoundType, UI32 SoundSampleCount, SoundData
+ */
+struct swf_sound {
+	int id;
+	int format;
+	int rate; /* in hz */
+	int bits;
+	int channels;
+	uint32_t samples; /* per channel */
+	const unsigned char *data; /* SoundData */
+	int64_t len;
+	int64_t offset; /* of data, in the uncompressed file */
+};
+
+/* takes the file contents (kept by reference for FWS, inflated into
+ * swf->inflated for CWS) and positions at the first tag, returns -1
+ * when it is not a supported swf
+ */
+int swf_open(struct swf *swf, const unsigned char *buf, int64_t len);
+
+/* returns 1 with the next tag, 0 at End, -1 when truncated
+ */
+int swf_next_tag(struct swf *swf, struct swf_tag *tag);
+
+/* returns -1 when the tag is not a well formed DefineSound
+ */
+int swf_define_sound(const struct swf_tag *tag, struct swf_sound *sound);
+
+void swf_free(struct swf *swf);
+
+#ifdef __cplusplus
+}; /* end of function prototypes */
+#endif
+
+#endif /* ! q8m2tz5hw0ky7vd3nc swf-h */
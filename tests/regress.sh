@@ -0,0 +1,245 @@
+#!/bin/bash
+#
+# regression checks for adpcm_swf2raw, run by "make check"
+# every packet kernel and the packet cache must write the same
+# pcm as the default decoder, hostile inputs must fail cleanly
+#
+
+set -u #x
+
+P=${P:-$(cd "$(dirname "$0")/.." && pwd)/adpcm_swf2raw}
+T=$(mktemp -d)
+trap 'rm -rf "$T"' EXIT
+
+fail=0
+
+bad(){
+    echo "FAIL $*"
+    fail=1
+}
+
+# input of n bytes: random, all zero or all 0xff
+input(){
+    case $2 in
+    rand) head -c $3 /dev/urandom > $1 ;;
+    zero) head -c $3 /dev/zero > $1 ;;
+    ones) head -c $3 /dev/zero | tr '\0' '\377' > $1 ;;
+    esac
+}
+
+# decode $1 into $2 with the remaining options, 0 or 1 is clean
+decode(){
+    local in=$1 out=$2
+    shift 2
+    "$P" -i $in -o $out --log-level error "$@" 2>$T/err
+    local rc=$?
+    [ $rc -le 1 ] || bad "rc $rc: -i $in $*"
+    return $rc
+}
+
+# bytes of the hex string $1
+unhex(){
+    printf "$(echo $1 | sed 's/../\\x&/g')"
+}
+
+# overwrite bytes of $1 at offset $2 with the hex string $3
+poke(){
+    unhex $3 | dd of=$1 bs=1 seek=$2 conv=notrunc status=none
+}
+
+# recompute the checksum of the tar header at the start of $1
+tar_sum(){
+    poke $1 148 2020202020202020
+    local s=$(head -c 512 $1 | od -An -v -tu1 | awk '{ for (i = 1; i <= NF; i++) s += $i } END { print s }')
+    printf '%06o\0 ' $s | dd of=$1 bs=1 seek=148 conv=notrunc status=none
+}
+
+# little endian u16 and u32 of $1 as hex
+le16(){
+    printf '%02x%02x' $(($1 & 255)) $(($1 >> 8 & 255))
+}
+le32(){
+    printf '%s%s' $(le16 $(($1 & 65535))) $(le16 $(($1 >> 16)))
+}
+
+# zlib stream of file $1 (under 64 KiB) in one stored block
+zlib(){
+    local n=$(wc -c < $1)
+    local sum=$(od -An -v -tu1 $1 | awk 'BEGIN { a = 1 } { for (i = 1; i <= NF; i++) { a = (a + $i) % 65521; b = (b + a) % 65521 } } END { printf "%04x%04x", b, a }')
+    unhex 780101$(le16 $n)$(le16 $((n ^ 65535)))
+    cat $1
+    unhex $sum
+}
+
+# hostile input $1 must be refused with 1, not crash or hang
+refuse(){
+    local what=$1
+    shift
+    timeout 60 "$P" --log-level error "$@" 2>/dev/null
+    local rc=$?
+    [ $rc = 1 ] || bad "rc $rc: $what"
+}
+
+for kind in rand zero ones; do
+    for n in 1 3 4096 20000 300000; do
+        for stereo in "" -s; do
+            f=$T/in.adpcm
+            input $f $kind $n
+            decode $f $T/ref.raw $stereo || continue
+            for k in fused unpack pdep prefix table; do
+                if ! decode $f $T/out.raw $stereo -K $k; then
+                    # pdep needs bmi2
+                    grep -q 'unsupported kernel' $T/err || bad "-K $k $kind $n $stereo"
+                    continue
+                fi
+                cmp -s $T/ref.raw $T/out.raw || bad "-K $k $kind $n $stereo differs"
+            done
+            for c in 1 16; do
+                decode $f $T/out.raw $stereo -C $c || bad "-C $c $kind $n $stereo"
+                cmp -s $T/ref.raw $T/out.raw || bad "-C $c $kind $n $stereo differs"
+            done
+            decode $f $T/out.raw $stereo -Q || bad "-Q $kind $n $stereo"
+            cmp -s $T/ref.raw $T/out.raw || bad "-Q $kind $n $stereo differs"
+        done
+    done
+done
+
+# repeated packets must be served by the cache
+for kind in zero ones; do
+    input $T/in.adpcm $kind 300000
+    "$P" -i $T/in.adpcm -o $T/out.raw --log-level error -C 16 -S 2>$T/err
+    grep -q '"hits": [1-9]' $T/err || bad "-C 16 $kind: no cache hits"
+done
+
+# peaks: the sidecar does not depend on the reader, bad lists are refused
+head -c 300000 /dev/urandom > $T/p.adpcm
+"$P" -i $T/p.adpcm -o $T/out.raw -P $T/p1.peaks --log-level error || bad "--peaks"
+"$P" -i $T/p.adpcm -o $T/out.raw -P $T/p2.peaks -Q --log-level error || bad "--peaks -Q"
+[ -s $T/p1.peaks ] && cmp -s $T/p1.peaks $T/p2.peaks || bad "--peaks -Q differs"
+for b in 1024,256 0 abc 256,,1024; do
+    refuse "--peaks-buckets $b" -i $T/p.adpcm -o $T/out.raw -P $T/p3.peaks -B $b
+done
+refuse "--peaks into a missing directory" -i $T/p.adpcm -o $T/out.raw -P $T/missing/p.peaks
+
+# archives
+mkdir $T/a
+head -c 4000 /dev/urandom > $T/a/m.adpcm
+tar -cf $T/ok.tar -C $T/a m.adpcm
+gzip -c $T/ok.tar > $T/ok.tar.gz
+"$P" -i $T/a/m.adpcm -o $T/ref.raw --log-level error
+for f in ok.tar ok.tar.gz; do
+    "$P" --archive -i $T/$f -o $T/out_$f --log-level error || bad "--archive $f"
+    cmp -s $T/ref.raw $T/out_$f/m.adpcm.raw || bad "--archive $f differs"
+done
+
+head -c 700 $T/ok.tar > $T/short.tar
+refuse "truncated tar" --archive -i $T/short.tar -o $T/out
+head -c 1000 $T/ok.tar.gz > $T/short.tar.gz
+refuse "truncated tar.gz" --archive -i $T/short.tar.gz -o $T/out
+
+# size fields: octal past the end, base-256 negative and past 2^63
+for size in 3737373737373737373737 ff0000000000000000000fa0 80000000ffffffffffffffff; do
+    cp $T/ok.tar $T/size.tar
+    poke $T/size.tar 124 $size
+    tar_sum $T/size.tar
+    refuse "tar size $size" --archive -i $T/size.tar -o $T/out
+done
+
+# zip64 central directory and locator offsets far past the end
+unhex 504b0304504b01022d002d00000000000000000000000000000000000000000007000c0000000000000000000000ffffffff612e616470636d010008000010000000000080504b0506000000000100010041000000040000000000 > $T/zip64.zip
+refuse "zip64 offset" --archive -i $T/zip64.zip -o $T/out
+unhex 504b0304504b01022d002d00000000000000000000000000000000000000000007000c0000000000000000000000ffffffff612e616470636d010008000010000000000080504b060700000000f0ffffffffffffff01000000504b0506000000000100010041000000040000000000 > $T/zip64loc.zip
+refuse "zip64 locator" --archive -i $T/zip64loc.zip -o $T/out
+
+# swf: one mono 22 kHz adpcm DefineSound, stored and deflated
+mkdir $T/s
+head -c 4000 /dev/urandom > $T/s/sound.adpcm
+"$P" -i $T/s/sound.adpcm -o $T/ref.raw --log-level error
+{
+    unhex 0000180100bf03$(le32 4007)01001a$(le32 0)
+    cat $T/s/sound.adpcm
+    unhex 0000
+} > $T/s/body
+n=$((8 + $(wc -c < $T/s/body)))
+{ printf 'FWS\x0a'; unhex $(le32 $n); cat $T/s/body; } > $T/s/f.swf
+{ printf 'CWS\x0a'; unhex $(le32 $n); zlib $T/s/body; } > $T/s/c.swf
+for f in f c; do
+    "$P" --extract-assets $T/s/$f.swf --log-level error 2>/dev/null || bad "--extract-assets $f.swf"
+    tail -c +45 $T/s/$f.swf_assets/sound-0001.adpcm.wav | cmp -s $T/ref.raw - || bad "--extract-assets $f.swf differs"
+done
+
+# a 4 GiB FileLength must not be allocated, only what inflates
+{ printf 'CWS\x0a'; unhex ffffffff; zlib $T/s/body; } > $T/s/big.swf
+(ulimit -v 1048576; "$P" --extract-assets $T/s/big.swf --log-level error 2>/dev/null) || bad "--extract-assets big.swf"
+tail -c +45 $T/s/big.swf_assets/sound-0001.adpcm.wav | cmp -s $T/ref.raw - || bad "--extract-assets big.swf differs"
+
+# truncated, the sound cut short must not be written
+head -c 2000 $T/s/f.swf > $T/s/short.swf
+head -c 2000 $T/s/c.swf > $T/s/cshort.swf
+head -c 12 $T/s/c.swf > $T/s/header.swf
+for f in short cshort header; do
+    timeout 60 "$P" --extract-assets $T/s/$f.swf --log-level error 2>/dev/null
+    rc=$?
+    [ $rc -le 1 ] || bad "rc $rc: --extract-assets $f.swf"
+    [ ! -e $T/s/$f.swf_assets/sound-0001.adpcm ] || bad "--extract-assets $f.swf wrote a cut sound"
+done
+
+# manifest: a second run skips the unchanged swf, a rewritten one is redone
+mkdir $T/m
+cp $T/s/f.swf $T/m/
+"$P" --extract-assets $T/m --manifest $T/m.manifest --log-level error 2>$T/err || bad "--manifest"
+grep -q '"adpcm": 1,' $T/err || bad "--manifest first run"
+"$P" --extract-assets $T/m --manifest $T/m.manifest --log-level error 2>$T/err || bad "--manifest again"
+grep -q '"unchanged": 1,' $T/err || bad "--manifest did not skip"
+cp $T/s/c.swf $T/m/f.swf
+"$P" --extract-assets $T/m --manifest $T/m.manifest --log-level error 2>$T/err || bad "--manifest rewritten"
+grep -q '"adpcm": 1,' $T/err || bad "--manifest skipped a rewritten swf"
+
+# and the same swfs as archive members
+tar -cf $T/swf.tar -C $T/s f.swf c.swf big.swf
+"$P" --archive -i $T/swf.tar -o $T/out_swf --log-level error || bad "--archive swf.tar"
+for f in f c big; do
+    cmp -s $T/ref.raw $T/out_swf/$f.swf_assets/sound-0001.raw || bad "--archive $f.swf differs"
+done
+tar -cf $T/swfbad.tar -C $T/s short.swf cshort.swf header.swf
+timeout 60 "$P" --archive -i $T/swfbad.tar -o $T/out_swfbad --log-level error 2>/dev/null
+rc=$?
+[ $rc -le 1 ] || bad "rc $rc: --archive swfbad.tar"
+
+# flv: two mono 22 kHz adpcm audio tags, each restarts the stream
+head -c 4000 /dev/urandom > $T/tag.adpcm
+"$P" -i $T/tag.adpcm -o $T/tag.raw --log-level error
+cat $T/tag.raw $T/tag.raw > $T/ref.raw
+# audio tag of flags $1 and the data in $2
+flv_tag(){
+    local n=$((1 + $(wc -c < $2)))
+    unhex 08$(printf '%06x' $n)00000000000000$1
+    cat $2
+    unhex $(printf '%08x' $((11 + n)))
+}
+{
+    unhex 464c5601040000000900000000
+    flv_tag 1a $T/tag.adpcm
+    flv_tag 1a $T/tag.adpcm
+} > $T/ok.flv
+"$P" --flv -i $T/ok.flv -o $T/out.raw --log-level error || bad "--flv ok.flv"
+cmp -s $T/ref.raw $T/out.raw || bad "--flv ok.flv differs"
+cat $T/ok.flv | "$P" --flv -i - -o $T/out.raw --log-level error || bad "--flv stdin"
+cmp -s $T/ref.raw $T/out.raw || bad "--flv stdin differs"
+
+head -c 2000 $T/ok.flv > $T/short.flv
+refuse "truncated flv" --flv -i $T/short.flv -o $T/out.raw
+head -c 5 $T/ok.flv > $T/header.flv
+refuse "flv header" --flv -i $T/header.flv -o $T/out.raw
+{ unhex 464c5601040000000900000000; unhex 08ffffff0000000000000000; head -c 100 $T/tag.adpcm; } > $T/huge.flv
+refuse "flv tag size past the end" --flv -i $T/huge.flv -o $T/out.raw
+{ unhex 464c56010400ffffff00000000; cat $T/tag.adpcm; } > $T/offset.flv
+refuse "flv data offset past the end" --flv -i $T/offset.flv -o $T/out.raw
+cp $T/ok.flv $T/filter.flv
+poke $T/filter.flv 13 28
+refuse "encrypted flv tag" --flv -i $T/filter.flv -o $T/out.raw
+{ unhex 464c5601040000000900000000; flv_tag 1a $T/tag.adpcm; flv_tag 1b $T/tag.adpcm; } > $T/switch.flv
+refuse "flv channel switch" --flv -i $T/switch.flv -o $T/out.raw
+
+[ $fail = 0 ] && echo "all ok"
+exit $fail